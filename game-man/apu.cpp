@@ -0,0 +1,471 @@
+#include "apu.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    constexpr uint8_t duty_patterns[4][8] = {
+        {0, 0, 0, 0, 0, 0, 0, 1}, // 12.5%
+        {1, 0, 0, 0, 0, 0, 0, 1}, // 25%
+        {1, 0, 0, 0, 0, 1, 1, 1}, // 50%
+        {0, 1, 1, 1, 1, 1, 1, 0}  // 75%
+    };
+
+    // bits that always read back as 1, indexed from 0xFF10
+    constexpr uint8_t read_masks[0x20] = {
+        0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+        0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR20-NR24
+        0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+        0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR40-NR44
+        0x00, 0x00, 0x70,             // NR50-NR52
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+    };
+
+    constexpr uint8_t noise_divisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+    // DC blocking like the real output capacitor, 0.999958 per cycle
+    constexpr float high_pass_charge = 0.998657f;
+
+    int16_t ClampSample(float val)
+    {
+        return static_cast<int16_t>(std::clamp(val, -32768.0f, 32767.0f));
+    }
+}
+
+Apu::Apu(Memory& memory, Scheduler& scheduler): m_Memory(memory), m_Scheduler(scheduler), dropped_samples(0), consumer(nullptr)
+{
+    std::memset(&this->state, 0, sizeof(this->state));
+    this->state.synthesized_cycle = scheduler.Now();
+    this->state.powered = true;
+
+    m_Memory.ConnectApu(*this);
+    m_Scheduler.SetClient(EventType::ApuFrameSequencer, *this);
+    m_Scheduler.Schedule(EventType::ApuFrameSequencer, scheduler.Now() + APU_FRAME_SEQUENCER_CYCLES);
+}
+
+void Apu::OnEvent(EventType, uint64_t cycle)
+{
+    // everything before the step still uses the old lengths/volumes
+    CatchUp(cycle);
+    ClockFrameSequencer();
+
+    m_Scheduler.Schedule(EventType::ApuFrameSequencer, cycle + APU_FRAME_SEQUENCER_CYCLES);
+}
+
+AudioSampleRing& Apu::Samples()
+{
+    return samples;
+}
+
+uint64_t Apu::DroppedSamples() const
+{
+    return dropped_samples.load(std::memory_order_relaxed);
+}
+
+void Apu::AttachConsumer(AudioSampleConsumer* consumer)
+{
+    this->consumer.store(consumer, std::memory_order_release);
+}
+
+void Apu::CatchUp(uint64_t cycle)
+{
+    while (state.synthesized_cycle + APU_CYCLES_PER_SAMPLE <= cycle)
+    {
+        RenderSample();
+        state.synthesized_cycle += APU_CYCLES_PER_SAMPLE;
+    }
+}
+
+void Apu::RenderSample()
+{
+    int32_t outputs[4] = {};
+
+    SquareChannel* squares[2] = { &state.square1, &state.square2 };
+    for (int i = 0; i < 2; ++i)
+    {
+        SquareChannel& channel = *squares[i];
+        if (!channel.enabled)
+            continue;
+
+        channel.timer -= APU_CYCLES_PER_SAMPLE;
+        while (channel.timer <= 0)
+        {
+            channel.timer += SquarePeriod(channel);
+            channel.duty_step = (channel.duty_step + 1) & 0b111;
+        }
+        outputs[i] = duty_patterns[channel.duty][channel.duty_step] * channel.envelope.volume;
+    }
+
+    if (state.wave.enabled)
+    {
+        state.wave.timer -= APU_CYCLES_PER_SAMPLE;
+        while (state.wave.timer <= 0)
+        {
+            state.wave.timer += WavePeriod();
+            state.wave.position = (state.wave.position + 1) & 0b11111;
+        }
+        const uint8_t wave_byte = Register(0xFF30 + state.wave.position / 2);
+        const uint8_t nibble = (state.wave.position & 1) == 0 ? wave_byte >> 4 : wave_byte & 0x0F;
+        outputs[2] = nibble >> state.wave.volume_shift;
+    }
+
+    if (state.noise.enabled)
+    {
+        state.noise.timer -= APU_CYCLES_PER_SAMPLE;
+        while (state.noise.timer <= 0)
+        {
+            state.noise.timer += NoisePeriod();
+            const uint16_t feedback = (state.noise.lfsr & 1) ^ ((state.noise.lfsr >> 1) & 1);
+            state.noise.lfsr = (state.noise.lfsr >> 1) | (feedback << 14);
+            if ((Register(0xFF22) & 0b1000) == 0b1000) // 7 bit mode
+                state.noise.lfsr = (state.noise.lfsr & ~0x40) | (feedback << 6);
+        }
+        outputs[3] = (~state.noise.lfsr & 1) * state.noise.envelope.volume;
+    }
+
+    // DACs map 0..15 to -15..15, a DAC that's off outputs nothing
+    const bool dacs[4] = { state.square1.dac_enabled, state.square2.dac_enabled, state.wave.dac_enabled, state.noise.dac_enabled };
+    const uint8_t panning = Register(0xFF25);
+    int32_t left = 0;
+    int32_t right = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!dacs[i])
+            continue;
+
+        const int32_t analog = outputs[i] * 2 - 15;
+        if ((panning & (0x10 << i)) != 0)
+            left += analog;
+        if ((panning & (0x01 << i)) != 0)
+            right += analog;
+    }
+
+    // NR50 master volume 1-8, 4 channels * 15 * 8 * 64 stays inside int16
+    const uint8_t master = Register(0xFF24);
+    const float scaled_left = static_cast<float>(left * (((master >> 4) & 0b111) + 1) * 64);
+    const float scaled_right = static_cast<float>(right * ((master & 0b111) + 1) * 64);
+
+    const float out_left = scaled_left - state.high_pass_left;
+    state.high_pass_left = scaled_left - out_left * high_pass_charge;
+    const float out_right = scaled_right - state.high_pass_right;
+    state.high_pass_right = scaled_right - out_right * high_pass_charge;
+
+    const AudioSample sample = { ClampSample(out_left), ClampSample(out_right) };
+    if (samples.TryPush(sample))
+        return;
+
+    // a recording can't lose anything, wait for it to catch up, it only gets woken once per full ring
+    AudioSampleConsumer* waiting_on = consumer.load(std::memory_order_acquire);
+    if (waiting_on)
+        waiting_on->OnRingFull();
+    while (waiting_on)
+    {
+        if (samples.TryPush(sample))
+            return;
+        std::this_thread::yield();
+        waiting_on = consumer.load(std::memory_order_acquire);
+    }
+    dropped_samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Apu::ClockFrameSequencer()
+{
+    // step:   0 1 2 3 4 5 6 7
+    // length  x   x   x   x
+    // sweep       x       x
+    // volume                x
+    const uint8_t step = state.frame_sequencer_step;
+    state.frame_sequencer_step = (step + 1) & 0b111;
+
+    if (!state.powered)
+        return;
+
+    if ((step & 1) == 0)
+    {
+        ClockLength(state.square1.enabled, state.square1.length_enabled, state.square1.length);
+        ClockLength(state.square2.enabled, state.square2.length_enabled, state.square2.length);
+        ClockLength(state.wave.enabled, state.wave.length_enabled, state.wave.length);
+        ClockLength(state.noise.enabled, state.noise.length_enabled, state.noise.length);
+    }
+
+    if (step == 2 || step == 6)
+        ClockSweep();
+
+    if (step == 7)
+    {
+        ClockEnvelope(state.square1.envelope);
+        ClockEnvelope(state.square2.envelope);
+        ClockEnvelope(state.noise.envelope);
+    }
+}
+
+void Apu::ClockEnvelope(Envelope& envelope)
+{
+    if (envelope.period == 0)
+        return;
+
+    if (--envelope.timer > 0)
+        return;
+
+    envelope.timer = envelope.period;
+    if (envelope.increase && envelope.volume < 15)
+        ++envelope.volume;
+    else if (!envelope.increase && envelope.volume > 0)
+        --envelope.volume;
+}
+
+void Apu::ClockLength(bool& enabled, bool length_enabled, uint16_t& length)
+{
+    if (!length_enabled || length == 0)
+        return;
+
+    if (--length == 0)
+        enabled = false;
+}
+
+void Apu::ReloadEnvelope(Envelope& envelope, uint8_t nrx2)
+{
+    envelope.volume = nrx2 >> 4;
+    envelope.increase = (nrx2 & 0b1000) == 0b1000;
+    envelope.period = nrx2 & 0b111;
+    envelope.timer = envelope.period;
+}
+
+uint16_t Apu::SweepFrequency()
+{
+    const uint16_t delta = state.sweep.shadow_frequency >> state.sweep.shift;
+    const uint16_t frequency = state.sweep.negate ? state.sweep.shadow_frequency - delta : state.sweep.shadow_frequency + delta;
+
+    if (frequency > 2047)
+        state.square1.enabled = false;
+
+    return frequency;
+}
+
+void Apu::ClockSweep()
+{
+    if (state.sweep.timer > 0)
+        --state.sweep.timer;
+    if (state.sweep.timer > 0)
+        return;
+
+    state.sweep.timer = state.sweep.period != 0 ? state.sweep.period : 8;
+    if (!state.sweep.enabled || state.sweep.period == 0)
+        return;
+
+    const uint16_t frequency = SweepFrequency();
+    if (frequency <= 2047 && state.sweep.shift != 0)
+    {
+        state.sweep.shadow_frequency = frequency;
+        state.square1.frequency = frequency;
+        Register(0xFF13) = frequency & 0xFF;
+        Register(0xFF14) = (Register(0xFF14) & 0b11111000) | (frequency >> 8);
+
+        // overflow check with the new frequency, result thrown away
+        SweepFrequency();
+    }
+}
+
+int32_t Apu::SquarePeriod(const SquareChannel& channel) const
+{
+    return (2048 - channel.frequency) * 4;
+}
+
+int32_t Apu::WavePeriod() const
+{
+    return (2048 - state.wave.frequency) * 2;
+}
+
+int32_t Apu::NoisePeriod() const
+{
+    const uint8_t nr43 = state.registers[0xFF22 - 0xFF10];
+    return noise_divisors[nr43 & 0b111] << (nr43 >> 4);
+}
+
+void Apu::TriggerSquare(SquareChannel& channel, uint8_t nrx2, bool with_sweep)
+{
+    channel.enabled = channel.dac_enabled;
+    if (channel.length == 0)
+        channel.length = 64;
+    channel.timer = SquarePeriod(channel);
+    ReloadEnvelope(channel.envelope, nrx2);
+
+    if (!with_sweep)
+        return;
+
+    const uint8_t nr10 = Register(0xFF10);
+    state.sweep.shadow_frequency = channel.frequency;
+    state.sweep.period = (nr10 >> 4) & 0b111;
+    state.sweep.negate = (nr10 & 0b1000) == 0b1000;
+    state.sweep.shift = nr10 & 0b111;
+    state.sweep.timer = state.sweep.period != 0 ? state.sweep.period : 8;
+    state.sweep.enabled = state.sweep.period != 0 || state.sweep.shift != 0;
+    if (state.sweep.shift != 0)
+        SweepFrequency();
+}
+
+void Apu::TriggerWave()
+{
+    state.wave.enabled = state.wave.dac_enabled;
+    if (state.wave.length == 0)
+        state.wave.length = 256;
+    state.wave.timer = WavePeriod();
+    state.wave.position = 0;
+}
+
+void Apu::TriggerNoise()
+{
+    state.noise.enabled = state.noise.dac_enabled;
+    if (state.noise.length == 0)
+        state.noise.length = 64;
+    state.noise.timer = NoisePeriod();
+    state.noise.lfsr = 0x7FFF;
+    ReloadEnvelope(state.noise.envelope, Register(0xFF21));
+}
+
+void Apu::PowerOff()
+{
+    // everything but wave ram is cleared and stays read only until powered again
+    std::memset(state.registers, 0, 0xFF26 - 0xFF10);
+    state.square1 = {};
+    state.sweep = {};
+    state.square2 = {};
+    state.wave = {};
+    state.noise = {};
+    state.powered = false;
+}
+
+uint8_t Apu::ReadRegister(uint16_t offset) const
+{
+    if (offset >= 0xFF30)
+        return state.registers[offset - 0xFF10];
+
+    if (offset == 0xFF26)
+    {
+        return (state.powered ? 0b10000000 : 0) | read_masks[offset - 0xFF10]
+            | (state.square1.enabled ? 0b0001 : 0) | (state.square2.enabled ? 0b0010 : 0)
+            | (state.wave.enabled ? 0b0100 : 0) | (state.noise.enabled ? 0b1000 : 0);
+    }
+
+    return state.registers[offset - 0xFF10] | read_masks[offset - 0xFF10];
+}
+
+void Apu::WriteRegister(uint16_t offset, uint8_t val)
+{
+    // whatever was playing up to now was played with the old values
+    CatchUp(m_Scheduler.Now());
+
+    if (offset >= 0xFF30)
+    {
+        Register(offset) = val;
+        return;
+    }
+
+    if (offset == 0xFF26) // NR52
+    {
+        const bool power = (val & 0b10000000) == 0b10000000;
+        if (!power && state.powered)
+            PowerOff();
+        else if (power && !state.powered)
+        {
+            state.powered = true;
+            state.frame_sequencer_step = 0;
+        }
+        return;
+    }
+
+    if (!state.powered)
+        return;
+
+    Register(offset) = val;
+
+    switch (offset)
+    {
+    case 0xFF11: // NR11
+        state.square1.duty = val >> 6;
+        state.square1.length = 64 - (val & 0b111111);
+        break;
+    case 0xFF12: // NR12
+        state.square1.dac_enabled = (val & 0b11111000) != 0;
+        if (!state.square1.dac_enabled)
+            state.square1.enabled = false;
+        break;
+    case 0xFF13: // NR13
+        state.square1.frequency = (state.square1.frequency & 0x700) | val;
+        break;
+    case 0xFF14: // NR14
+        state.square1.frequency = (state.square1.frequency & 0xFF) | ((val & 0b111) << 8);
+        state.square1.length_enabled = (val & 0b01000000) != 0;
+        if ((val & 0b10000000) != 0)
+            TriggerSquare(state.square1, Register(0xFF12), true);
+        break;
+    case 0xFF16: // NR21
+        state.square2.duty = val >> 6;
+        state.square2.length = 64 - (val & 0b111111);
+        break;
+    case 0xFF17: // NR22
+        state.square2.dac_enabled = (val & 0b11111000) != 0;
+        if (!state.square2.dac_enabled)
+            state.square2.enabled = false;
+        break;
+    case 0xFF18: // NR23
+        state.square2.frequency = (state.square2.frequency & 0x700) | val;
+        break;
+    case 0xFF19: // NR24
+        state.square2.frequency = (state.square2.frequency & 0xFF) | ((val & 0b111) << 8);
+        state.square2.length_enabled = (val & 0b01000000) != 0;
+        if ((val & 0b10000000) != 0)
+            TriggerSquare(state.square2, Register(0xFF17), false);
+        break;
+    case 0xFF1A: // NR30
+        state.wave.dac_enabled = (val & 0b10000000) != 0;
+        if (!state.wave.dac_enabled)
+            state.wave.enabled = false;
+        break;
+    case 0xFF1B: // NR31
+        state.wave.length = 256 - val;
+        break;
+    case 0xFF1C: // NR32
+    {
+        static constexpr uint8_t shifts[4] = { 4, 0, 1, 2 }; // mute, 100%, 50%, 25%
+        state.wave.volume_shift = shifts[(val >> 5) & 0b11];
+        break;
+    }
+    case 0xFF1D: // NR33
+        state.wave.frequency = (state.wave.frequency & 0x700) | val;
+        break;
+    case 0xFF1E: // NR34
+        state.wave.frequency = (state.wave.frequency & 0xFF) | ((val & 0b111) << 8);
+        state.wave.length_enabled = (val & 0b01000000) != 0;
+        if ((val & 0b10000000) != 0)
+            TriggerWave();
+        break;
+    case 0xFF20: // NR41
+        state.noise.length = 64 - (val & 0b111111);
+        break;
+    case 0xFF21: // NR42
+        state.noise.dac_enabled = (val & 0b11111000) != 0;
+        if (!state.noise.dac_enabled)
+            state.noise.enabled = false;
+        break;
+    case 0xFF23: // NR44
+        state.noise.length_enabled = (val & 0b01000000) != 0;
+        if ((val & 0b10000000) != 0)
+            TriggerNoise();
+        break;
+    default: // NR10, NR43, NR50, NR51 are only looked at when used
+        break;
+    }
+}
+
+void Apu::SaveState(StateWriter& writer) const
+{
+    writer.Write("APU ", state);
+}
+
+void Apu::LoadState(StateReader& reader)
+{
+    reader.Read("APU ", state);
+}
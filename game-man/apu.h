@@ -0,0 +1,159 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#include "memory.h"
+#include "scheduler.h"
+#include "spsc-ring.h"
+
+#define APU_CYCLES_PER_SAMPLE 32
+#define APU_SAMPLE_RATE (GB_CLOCK / APU_CYCLES_PER_SAMPLE) // 131072 Hz
+#define APU_FRAME_SEQUENCER_CYCLES 8192 // 512 Hz
+#ifdef GAMEMAN_COMPACT
+#define APU_SAMPLE_RING_SIZE 1024 // ~8ms, mass hosting rarely listens, whatever isn't drained is dropped
+#else
+#define APU_SAMPLE_RING_SIZE 16384 // ~125ms at the native rate
+#endif
+
+struct AudioSample
+{
+    int16_t left;
+    int16_t right;
+};
+
+using AudioSampleRing = SpscRing<AudioSample, APU_SAMPLE_RING_SIZE>;
+
+// a consumer that has to get every sample, a recording, attached to the Apu it holds the emulation thread
+// on a full ring instead of letting samples drop
+// called on the emulation thread once each time it finds the ring full, before it starts waiting
+class AudioSampleConsumer
+{
+public:
+    virtual ~AudioSampleConsumer() = default;
+    virtual void OnRingFull() = 0;
+};
+
+// the four DMG sound channels, synthesized lazily, nothing runs per instruction
+// samples are only produced when a sound register is written (up to that cycle, with the old settings)
+// and on every frame sequencer step, which is also what keeps the ring topped up
+class Apu : public SchedulerClient
+{
+public:
+    Apu(Memory& memory, Scheduler& scheduler);
+    void OnEvent(EventType type, uint64_t cycle) override;
+
+    uint8_t ReadRegister(uint16_t offset) const;
+    void WriteRegister(uint16_t offset, uint8_t val);
+
+    // drained by whatever plays or records the audio, from any one thread
+    AudioSampleRing& Samples();
+    // samples thrown away because nobody drained the ring in time
+    uint64_t DroppedSamples() const;
+    // with a consumer attached a full ring waits for it to make room, nullptr goes back to dropping
+    // any thread may detach, the consumer has to outlive whatever the emulation thread is doing while it's attached
+    void AttachConsumer(AudioSampleConsumer* consumer);
+
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+private:
+    struct Envelope
+    {
+        uint8_t volume;
+        uint8_t period;
+        uint8_t timer;
+        bool increase;
+    };
+
+    struct SquareChannel
+    {
+        bool enabled;
+        bool dac_enabled;
+        bool length_enabled;
+        uint8_t duty;
+        uint8_t duty_step;
+        uint16_t length;
+        uint16_t frequency;
+        int32_t timer;
+        Envelope envelope;
+    };
+
+    struct Sweep
+    {
+        uint16_t shadow_frequency;
+        uint8_t period;
+        uint8_t timer;
+        uint8_t shift;
+        bool negate;
+        bool enabled;
+    };
+
+    struct WaveChannel
+    {
+        bool enabled;
+        bool dac_enabled;
+        bool length_enabled;
+        uint8_t volume_shift;
+        uint8_t position;
+        uint16_t length;
+        uint16_t frequency;
+        int32_t timer;
+    };
+
+    struct NoiseChannel
+    {
+        bool enabled;
+        bool dac_enabled;
+        bool length_enabled;
+        uint16_t length;
+        uint16_t lfsr;
+        int32_t timer;
+        Envelope envelope;
+    };
+
+    void CatchUp(uint64_t cycle);
+    void RenderSample();
+    void ClockFrameSequencer();
+
+    static void ClockEnvelope(Envelope& envelope);
+    static void ClockLength(bool& enabled, bool length_enabled, uint16_t& length);
+    static void ReloadEnvelope(Envelope& envelope, uint8_t nrx2);
+    uint16_t SweepFrequency();
+    void ClockSweep();
+
+    void TriggerSquare(SquareChannel& channel, uint8_t nrx2, bool with_sweep);
+    void TriggerWave();
+    void TriggerNoise();
+    void PowerOff();
+
+    int32_t SquarePeriod(const SquareChannel& channel) const;
+    int32_t WavePeriod() const;
+    int32_t NoisePeriod() const;
+
+    uint8_t& Register(uint16_t offset)
+    {
+        return state.registers[offset - 0xFF10];
+    }
+
+    Memory& m_Memory;
+    Scheduler& m_Scheduler;
+
+    struct ApuState
+    {
+        uint64_t synthesized_cycle; // samples exist up to here
+        uint8_t registers[0x30]; // 0xFF10 - 0xFF3F, wave ram included
+        uint8_t frame_sequencer_step;
+        bool powered;
+        SquareChannel square1;
+        Sweep sweep;
+        SquareChannel square2;
+        WaveChannel wave;
+        NoiseChannel noise;
+        float high_pass_left;
+        float high_pass_right;
+    };
+    ApuState state;
+
+    AudioSampleRing samples;
+    std::atomic<uint64_t> dropped_samples;
+    std::atomic<AudioSampleConsumer*> consumer;
+};
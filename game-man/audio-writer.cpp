@@ -0,0 +1,196 @@
+#include "audio-writer.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+    void Put16(uint8_t* dest, uint16_t val)
+    {
+        dest[0] = static_cast<uint8_t>(val);
+        dest[1] = static_cast<uint8_t>(val >> 8);
+    }
+
+    void Put32(uint8_t* dest, uint32_t val)
+    {
+        Put16(dest, static_cast<uint16_t>(val));
+        Put16(dest + 2, static_cast<uint16_t>(val >> 16));
+    }
+
+    constexpr uint32_t wav_header_size = 44;
+    constexpr uint16_t channel_count = 2;
+    constexpr uint16_t bytes_per_sample = sizeof(AudioSample);
+}
+
+AudioWriter::AudioWriter(Apu& apu, std::string const& path, AudioFileFormat format, uint32_t output_rate):
+    AudioWriter(apu.Samples(), &apu, path, format, output_rate)
+{
+}
+
+AudioWriter::AudioWriter(AudioSampleRing& samples, std::string const& path, AudioFileFormat format, uint32_t output_rate):
+    AudioWriter(samples, nullptr, path, format, output_rate)
+{
+}
+
+AudioWriter::AudioWriter(AudioSampleRing& samples, Apu* apu, std::string const& path, AudioFileFormat format, uint32_t output_rate):
+    m_Samples(samples), m_Apu(apu), format(format), file(path, std::ios::binary | std::ios::trunc),
+    resampler(APU_SAMPLE_RATE, output_rate), samples_written(0), running(true), ring_full(false)
+{
+    if (!file.is_open())
+        throw std::runtime_error("AudioWriter couldn't open " + path + ": " + std::strerror(errno));
+
+    input_buffer.reserve(APU_SAMPLE_RING_SIZE);
+    output_buffer.reserve(AUDIO_WRITER_BUFFER_SAMPLES * 2);
+    output_bytes.reserve(output_buffer.capacity() * bytes_per_sample);
+
+    // placeholder sizes, patched once the stream ends
+    if (format == AudioFileFormat::Wav)
+        WriteWavHeader(0);
+
+    writer_thread = std::thread(&AudioWriter::WriterLoop, this);
+    if (m_Apu)
+        m_Apu->AttachConsumer(this);
+}
+
+AudioWriter::~AudioWriter()
+{
+    try
+    {
+        Stop();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "AudioWriter: " << e.what() << "\n";
+    }
+}
+
+void AudioWriter::WriteWavHeader(uint32_t data_size)
+{
+    const uint32_t sample_rate = resampler.OutputRate();
+    uint8_t header[wav_header_size];
+
+    std::memcpy(header, "RIFF", 4);
+    Put32(header + 4, wav_header_size - 8 + data_size);
+    std::memcpy(header + 8, "WAVEfmt ", 8);
+    Put32(header + 16, 16); // fmt chunk size
+    Put16(header + 20, 1); // PCM
+    Put16(header + 22, channel_count);
+    Put32(header + 24, sample_rate);
+    Put32(header + 28, sample_rate * bytes_per_sample); // byte rate
+    Put16(header + 32, bytes_per_sample); // block align
+    Put16(header + 34, 16); // bits per channel
+    std::memcpy(header + 36, "data", 4);
+    Put32(header + 40, data_size);
+
+    file.seekp(0, std::ios::beg);
+    file.write(reinterpret_cast<const char*>(header), wav_header_size);
+}
+
+bool AudioWriter::DrainRing()
+{
+    input_buffer.clear();
+    AudioSample sample;
+    while (input_buffer.size() < APU_SAMPLE_RING_SIZE && m_Samples.TryPop(sample))
+        input_buffer.push_back(sample);
+
+    if (input_buffer.empty())
+        return false;
+
+    resampler.Process(input_buffer.data(), input_buffer.size(), output_buffer);
+    if (output_buffer.size() >= AUDIO_WRITER_BUFFER_SAMPLES)
+        FlushBuffer();
+
+    return true;
+}
+
+void AudioWriter::FlushBuffer()
+{
+    if (output_buffer.empty())
+        return;
+
+    // written sample by sample so the file is little endian no matter the host
+    output_bytes.resize(output_buffer.size() * bytes_per_sample);
+    for (std::size_t i = 0; i < output_buffer.size(); ++i)
+    {
+        Put16(&output_bytes[i * bytes_per_sample], static_cast<uint16_t>(output_buffer[i].left));
+        Put16(&output_bytes[i * bytes_per_sample + 2], static_cast<uint16_t>(output_buffer[i].right));
+    }
+
+    file.write(reinterpret_cast<const char*>(output_bytes.data()), output_bytes.size());
+    if (!file)
+        throw std::runtime_error("AudioWriter failed writing samples");
+
+    samples_written.fetch_add(output_buffer.size(), std::memory_order_relaxed);
+    output_buffer.clear();
+}
+
+void AudioWriter::Stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    if (m_Apu)
+        m_Apu->AttachConsumer(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        ring_full = true;
+    }
+    wake.notify_one();
+    writer_thread.join();
+    if (error)
+    {
+        file.close();
+        std::rethrow_exception(error);
+    }
+
+    while (DrainRing())
+    {
+    }
+    FlushBuffer();
+
+    if (format == AudioFileFormat::Wav)
+        WriteWavHeader(static_cast<uint32_t>(samples_written.load() * bytes_per_sample));
+
+    file.close();
+}
+
+uint64_t AudioWriter::SamplesWritten() const
+{
+    return samples_written.load(std::memory_order_relaxed);
+}
+
+void AudioWriter::OnRingFull()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        ring_full = true;
+    }
+    wake.notify_one();
+}
+
+void AudioWriter::WriterLoop()
+{
+    try
+    {
+        while (running.load(std::memory_order_acquire))
+        {
+            if (DrainRing())
+                continue;
+
+            // the ring holds ~125ms of emulated time, a few ms of sleep keeps it far from full at real time speed,
+            // an unthrottled run fills it quicker than that and the emulation thread wakes us up
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(2), [this] { return ring_full; });
+            ring_full = false;
+        }
+    }
+    catch (...)
+    {
+        // nobody drains the ring any more, let the APU go back to dropping so the emulation doesn't wait forever
+        error = std::current_exception();
+        if (m_Apu)
+            m_Apu->AttachConsumer(nullptr);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "apu.h"
+#include "resampler.h"
+
+#define AUDIO_WRITER_BUFFER_SAMPLES 8192 // resampled stereo samples held before each write
+
+enum class AudioFileFormat
+{
+    Wav,
+    RawPcm // interleaved little endian int16 stereo, no header
+};
+
+// headless audio output, drains the APU's sample ring on its own thread, resamples and streams to disk
+// it is the ring's only consumer, the emulation thread never touches the file
+// a failed write stops the thread, the error is kept and thrown from Stop
+// made from the Apu it attaches as its consumer, so an unthrottled run waits for the disk instead of leaving holes,
+// made from just a ring it drains whatever comes and the producer drops what doesn't fit
+class AudioWriter : public AudioSampleConsumer
+{
+public:
+    AudioWriter(Apu& apu, std::string const& path, AudioFileFormat format, uint32_t output_rate);
+    AudioWriter(AudioSampleRing& samples, std::string const& path, AudioFileFormat format, uint32_t output_rate);
+    ~AudioWriter();
+
+    AudioWriter(const AudioWriter&) = delete;
+    AudioWriter& operator=(const AudioWriter&) = delete;
+
+    // detaches from the Apu, stops the thread, writes out whatever is still queued and finishes the WAV header
+    // throws if a write failed, on the thread or here, the destructor stops too but can only print the error
+    // call it from the emulation thread or once that's done with the Apu, it may still be waiting on this otherwise
+    void Stop();
+
+    uint64_t SamplesWritten() const;
+
+    // emulation thread, wakes the writer thread early
+    void OnRingFull() override;
+private:
+    AudioWriter(AudioSampleRing& samples, Apu* apu, std::string const& path, AudioFileFormat format, uint32_t output_rate);
+
+    void WriterLoop();
+    bool DrainRing();
+    void FlushBuffer();
+    void WriteWavHeader(uint32_t data_size);
+
+    AudioSampleRing& m_Samples;
+    Apu* m_Apu; // nullptr when made from a bare ring
+    AudioFileFormat format;
+    std::ofstream file;
+
+    // writer thread state
+    Resampler resampler;
+    std::vector<AudioSample> input_buffer;
+    std::vector<AudioSample> output_buffer;
+    std::vector<uint8_t> output_bytes;
+    std::atomic<uint64_t> samples_written;
+
+    std::atomic<bool> running;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool ring_full; // under wake_mutex
+    std::thread writer_thread;
+    std::exception_ptr error; // set by the writer thread, only read once it's joined
+};
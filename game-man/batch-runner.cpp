@@ -0,0 +1,68 @@
+#include "batch-runner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+BatchRunner::BatchRunner(WorkStealingPool& pool, uint32_t frames_per_slice): m_Pool(pool), frames_per_slice(frames_per_slice)
+{
+    if (frames_per_slice == 0)
+        throw std::runtime_error("A slice has to run at least one frame");
+}
+
+void BatchRunner::RunSlice(Slot& slot, const SliceCallback& on_slice)
+{
+    const std::thread::id thread = std::this_thread::get_id();
+    if (slot.slices != 0 && thread != slot.last_thread)
+        ++slot.migrations;
+    slot.last_thread = thread;
+
+    const uint64_t frames = std::min<uint64_t>(frames_per_slice, slot.frames_left);
+    for (uint64_t i = 0; i < frames; ++i)
+        slot.machine->RunFrame();
+
+    slot.frames_left -= frames;
+    slot.frames_run += frames;
+    ++slot.slices;
+
+    if (on_slice && !on_slice(*slot.machine, slot.index))
+        slot.frames_left = 0;
+
+    // from inside a task this goes onto our own deque
+    if (slot.frames_left != 0)
+        m_Pool.Submit([this, &slot, &on_slice] { RunSlice(slot, on_slice); });
+}
+
+BatchStats BatchRunner::Run(const std::vector<Machine*>& machines, uint64_t frames, const SliceCallback& on_slice)
+{
+    std::vector<Slot> slots(machines.size());
+    for (std::size_t i = 0; i < machines.size(); ++i)
+    {
+        slots[i].machine = machines[i];
+        slots[i].index = i;
+        slots[i].frames_left = frames;
+        slots[i].frames_run = 0;
+        slots[i].slices = 0;
+        slots[i].migrations = 0;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (Slot& slot : slots)
+    {
+        if (slot.frames_left != 0)
+            m_Pool.Submit([this, &slot, &on_slice] { RunSlice(slot, on_slice); });
+    }
+    m_Pool.Wait();
+    const auto end = std::chrono::steady_clock::now();
+
+    // only read once every chain is done, Wait() is the one synchronization point
+    BatchStats stats = {};
+    for (const Slot& slot : slots)
+    {
+        stats.frames += slot.frames_run;
+        stats.slices += slot.slices;
+        stats.steals += slot.migrations;
+    }
+    stats.seconds = std::chrono::duration<double>(end - start).count();
+    return stats;
+}
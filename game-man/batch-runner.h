@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "machine.h"
+#include "work-stealing-pool.h"
+
+struct BatchStats
+{
+    uint64_t frames; // over all machines
+    uint64_t slices;
+    uint64_t steals; // slices that ran on another worker than the previous one of the same machine
+    double seconds;
+};
+
+// runs a batch of independent machines on a pool, every machine is a chain of tasks that each run
+// frames_per_slice frames and then queue the next slice of the same machine
+// a slice only ever touches its own machine and its own slot, nothing is shared between them
+// and the next slice lands on the same worker's deque, so a machine stays on one core unless
+// another one has run out of work and steals it
+class BatchRunner
+{
+public:
+    // called on the worker after every slice, false stops that machine early (test case decided, agent done)
+    using SliceCallback = std::function<bool(Machine& machine, std::size_t index)>;
+
+    explicit BatchRunner(WorkStealingPool& pool, uint32_t frames_per_slice = 1);
+
+    // blocks until every machine ran `frames` frames or was stopped by the callback
+    BatchStats Run(const std::vector<Machine*>& machines, uint64_t frames, const SliceCallback& on_slice = nullptr);
+private:
+    struct alignas(64) Slot
+    {
+        Machine* machine;
+        std::size_t index;
+        uint64_t frames_left;
+        uint64_t frames_run;
+        uint64_t slices;
+        uint64_t migrations;
+        std::thread::id last_thread;
+    };
+
+    void RunSlice(Slot& slot, const SliceCallback& on_slice);
+
+    WorkStealingPool& m_Pool;
+    uint32_t frames_per_slice;
+};
@@ -0,0 +1,172 @@
+#include "battery-saver.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+BatterySaver::BatterySaver(std::string const& path, std::chrono::milliseconds flush_interval): path(path), flush_interval(flush_interval),
+    has_pending(false), flush_requested(false), writing_file(false), running(true), flushes(0)
+{
+    flush_thread = std::thread(&BatterySaver::FlushLoop, this);
+}
+
+BatterySaver::~BatterySaver()
+{
+    try
+    {
+        Stop();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "BatterySaver: " << e.what() << "\n";
+    }
+}
+
+bool BatterySaver::Load(std::vector<uint8_t>& ram) const
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    const std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (contents.size() != ram.size())
+        return false;
+
+    ram = contents;
+    return true;
+}
+
+void BatterySaver::Submit(const std::vector<uint8_t>& ram)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pending = ram;
+    has_pending = true;
+}
+
+void BatterySaver::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (running)
+    {
+        flush_requested = true;
+        wake.notify_one();
+        written.wait(lock, [this] { return !has_pending && !writing_file; });
+    }
+    RethrowError();
+}
+
+void BatterySaver::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (running)
+        {
+            running = false;
+            wake.notify_one();
+        }
+    }
+
+    if (flush_thread.joinable())
+        flush_thread.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    RethrowError();
+}
+
+void BatterySaver::RethrowError()
+{
+    if (!error)
+        return;
+    std::exception_ptr thrown = nullptr;
+    std::swap(thrown, error);
+    std::rethrow_exception(thrown);
+}
+
+uint64_t BatterySaver::Flushes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return flushes;
+}
+
+void BatterySaver::FlushLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait_for(lock, flush_interval, [this] { return !running || flush_requested; });
+
+        if (has_pending)
+        {
+            writing.swap(pending);
+            has_pending = false;
+            writing_file = true;
+
+            // the emulation thread can keep submitting while the file is being written
+            lock.unlock();
+            std::exception_ptr failed = nullptr;
+            try
+            {
+                WriteFile(writing);
+            }
+            catch (...)
+            {
+                failed = std::current_exception();
+            }
+            lock.lock();
+
+            writing_file = false;
+            if (failed)
+            {
+                // the first one is the interesting one, the next submit tries again
+                if (!error)
+                    error = failed;
+            }
+            else
+            {
+                ++flushes;
+            }
+        }
+
+        // a Flush waits for whatever got submitted during the write too
+        if (!has_pending)
+        {
+            flush_requested = false;
+            written.notify_all();
+        }
+        if (!running && !has_pending)
+            return;
+    }
+}
+
+void BatterySaver::WriteFile(const std::vector<uint8_t>& ram)
+{
+    const std::string temp_path = path + ".tmp";
+    std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (file == nullptr)
+        throw std::runtime_error("BatterySaver couldn't open " + temp_path + ": " + std::strerror(errno));
+
+    const bool written = std::fwrite(ram.data(), 1, ram.size(), file) == ram.size() && std::fflush(file) == 0;
+#ifdef _WIN32
+    const bool synced = _commit(_fileno(file)) == 0;
+#else
+    const bool synced = fsync(fileno(file)) == 0;
+#endif
+    std::fclose(file);
+
+    if (!written || !synced)
+        throw std::runtime_error("BatterySaver failed writing " + temp_path + ": " + std::strerror(errno));
+
+    // a crash mid write leaves the previous save in place
+    std::filesystem::rename(temp_path, path);
+}
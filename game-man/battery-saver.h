@@ -0,0 +1,63 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BATTERY_FLUSH_INTERVAL_MS 1000
+#define BATTERY_POLL_FRAMES 60 // how often a running machine hands written cartridge RAM over, about once a second
+
+// writes battery backed cartridge RAM to a .sav file on its own thread
+// the emulation thread only ever copies the RAM into a pending buffer, several submits between two
+// flushes end up as one write, the file is written next to the old one and renamed over it after syncing
+// a failed write doesn't take the flush thread down, the error is kept and thrown from the next Flush or Stop
+class BatterySaver
+{
+public:
+    BatterySaver(std::string const& path, std::chrono::milliseconds flush_interval = std::chrono::milliseconds(BATTERY_FLUSH_INTERVAL_MS));
+    ~BatterySaver();
+
+    BatterySaver(const BatterySaver&) = delete;
+    BatterySaver& operator=(const BatterySaver&) = delete;
+
+    // fills ram with what's on disk, false (and ram untouched) if there's no save yet or it's the wrong size
+    bool Load(std::vector<uint8_t>& ram) const;
+
+    // emulation thread, only holds the lock for the copy
+    void Submit(const std::vector<uint8_t>& ram);
+
+    // returns once everything submitted so far is on disk, throws if a write failed since the last Flush or Stop
+    void Flush();
+
+    // writes whatever is still pending and stops the thread, throws like Flush
+    // the destructor stops too but can only print the error, call this first to get it
+    void Stop();
+
+    uint64_t Flushes() const;
+private:
+    void FlushLoop();
+    void WriteFile(const std::vector<uint8_t>& ram);
+    void RethrowError();
+
+    std::string path;
+    std::chrono::milliseconds flush_interval;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable written;
+    std::vector<uint8_t> pending;
+    bool has_pending;
+    bool flush_requested;
+    bool writing_file;
+    bool running;
+    uint64_t flushes;
+    std::exception_ptr error;
+
+    // flush thread only
+    std::vector<uint8_t> writing;
+    std::thread flush_thread;
+};
@@ -0,0 +1,446 @@
+#include "cartridge.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+    constexpr uint64_t seconds_per_day = 86400;
+    constexpr uint64_t rtc_day_limit = 512;
+
+    std::size_t RamSizeFromHeader(uint8_t code)
+    {
+        switch (code)
+        {
+        case 0x00: return 0;
+        case 0x01: return 0x800;
+        case 0x02: return 0x2000;
+        case 0x03: return 0x8000;
+        case 0x04: return 0x20000;
+        case 0x05: return 0x10000;
+        default:
+            throw std::runtime_error("Cartridge has an unknown RAM size code");
+        }
+    }
+
+    bool TypeHasBattery(uint8_t type)
+    {
+        switch (type)
+        {
+        case 0x03: // MBC1+RAM+BATTERY
+        case 0x06: // MBC2+BATTERY
+        case 0x09: // ROM+RAM+BATTERY
+        case 0x0D: // MMM01+RAM+BATTERY
+        case 0x0F: // MBC3+TIMER+BATTERY
+        case 0x10: // MBC3+TIMER+RAM+BATTERY
+        case 0x13: // MBC3+RAM+BATTERY
+        case 0x1B: // MBC5+RAM+BATTERY
+        case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    std::atomic<uint64_t> next_ram_version(1);
+
+    uint64_t UnixSeconds()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void Put32(uint8_t* dest, uint32_t val)
+    {
+        for (int i = 0; i < 4; ++i)
+            dest[i] = static_cast<uint8_t>(val >> (i * 8));
+    }
+
+    uint32_t Get32(const uint8_t* src)
+    {
+        return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+    }
+}
+
+Cartridge::Cartridge(Memory& memory, Scheduler& scheduler, std::shared_ptr<const std::vector<uint8_t>> rom): m_Memory(memory), m_Scheduler(scheduler),
+    m_Battery(nullptr), rom(std::move(rom)), rtc_written(false)
+{
+    if (this->rom->size() < 2 * CART_ROM_BANK_SIZE || this->rom->size() % CART_ROM_BANK_SIZE != 0)
+        throw std::runtime_error("Cartridge ROM has to be a whole number of 16K banks, at least two");
+
+    std::memset(&this->state, 0, sizeof(this->state));
+    this->state.type = (*this->rom)[CART_TYPE_ADDRESS];
+    this->state.rom_bank = 1;
+    this->state.rtc.clock = static_cast<uint8_t>(RtcClock::Emulated);
+    this->state.rtc.anchor = RtcNow();
+
+    this->mbc = state.type >= 0x0F && state.type <= 0x13 ? Mbc::Mbc3 : Mbc::None;
+
+    // MBC2 has 512 half bytes built in and says 0 in the header
+    const std::size_t ram_size = state.type == 0x05 || state.type == 0x06 ? 0x200 : RamSizeFromHeader((*this->rom)[CART_RAM_SIZE_ADDRESS]);
+    this->ram.assign(ram_size, 0);
+    this->mapped_ram_size = std::min<std::size_t>(ram_size, CART_RAM_BANK_SIZE);
+    this->ram_versions.resize(mapped_ram_size == 0 ? 0 : ram_size / mapped_ram_size);
+    for (std::size_t bank = 0; bank < ram_versions.size(); ++bank)
+        BumpRamVersion(bank);
+
+    // banks 0 and 1 sit next to each other in the ROM too
+    m_Memory.MapBank(0x0000, this->rom->data(), 2 * CART_ROM_BANK_SIZE);
+    m_Memory.ConnectCartridge(*this);
+}
+
+Cartridge::~Cartridge()
+{
+    FlushBattery();
+}
+
+void Cartridge::Write(uint16_t offset, uint8_t val)
+{
+    if (offset < 0x2000)
+    {
+        // RAM (and RTC) enable, 0x0A in the low nibble
+        const bool enable = (val & 0x0F) == 0x0A;
+        if (state.ram_enabled && !enable)
+            FlushBattery();
+        state.ram_enabled = enable;
+        return;
+    }
+
+    if (offset < 0x8000)
+    {
+        if (mbc == Mbc::Mbc3)
+            WriteMbc3(offset, val);
+        return; // ROM stays read only either way
+    }
+
+    if (!state.ram_enabled)
+        return;
+
+    if (state.ram_select >= 0x08)
+    {
+        if (HasRtc() && state.ram_select <= 0x0C)
+            WriteRtc(state.ram_select, val);
+        return;
+    }
+
+    if (static_cast<std::size_t>(offset - 0xA000) < mapped_ram_size)
+        m_Memory.PokeAt(offset, val);
+}
+
+uint8_t Cartridge::ReadRam(uint16_t offset) const
+{
+    if (!state.ram_enabled)
+        return 0xFF;
+
+    if (state.ram_select >= 0x08)
+        return HasRtc() && state.ram_select <= 0x0C ? state.rtc.latched[state.ram_select - 0x08] : 0xFF;
+
+    if (static_cast<std::size_t>(offset - 0xA000) >= mapped_ram_size)
+        return 0xFF;
+
+    return *m_Memory.PeekPtrAt(offset);
+}
+
+void Cartridge::WriteMbc3(uint16_t offset, uint8_t val)
+{
+    if (offset < 0x4000)
+    {
+        MapRomBank(val & 0x7F);
+    }
+    else if (offset < 0x6000)
+    {
+        state.ram_select = val & 0x0F;
+        if (state.ram_select < 0x04)
+            MapRamBank(state.ram_select);
+    }
+    else
+    {
+        if (state.latch_write == 0x00 && val == 0x01)
+            LatchRtc();
+        state.latch_write = val;
+    }
+}
+
+void Cartridge::MapRomBank(uint16_t bank)
+{
+    const std::size_t bank_count = rom->size() / CART_ROM_BANK_SIZE;
+    if (bank == 0)
+        bank = 1;
+    bank = static_cast<uint16_t>(bank % bank_count);
+    if (bank == state.rom_bank)
+        return;
+
+    state.rom_bank = bank;
+    m_Memory.MapBank(0x4000, rom->data() + bank * CART_ROM_BANK_SIZE, CART_ROM_BANK_SIZE);
+}
+
+void Cartridge::MapRamBank(uint8_t bank)
+{
+    const std::size_t bank_count = ram.size() / CART_RAM_BANK_SIZE;
+    if (bank_count <= 1)
+        return;
+
+    bank = static_cast<uint8_t>(bank % bank_count);
+    if (bank == state.mapped_ram_bank)
+        return;
+
+    SyncRamFromMemory();
+    state.mapped_ram_bank = bank;
+    m_Memory.MapBank(0xA000, ram.data() + bank * CART_RAM_BANK_SIZE, CART_RAM_BANK_SIZE);
+}
+
+void Cartridge::SyncRamFromMemory()
+{
+    // only a real change gets a new version, a flush of untouched RAM doesn't send anyone copying banks
+    uint8_t* bank = ram.data() + state.mapped_ram_bank * CART_RAM_BANK_SIZE;
+    if (mapped_ram_size == 0 || std::memcmp(bank, m_Memory.PeekPtrAt(0xA000), mapped_ram_size) == 0)
+        return;
+
+    std::memcpy(bank, m_Memory.PeekPtrAt(0xA000), mapped_ram_size);
+    BumpRamVersion(state.mapped_ram_bank);
+}
+
+void Cartridge::BumpRamVersion(std::size_t bank)
+{
+    ram_versions[bank] = next_ram_version.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::size_t Cartridge::RamBankCount() const
+{
+    return ram_versions.size();
+}
+
+std::size_t Cartridge::RamBankSize() const
+{
+    return mapped_ram_size;
+}
+
+uint64_t Cartridge::RamBankVersion(std::size_t bank) const
+{
+    return ram_versions.at(bank);
+}
+
+const uint8_t* Cartridge::RamBank(std::size_t bank) const
+{
+    return ram.data() + bank * mapped_ram_size;
+}
+
+void Cartridge::WriteRamBank(std::size_t bank, const uint8_t* data)
+{
+    std::memcpy(ram.data() + bank * mapped_ram_size, data, mapped_ram_size);
+    BumpRamVersion(bank);
+}
+
+bool Cartridge::HasBattery() const
+{
+    return TypeHasBattery(state.type) && (!ram.empty() || HasRtc());
+}
+
+bool Cartridge::HasRtc() const
+{
+    return state.type == 0x0F || state.type == 0x10;
+}
+
+std::size_t Cartridge::RamSize() const
+{
+    return ram.size();
+}
+
+uint64_t Cartridge::RtcNow() const
+{
+    if (static_cast<RtcClock>(state.rtc.clock) == RtcClock::Emulated)
+        return m_Scheduler.Now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint64_t Cartridge::RtcTicksPerSecond() const
+{
+    return static_cast<RtcClock>(state.rtc.clock) == RtcClock::Emulated ? GB_CLOCK : 1000000;
+}
+
+uint64_t Cartridge::RtcSeconds() const
+{
+    if (state.rtc.halted)
+        return state.rtc.base_seconds;
+
+    return state.rtc.base_seconds + (RtcNow() - state.rtc.anchor) / RtcTicksPerSecond();
+}
+
+void Cartridge::RebaseRtc()
+{
+    if (state.rtc.halted)
+        return;
+
+    // only whole seconds move into the base, the fraction stays pending in the anchor
+    const uint64_t now = RtcNow();
+    const uint64_t elapsed = (now - state.rtc.anchor) / RtcTicksPerSecond();
+    state.rtc.base_seconds += elapsed;
+    state.rtc.anchor += elapsed * RtcTicksPerSecond();
+
+    if (state.rtc.base_seconds >= rtc_day_limit * seconds_per_day)
+    {
+        state.rtc.day_carry = true;
+        state.rtc.base_seconds %= rtc_day_limit * seconds_per_day;
+    }
+}
+
+void Cartridge::RtcRegisters(uint64_t seconds, uint8_t* registers) const
+{
+    const bool overflowed = seconds >= rtc_day_limit * seconds_per_day;
+    seconds %= rtc_day_limit * seconds_per_day;
+    const uint64_t days = seconds / seconds_per_day;
+
+    registers[0] = static_cast<uint8_t>(seconds % 60);
+    registers[1] = static_cast<uint8_t>(seconds / 60 % 60);
+    registers[2] = static_cast<uint8_t>(seconds / 3600 % 24);
+    registers[3] = static_cast<uint8_t>(days);
+    registers[4] = static_cast<uint8_t>((days >> 8) | (state.rtc.halted ? 0x40 : 0) | (state.rtc.day_carry || overflowed ? 0x80 : 0));
+}
+
+void Cartridge::LatchRtc()
+{
+    RebaseRtc();
+    RtcRegisters(state.rtc.base_seconds, state.rtc.latched);
+}
+
+void Cartridge::WriteRtc(uint8_t reg, uint8_t val)
+{
+    RebaseRtc();
+
+    uint8_t registers[5];
+    RtcRegisters(state.rtc.base_seconds, registers);
+    registers[reg - 0x08] = val;
+
+    const uint64_t days = registers[3] | ((registers[4] & 0x01) << 8);
+    state.rtc.base_seconds = days * seconds_per_day + (registers[2] & 0x1F) * 3600ull + (registers[1] & 0x3F) * 60ull + (registers[0] & 0x3F);
+    state.rtc.day_carry = (registers[4] & 0x80) != 0;
+
+    const bool halt = (registers[4] & 0x40) != 0;
+    if (state.rtc.halted && !halt)
+        state.rtc.anchor = RtcNow();
+    state.rtc.halted = halt;
+
+    // writing the seconds restarts the current second
+    if (reg == 0x08)
+        state.rtc.anchor = RtcNow();
+
+    rtc_written = true;
+}
+
+void Cartridge::SetRtcClock(RtcClock clock)
+{
+    RebaseRtc();
+    state.rtc.clock = static_cast<uint8_t>(clock);
+    state.rtc.anchor = RtcNow();
+}
+
+std::vector<uint8_t> Cartridge::BatteryImage() const
+{
+    std::vector<uint8_t> image(ram);
+    if (!HasRtc())
+        return image;
+
+    uint8_t registers[5];
+    RtcRegisters(RtcSeconds(), registers);
+
+    image.resize(ram.size() + RTC_SAVE_SIZE);
+    uint8_t* footer = image.data() + ram.size();
+    for (int i = 0; i < 5; ++i)
+    {
+        Put32(footer + i * 4, registers[i]);
+        Put32(footer + 20 + i * 4, state.rtc.latched[i]);
+    }
+    const uint64_t timestamp = UnixSeconds();
+    Put32(footer + 40, static_cast<uint32_t>(timestamp));
+    Put32(footer + 44, static_cast<uint32_t>(timestamp >> 32));
+    return image;
+}
+
+void Cartridge::LoadBatteryImage(const std::vector<uint8_t>& image, bool with_rtc)
+{
+    std::memcpy(ram.data(), image.data(), ram.size());
+    for (std::size_t bank = 0; bank < ram_versions.size(); ++bank)
+        BumpRamVersion(bank);
+    m_Memory.MapBank(0xA000, ram.data() + state.mapped_ram_bank * CART_RAM_BANK_SIZE, mapped_ram_size);
+    if (!with_rtc)
+        return;
+
+    const uint8_t* footer = image.data() + ram.size();
+    const uint64_t days = (Get32(footer + 12) & 0xFF) | ((Get32(footer + 16) & 0x01) << 8);
+    state.rtc.base_seconds = days * seconds_per_day + Get32(footer + 8) * 3600ull + Get32(footer + 4) * 60ull + Get32(footer);
+    state.rtc.halted = (Get32(footer + 16) & 0x40) != 0;
+    state.rtc.day_carry = (Get32(footer + 16) & 0x80) != 0;
+    for (int i = 0; i < 5; ++i)
+        state.rtc.latched[i] = static_cast<uint8_t>(Get32(footer + 20 + i * 4));
+
+    // on the host clock the time the game was off counts too, the emulated clock only counts emulated time
+    const uint64_t saved_at = Get32(footer + 40) | (static_cast<uint64_t>(Get32(footer + 44)) << 32);
+    const uint64_t unix_now = UnixSeconds();
+    if (static_cast<RtcClock>(state.rtc.clock) == RtcClock::Host && !state.rtc.halted && unix_now > saved_at)
+        state.rtc.base_seconds += unix_now - saved_at;
+
+    state.rtc.anchor = RtcNow();
+    RebaseRtc();
+}
+
+void Cartridge::AttachBattery(BatterySaver& saver)
+{
+    if (!HasBattery())
+        return;
+
+    m_Battery = &saver;
+    std::vector<uint8_t> image(ram.size() + (HasRtc() ? RTC_SAVE_SIZE : 0));
+    if (saver.Load(image))
+    {
+        LoadBatteryImage(image, HasRtc());
+    }
+    else if (HasRtc())
+    {
+        // a save from something that didn't store the clock
+        image.resize(ram.size());
+        if (saver.Load(image))
+            LoadBatteryImage(image, false);
+    }
+
+    m_Memory.TakeCartRamWritten();
+}
+
+void Cartridge::FlushBattery()
+{
+    const bool ram_written = m_Memory.TakeCartRamWritten();
+    if (m_Battery == nullptr || (!ram_written && !rtc_written))
+        return;
+
+    SyncRamFromMemory();
+    rtc_written = false;
+    m_Battery->Submit(BatteryImage());
+}
+
+void Cartridge::SaveState(StateWriter& writer, bool with_ram) const
+{
+    // the mapped banks are part of the memory chunk, the copy in ram may be stale but it doesn't get loaded back over it
+    writer.Write("CART", state);
+    if (with_ram)
+        writer.WriteChunk("CRAM", ram.data(), ram.size());
+}
+
+void Cartridge::LoadState(StateReader& reader, bool with_ram)
+{
+    // ROM pages are never dirty, without memory the bank the state had mapped has to be copied in here
+    const uint16_t mapped_rom_bank = state.rom_bank;
+    reader.Read("CART", state);
+    if (!with_ram && state.rom_bank != mapped_rom_bank)
+        m_Memory.MapBank(0x4000, rom->data() + state.rom_bank * CART_ROM_BANK_SIZE, CART_ROM_BANK_SIZE);
+    if (with_ram)
+    {
+        reader.ReadChunk("CRAM", ram.data(), ram.size());
+        for (std::size_t bank = 0; bank < ram_versions.size(); ++bank)
+            BumpRamVersion(bank);
+    }
+    // a loaded state replaces what's on the battery too
+    m_Memory.MarkCartRamWritten();
+}
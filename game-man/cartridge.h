@@ -0,0 +1,121 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "battery-saver.h"
+#include "memory.h"
+#include "scheduler.h"
+
+#define CART_TYPE_ADDRESS 0x147
+#define CART_RAM_SIZE_ADDRESS 0x149
+#define CART_ROM_BANK_SIZE 0x4000
+#define CART_RAM_BANK_SIZE 0x2000
+#define RTC_SAVE_SIZE 48 // the usual 5 current + 5 latched u32 registers and a u64 unix timestamp after the RAM
+
+// where the MBC3 clock gets its time from, emulated keeps fast forwarded and replayed runs deterministic
+enum class RtcClock : uint8_t
+{
+    Emulated,
+    Host
+};
+
+// what's plugged into the slot, owns everything the header says is on the board
+// ROM bank 0, the selected ROM bank and the selected RAM bank are copied into Memory so plain reads never
+// come here, only writes into ROM space (the MBC registers) and external RAM accesses do
+class Cartridge
+{
+public:
+    // the ROM is never written, machines running the same game share one copy
+    Cartridge(Memory& memory, Scheduler& scheduler, std::shared_ptr<const std::vector<uint8_t>> rom);
+    ~Cartridge();
+
+    // 0x0000-0x7FFF and 0xA000-0xBFFF
+    void Write(uint16_t offset, uint8_t val);
+    uint8_t ReadRam(uint16_t offset) const;
+
+    bool HasBattery() const;
+    bool HasRtc() const;
+    std::size_t RamSize() const;
+
+    // loads the save if there is one, from then on RAM goes to the saver whenever the game
+    // disables it (which is what games do once they're done saving), every BATTERY_POLL_FRAMES frames
+    // of Machine::RunFrame if it was written, and on shutdown
+    void AttachBattery(BatterySaver& saver);
+    void FlushBattery();
+
+    // switching keeps the clock where it is, it just continues counting with the other source
+    void SetRtcClock(RtcClock clock);
+
+    // RAM banks as the cartridge keeps them, the mapped one lives in Memory and its copy here may be stale
+    // a state without RAM leaves all of them out, whatever restores one incrementally brings back the banks whose
+    // version changed since it last looked, versions come from one process wide counter and only go up
+    std::size_t RamBankCount() const;
+    std::size_t RamBankSize() const;
+    uint64_t RamBankVersion(std::size_t bank) const;
+    const uint8_t* RamBank(std::size_t bank) const;
+    void WriteRamBank(std::size_t bank, const uint8_t* data);
+
+    // without RAM only the banking and clock state goes in, Memory passes its with_memory on
+    void SaveState(StateWriter& writer, bool with_ram = true) const;
+    void LoadState(StateReader& reader, bool with_ram = true);
+private:
+    enum class Mbc : uint8_t
+    {
+        None,
+        Mbc3
+    };
+
+    void WriteMbc3(uint16_t offset, uint8_t val);
+    void MapRomBank(uint16_t bank);
+    void MapRamBank(uint8_t bank);
+    void SyncRamFromMemory();
+    void BumpRamVersion(std::size_t bank);
+
+    // the clock is never ticked, registers are worked out from rtc.base_seconds + time passed since rtc.anchor
+    uint64_t RtcNow() const;
+    uint64_t RtcTicksPerSecond() const;
+    uint64_t RtcSeconds() const;
+    void RebaseRtc();
+    void LatchRtc();
+    void WriteRtc(uint8_t reg, uint8_t val);
+    void RtcRegisters(uint64_t seconds, uint8_t* registers) const;
+
+    std::vector<uint8_t> BatteryImage() const;
+    void LoadBatteryImage(const std::vector<uint8_t>& image, bool with_rtc);
+
+    Memory& m_Memory;
+    Scheduler& m_Scheduler;
+    BatterySaver* m_Battery;
+
+    std::shared_ptr<const std::vector<uint8_t>> rom;
+    // every RAM bank, the one currently mapped lives in Memory and is only copied back here when needed
+    std::vector<uint8_t> ram;
+    std::size_t mapped_ram_size; // how much of 0xA000-0xBFFF is backed by RAM
+    std::vector<uint64_t> ram_versions; // one per bank
+    Mbc mbc;
+    bool rtc_written;
+
+    struct RtcState
+    {
+        uint64_t base_seconds; // clock value at anchor, days past 511 already folded into day_carry
+        uint64_t anchor; // RtcNow() when base_seconds was right
+        uint8_t latched[5]; // S M H DL DH as the game last latched them
+        uint8_t clock;
+        bool halted;
+        bool day_carry;
+    };
+
+    struct CartridgeState
+    {
+        uint8_t type;
+        bool ram_enabled;
+        uint16_t rom_bank;
+        uint8_t ram_select; // 0-3 RAM bank, 0x08-0x0C RTC register
+        uint8_t mapped_ram_bank; // what's in Memory, stays put while an RTC register is selected
+        uint8_t latch_write; // last write to 0x6000-0x7FFF, 0 then 1 latches
+        RtcState rtc;
+    };
+    CartridgeState state;
+};
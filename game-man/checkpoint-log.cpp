@@ -0,0 +1,223 @@
+#include "checkpoint-log.h"
+
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#include "cartridge.h"
+
+namespace
+{
+    constexpr std::size_t record_header_size = 5; // u32 size + u8 kind
+}
+
+CheckpointLog::CheckpointLog(std::string const& path, Cpu& cpu, Memory& memory, uint32_t keyframe_interval):
+    m_Cpu(cpu), m_Memory(memory), file(path, std::ios::binary | std::ios::trunc),
+    keyframe_interval(keyframe_interval), checkpoints(0)
+{
+    if (!file.is_open())
+        throw std::runtime_error("CheckpointLog couldn't open " + path + ": " + std::strerror(errno));
+    if (keyframe_interval == 0)
+        throw std::runtime_error("CheckpointLog keyframe interval can't be 0");
+
+    file.write(CHECKPOINT_LOG_MAGIC, 4);
+}
+
+void CheckpointLog::Append()
+{
+    if (checkpoints % keyframe_interval == 0)
+    {
+        // everything is in the keyframe, start tracking pages and RAM banks from here
+        m_Memory.TakeDirtyPages();
+        TakeChangedRamBanks();
+        WriteRecord(RecordKind::Keyframe);
+    }
+    else
+    {
+        WriteRecord(RecordKind::Pages);
+    }
+
+    ++checkpoints;
+}
+
+void CheckpointLog::WriteRecord(RecordKind kind)
+{
+    StateWriter writer(state);
+    m_Cpu.SaveState(writer, kind == RecordKind::Keyframe);
+
+    if (kind == RecordKind::Pages)
+    {
+        DirtyPages pages = m_Memory.TakeDirtyPages();
+        // IO and HRAM get poked from all over the place without going through the cpu, always take them
+        pages.bits[0xFF >> 6] |= 1ull << (0xFF & 63);
+
+        page_data.clear();
+        for (uint16_t page = 0; page < MEMORY_PAGE_COUNT; ++page)
+        {
+            if (!pages.IsDirty(page))
+                continue;
+            const uint8_t* src = m_Memory.PeekPtrAt(page * MEMORY_PAGE_SIZE);
+            page_data.insert(page_data.end(), src, src + MEMORY_PAGE_SIZE);
+        }
+
+        writer.Write("PGMP", pages);
+        writer.WriteChunk("PAGE", page_data.data(), page_data.size());
+
+        // banks that aren't mapped don't show up in the pages, they only change when they get mapped out again
+        const uint32_t banks = TakeChangedRamBanks();
+        page_data.clear();
+        if (banks != 0)
+        {
+            const Cartridge& cartridge = *m_Memory.ConnectedCartridge();
+            for (std::size_t bank = 0; bank < cartridge.RamBankCount(); ++bank)
+            {
+                if ((banks & (1u << bank)) != 0)
+                    page_data.insert(page_data.end(), cartridge.RamBank(bank), cartridge.RamBank(bank) + cartridge.RamBankSize());
+            }
+        }
+
+        writer.Write("RBMP", banks);
+        writer.WriteChunk("RBNK", page_data.data(), page_data.size());
+    }
+
+    uint8_t header[record_header_size];
+    const uint32_t size = static_cast<uint32_t>(state.size());
+    std::memcpy(header, &size, sizeof(size));
+    header[4] = static_cast<uint8_t>(kind);
+
+    file.write(reinterpret_cast<const char*>(header), record_header_size);
+    if (!file.write(reinterpret_cast<const char*>(state.data()), state.size()))
+        throw std::runtime_error("CheckpointLog failed appending a checkpoint");
+}
+
+uint32_t CheckpointLog::TakeChangedRamBanks()
+{
+    const Cartridge* cartridge = m_Memory.ConnectedCartridge();
+    if (cartridge == nullptr)
+        return 0;
+
+    ram_versions.resize(cartridge->RamBankCount());
+    uint32_t banks = 0;
+    for (std::size_t bank = 0; bank < ram_versions.size(); ++bank)
+    {
+        const uint64_t version = cartridge->RamBankVersion(bank);
+        if (version != ram_versions[bank])
+            banks |= 1u << bank;
+        ram_versions[bank] = version;
+    }
+    return banks;
+}
+
+void CheckpointLog::Flush()
+{
+    file.flush();
+}
+
+uint64_t CheckpointLog::Checkpoints() const
+{
+    return checkpoints;
+}
+
+void CheckpointLog::Restore(std::string const& path, Cpu& cpu, Memory& memory, uint64_t checkpoint)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("CheckpointLog couldn't open " + path + ": " + std::strerror(errno));
+
+    // seeking past the end doesn't fail, a record only counts if all of it is inside the file
+    file.seekg(0, std::ios::end);
+    const std::streamoff length = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    char magic[4];
+    if (!file.read(magic, 4) || std::memcmp(magic, CHECKPOINT_LOG_MAGIC, 4) != 0)
+        throw std::runtime_error("CheckpointLog " + path + " is not a checkpoint log");
+
+    // one pass over the headers to find where the wanted checkpoint and the keyframe before it are
+    struct RecordPosition
+    {
+        std::streamoff offset;
+        uint32_t size;
+        RecordKind kind;
+    };
+    std::vector<RecordPosition> records;
+    std::size_t last_keyframe = 0;
+
+    uint8_t header[record_header_size];
+    while (records.size() <= checkpoint && file.read(reinterpret_cast<char*>(header), record_header_size))
+    {
+        RecordPosition position;
+        std::memcpy(&position.size, header, sizeof(position.size));
+        position.kind = static_cast<RecordKind>(header[4]);
+        position.offset = file.tellg();
+
+        if (position.offset + static_cast<std::streamoff>(position.size) > length)
+            break; // torn last record, whatever came before it is still good
+        file.seekg(position.size, std::ios::cur);
+
+        if (position.kind == RecordKind::Keyframe)
+            last_keyframe = records.size();
+        records.push_back(position);
+    }
+
+    if (records.empty() || records[0].kind != RecordKind::Keyframe)
+        throw std::runtime_error("CheckpointLog " + path + " has no keyframe");
+    if (checkpoint != CHECKPOINT_LAST && checkpoint >= records.size())
+        throw std::runtime_error("CheckpointLog " + path + " doesn't have that many checkpoints");
+
+    file.clear();
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> page_data;
+    for (std::size_t i = last_keyframe; i < records.size(); ++i)
+    {
+        payload.resize(records[i].size);
+        file.seekg(records[i].offset);
+        if (!file.read(reinterpret_cast<char*>(payload.data()), payload.size()))
+            throw std::runtime_error("CheckpointLog failed reading a checkpoint");
+
+        StateReader reader(payload);
+        const bool keyframe = records[i].kind == RecordKind::Keyframe;
+        cpu.LoadState(reader, keyframe);
+        if (keyframe)
+            continue;
+
+        DirtyPages pages;
+        reader.Read("PGMP", pages);
+        std::size_t page_count = 0;
+        for (uint16_t page = 0; page < MEMORY_PAGE_COUNT; ++page)
+            page_count += pages.IsDirty(page) ? 1 : 0;
+
+        page_data.resize(page_count * MEMORY_PAGE_SIZE);
+        reader.ReadChunk("PAGE", page_data.data(), page_data.size());
+
+        const uint8_t* src = page_data.data();
+        for (uint16_t page = 0; page < MEMORY_PAGE_COUNT; ++page)
+        {
+            if (!pages.IsDirty(page))
+                continue;
+            memory.WritePage(static_cast<uint8_t>(page), src);
+            src += MEMORY_PAGE_SIZE;
+        }
+
+        uint32_t banks = 0;
+        reader.Read("RBMP", banks);
+        Cartridge* cartridge = memory.ConnectedCartridge();
+        const std::size_t bank_count = static_cast<std::size_t>(std::popcount(banks));
+        if (bank_count != 0 && (cartridge == nullptr || banks >> cartridge->RamBankCount() != 0))
+            throw std::runtime_error("CheckpointLog " + path + " has RAM banks this cartridge doesn't");
+
+        page_data.resize(bank_count == 0 ? 0 : bank_count * cartridge->RamBankSize());
+        reader.ReadChunk("RBNK", page_data.data(), page_data.size());
+        src = page_data.data();
+        for (std::size_t bank = 0; bank_count != 0 && bank < cartridge->RamBankCount(); ++bank)
+        {
+            if ((banks & (1u << bank)) == 0)
+                continue;
+            cartridge->WriteRamBank(bank, src);
+            src += cartridge->RamBankSize();
+        }
+    }
+
+    // the next log written from here has to start with a keyframe anyway
+    memory.TakeDirtyPages();
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+
+#define CHECKPOINT_LOG_MAGIC "GMCL"
+#define CHECKPOINT_DEFAULT_KEYFRAME_INTERVAL 64
+#define CHECKPOINT_LAST std::numeric_limits<uint64_t>::max()
+
+// append only checkpoint file, every record is (u32 size, u8 kind, save state)
+// keyframes are full save states, the records in between skip the memory chunk and carry
+// only the pages written since the previous checkpoint and the cart RAM banks that changed outside of memory,
+// restoring replays at most one keyframe interval
+class CheckpointLog
+{
+public:
+    CheckpointLog(std::string const& path, Cpu& cpu, Memory& memory, uint32_t keyframe_interval = CHECKPOINT_DEFAULT_KEYFRAME_INTERVAL);
+
+    // between two instructions, on the emulation thread
+    void Append();
+    void Flush();
+    uint64_t Checkpoints() const;
+
+    // puts the machine back to checkpoint number `checkpoint` (counted from 0) of the log at path
+    static void Restore(std::string const& path, Cpu& cpu, Memory& memory, uint64_t checkpoint = CHECKPOINT_LAST);
+private:
+    enum class RecordKind : uint8_t
+    {
+        Keyframe,
+        Pages
+    };
+
+    void WriteRecord(RecordKind kind);
+    // cart RAM banks whose version moved since the last record, bit per bank, and remembers the new versions
+    uint32_t TakeChangedRamBanks();
+
+    Cpu& m_Cpu;
+    Memory& m_Memory;
+    std::ofstream file;
+    uint32_t keyframe_interval;
+    uint64_t checkpoints;
+    std::vector<uint8_t> state;
+    std::vector<uint8_t> page_data;
+    std::vector<uint64_t> ram_versions; // of every cart RAM bank as of the last record
+};
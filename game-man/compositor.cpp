@@ -0,0 +1,189 @@
+#include "compositor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// a full resync (every vram and oam chunk) plus the scanline and a frame end has to fit in one go
+static_assert((VRAM_SIZE + COMPOSITOR_CHUNK_SIZE - 1) / COMPOSITOR_CHUNK_SIZE + (OAM_SIZE + COMPOSITOR_CHUNK_SIZE - 1) / COMPOSITOR_CHUNK_SIZE + 2
+    < COMPOSITOR_QUEUE_SIZE, "COMPOSITOR_QUEUE_SIZE can't hold a resync");
+
+Compositor::Compositor(bool threaded): dropping_frame(false), resync_pending(true), submitted_frames(0), dropped_frames(0),
+    shadow_vram{}, shadow_oam{}, lines_in_frame(0),
+    threaded(threaded), running(threaded)
+{
+    if (threaded)
+        compositor_thread = std::thread(&Compositor::CompositorLoop, this);
+}
+
+Compositor::~Compositor()
+{
+    Stop();
+}
+
+std::size_t Compositor::ChunkCount(DirtyRange range)
+{
+    if (range.Empty())
+        return 0;
+
+    return (range.end - range.begin + COMPOSITOR_CHUNK_SIZE - 1) / COMPOSITOR_CHUNK_SIZE;
+}
+
+bool Compositor::PushRange(CompositorCommand::Type type, const uint8_t* region, DirtyRange range)
+{
+    CompositorCommand command;
+    command.type = type;
+
+    for (uint16_t offset = range.begin; offset < range.end; offset += COMPOSITOR_CHUNK_SIZE)
+    {
+        command.offset = offset;
+        command.length = static_cast<uint8_t>(std::min<int>(COMPOSITOR_CHUNK_SIZE, range.end - offset));
+        std::memcpy(command.data, region + offset, command.length);
+
+        if (!queue.TryPush(command))
+            return false;
+    }
+
+    return true;
+}
+
+void Compositor::SubmitScanline(const ScanlineRegisters& regs, const uint8_t* vram, DirtyRange vram_dirty,
+    const uint8_t* oam, DirtyRange oam_dirty)
+{
+    if (regs.ly == 0)
+    {
+        dropping_frame = false;
+        if (resync_pending)
+        {
+            vram_dirty = { 0, VRAM_SIZE };
+            oam_dirty = { 0, OAM_SIZE };
+        }
+    }
+
+    if (dropping_frame)
+        return;
+
+    // all or nothing per line, a half pushed line would desync the shadow copies
+    const std::size_t needed = ChunkCount(vram_dirty) + ChunkCount(oam_dirty) + 1;
+    if (queue.FreeSpace() < needed + 1) // keep a slot for the frame end
+    {
+        dropping_frame = true;
+        resync_pending = true;
+        dropped_frames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    PushRange(CompositorCommand::Type::VramChunk, vram, vram_dirty);
+    PushRange(CompositorCommand::Type::OamChunk, oam, oam_dirty);
+
+    CompositorCommand command;
+    command.type = CompositorCommand::Type::Scanline;
+    command.length = 0;
+    command.offset = 0;
+    command.registers = regs;
+    queue.TryPush(command);
+
+    if (regs.ly == 0)
+        resync_pending = false;
+
+    if (!threaded)
+        Drain();
+}
+
+void Compositor::SubmitFrameEnd()
+{
+    // dropped frames still take a number, that's how readers find out they missed one
+    const uint64_t frame_number = submitted_frames++;
+    if (dropping_frame)
+        return;
+
+    CompositorCommand command;
+    command.type = CompositorCommand::Type::FrameEnd;
+    command.length = 0;
+    command.offset = 0;
+    command.frame_number = frame_number;
+    queue.TryPush(command);
+
+    if (!threaded)
+        Drain();
+}
+
+void Compositor::Stop()
+{
+    if (running.exchange(false))
+        compositor_thread.join();
+
+    Drain();
+}
+
+uint64_t Compositor::CompletedFrames() const
+{
+    return frames.PublishedFrames();
+}
+
+uint64_t Compositor::DroppedFrames() const
+{
+    return dropped_frames.load(std::memory_order_relaxed);
+}
+
+FrameExchange& Compositor::Frames()
+{
+    return frames;
+}
+
+void Compositor::ProcessCommand(const CompositorCommand& command)
+{
+    switch (command.type)
+    {
+    case CompositorCommand::Type::VramChunk:
+        std::memcpy(shadow_vram + command.offset, command.data, command.length);
+        break;
+    case CompositorCommand::Type::OamChunk:
+        std::memcpy(shadow_oam + command.offset, command.data, command.length);
+        renderer.InvalidateSprites();
+        break;
+    case CompositorCommand::Type::Scanline:
+        if (command.registers.ly == 0)
+            lines_in_frame = 0;
+        renderer.RenderLine(command.registers, shadow_vram, shadow_oam, frames.BackBuffer() + command.registers.ly * LCD_WIDTH);
+        ++lines_in_frame;
+        break;
+    case CompositorCommand::Type::FrameEnd:
+        // frames that lost lines to a full queue never count as completed
+        if (lines_in_frame == LCD_HEIGHT)
+            frames.Publish(command.frame_number);
+        lines_in_frame = 0;
+        break;
+    }
+}
+
+void Compositor::Drain()
+{
+    CompositorCommand command;
+    while (queue.TryPop(command))
+    {
+        ProcessCommand(command);
+    }
+}
+
+void Compositor::CompositorLoop()
+{
+    uint32_t idle_spins = 0;
+    CompositorCommand command;
+
+    while (running.load(std::memory_order_acquire))
+    {
+        if (queue.TryPop(command))
+        {
+            ProcessCommand(command);
+            idle_spins = 0;
+            continue;
+        }
+
+        // spin a little first, a scanline shows up every ~110us when running at normal speed
+        if (++idle_spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
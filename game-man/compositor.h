@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <thread>
+
+#include "frame-exchange.h"
+#include "scanline-renderer.h"
+#include "spsc-ring.h"
+
+#ifdef GAMEMAN_COMPACT
+// inline only, the queue is drained after every scanline, so it only has to fit one scanline plus a full resync
+#define COMPOSITOR_QUEUE_SIZE 256
+#else
+#define COMPOSITOR_QUEUE_SIZE 4096
+#endif
+#define COMPOSITOR_CHUNK_SIZE 48
+
+// the emulation thread only ever pushes these, the compositor side owns its own copy of vram/oam
+struct CompositorCommand
+{
+    enum class Type : uint8_t { Scanline, VramChunk, OamChunk, FrameEnd };
+    Type type;
+    uint8_t length;
+    uint16_t offset;
+    union
+    {
+        ScanlineRegisters registers;
+        uint8_t data[COMPOSITOR_CHUNK_SIZE];
+        uint64_t frame_number;
+    };
+};
+
+// builds frames out of scanline snapshots, either on its own thread or inline on the emulation thread
+// both modes run the exact same command stream through the same renderer
+class Compositor
+{
+public:
+    explicit Compositor(bool threaded);
+    ~Compositor();
+    Compositor(const Compositor&) = delete;
+    Compositor& operator=(const Compositor&) = delete;
+
+    // emulation thread side, never blocks, if the queue is full the rest of the frame is dropped
+    // and the next frame resends the whole vram/oam
+    void SubmitScanline(const ScanlineRegisters& regs, const uint8_t* vram, DirtyRange vram_dirty,
+        const uint8_t* oam, DirtyRange oam_dirty);
+    void SubmitFrameEnd();
+
+    // stops the thread and processes everything that's still queued
+    void Stop();
+
+    uint64_t CompletedFrames() const;
+    uint64_t DroppedFrames() const;
+
+    // finished frames are handed out through here, without copies
+    FrameExchange& Frames();
+private:
+    bool PushRange(CompositorCommand::Type type, const uint8_t* region, DirtyRange range);
+    static std::size_t ChunkCount(DirtyRange range);
+
+    void ProcessCommand(const CompositorCommand& command);
+    void Drain();
+    void CompositorLoop();
+
+    SpscRing<CompositorCommand, COMPOSITOR_QUEUE_SIZE> queue;
+
+    // emulation thread state
+    bool dropping_frame;
+    bool resync_pending;
+    uint64_t submitted_frames;
+    std::atomic<uint64_t> dropped_frames;
+
+    // compositor thread state
+    uint8_t shadow_vram[VRAM_SIZE];
+    uint8_t shadow_oam[OAM_SIZE];
+    ScanlineRenderer renderer;
+    uint8_t lines_in_frame;
+    FrameExchange frames; // lines are rendered straight into its back buffer
+
+    bool threaded;
+    std::atomic<bool> running;
+    std::thread compositor_thread;
+};
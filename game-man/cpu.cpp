@@ -1,59 +1,146 @@
 #include "cpu.h"
 
+#include <cstring>
 #include <thread>
 #include <stdexcept>
 
-Cpu::Cpu(Memory& memory): m_Memory(memory)
+Cpu::Cpu(Memory& memory, Scheduler& scheduler): m_Memory(memory), m_Scheduler(scheduler)
 {
+    // everything starts out defined, replays have to come out identical
+    this->last_tick = std::chrono::steady_clock::now();
+    this->throttled = true;
+    this->af.both = 0;
+    this->bc.both = 0;
+    this->de.both = 0;
+    this->hl.both = 0;
+    this->flags = {};
+    this->pc = 0;
     this->sp = SP_INIT_VAL;
-    this->rendering_counter_total = 0;
-    this->rendering_counter_current_cycle = 0;
-    this->current_rendering_state = RenderingState::HBlank;
     this->interrupts_enabled = false;
-    this->display_info.currently_render_y = 0;
     this->remaining_di_instructions = 0;
     this->remaining_ei_instructions = 0;
+    std::memset(this->pc_history, 0, sizeof(this->pc_history));
+    this->pc_history_pos = 0;
+    this->instruction_count = 0;
 }
 
 void Cpu::StartExecution()
 {
-    PowerUpSequence();
-    this->pc = GB_ROM_ENTRY_POINT;
-    
+    Reset();
+
     while(1)
     {
-        this->ExecuteInstruction();
-
-        if(remaining_ei_instructions > 0)
-        {
-            --remaining_ei_instructions;
-            if (remaining_ei_instructions == 0)
-                EI();
-        }
-        if(remaining_di_instructions > 0)
-        {
-            --remaining_di_instructions;
-            if (remaining_di_instructions == 0)
-                DI();
-        }
-        const uint8_t interrupt_jp_address = GetInterruptJpAddress();
-        if(interrupt_jp_address != 0)
-        {
-            interrupts_enabled = false;
-            m_Memory.SetMemory8(0xFFFF, 0); // disable IME
-            PushStack(pc);
-            pc = interrupt_jp_address;
-        }
+        Step();
     }
 }
 
-void Cpu::ExecuteInstruction()
+uint64_t Cpu::InstructionCount() const
+{
+    return instruction_count;
+}
+
+void Cpu::Reset()
+{
+    PowerUpSequence();
+    this->pc = GB_ROM_ENTRY_POINT;
+    this->interrupts_enabled = false;
+    this->remaining_di_instructions = 0;
+    this->remaining_ei_instructions = 0;
+}
+
+void Cpu::Step()
+{
+    this->ExecuteInstruction();
+    ++instruction_count;
+    FinishStep();
+}
+
+void Cpu::FinishStep()
 {
-    pc_history.insert(pc_history.begin(), pc);
-    if(pc_history.size() > 10000)
+    if(remaining_ei_instructions > 0)
+    {
+        --remaining_ei_instructions;
+        if (remaining_ei_instructions == 0)
+            EI();
+    }
+    if(remaining_di_instructions > 0)
     {
-        pc_history.resize(5000);
+        --remaining_di_instructions;
+        if (remaining_di_instructions == 0)
+            DI();
     }
+    const uint8_t interrupt_jp_address = GetInterruptJpAddress();
+    if(interrupt_jp_address != 0)
+    {
+        interrupts_enabled = false;
+        AcknowledgeInterrupt(interrupt_jp_address);
+        PushStack(pc);
+        pc = interrupt_jp_address;
+    }
+}
+
+void Cpu::RetireInstruction(uint16_t instruction_pc, uint8_t cycles)
+{
+    pc_history[pc_history_pos] = instruction_pc;
+    pc_history_pos = (pc_history_pos + 1) & (PC_HISTORY_SIZE - 1);
+
+    ElapseCycles(cycles);
+    ++instruction_count;
+}
+
+bool Cpu::ControlPending()
+{
+    if (remaining_ei_instructions > 0 || remaining_di_instructions > 0)
+        return true;
+    if (!interrupts_enabled)
+        return false;
+
+    // same five sources GetInterruptJpAddress looks at
+    return (*m_Memory.PeekPtrAt(0xFFFF) & *m_Memory.PeekPtrAt(0xFF0F) & 0x1F) != 0;
+}
+
+CpuRegisters Cpu::GetRegisters() const
+{
+    CpuRegisters registers;
+    registers.a = af.first;
+    registers.f = af.second;
+    registers.b = bc.first;
+    registers.c = bc.second;
+    registers.d = de.first;
+    registers.e = de.second;
+    registers.h = hl.first;
+    registers.l = hl.second;
+    registers.sp = sp;
+    registers.pc = pc;
+    registers.flag_z = flags.z;
+    registers.flag_n = flags.n;
+    registers.flag_h = flags.h;
+    registers.flag_c = flags.c;
+    return registers;
+}
+
+void Cpu::SetRegisters(const CpuRegisters& registers)
+{
+    af.first = registers.a;
+    af.second = registers.f;
+    bc.first = registers.b;
+    bc.second = registers.c;
+    de.first = registers.d;
+    de.second = registers.e;
+    hl.first = registers.h;
+    hl.second = registers.l;
+    sp = registers.sp;
+    pc = registers.pc;
+    flags.z = registers.flag_z;
+    flags.n = registers.flag_n;
+    flags.h = registers.flag_h;
+    flags.c = registers.flag_c;
+}
+
+void Cpu::ExecuteInstruction()
+{
+    pc_history[pc_history_pos] = pc;
+    pc_history_pos = (pc_history_pos + 1) & (PC_HISTORY_SIZE - 1);
 
     uint8_t op = m_Memory.ReadMemory8(pc);
 
@@ -244,7 +331,7 @@ void Cpu::ExecuteInstruction()
         Execute_Jr_Flag(op);
         break;
     case 0x18: // JR n
-        Execute_Jr_n(op);
+        Execute_Jr_n();
         break;
     case 0x0B: // DEC BC
     case 0x1B: // DEC DE
@@ -259,7 +346,8 @@ void Cpu::ExecuteInstruction()
     case 0x1D: // DEC E
     case 0x25: // DEC H
     case 0x2D: // DEC L
-        // 4 cycles
+    case 0x35: // DEC (HL)
+        // 4 cycles, 12 for (HL)
         Execute_Dec_8(op);
         break;
     case 0xAF: // XOR A
@@ -538,11 +626,12 @@ uint8_t Cpu::GetInterruptJpAddress()
     if (!interrupts_enabled)
         return 0;
 
-    uint8_t interrupt_enable = m_Memory.ReadMemory8(0xFFFF);
+    // straight from the buffer, this isn't a cpu access, it works the same while a DMA has the bus
+    uint8_t interrupt_enable = *m_Memory.PeekPtrAt(0xFFFF);
     if (interrupt_enable == 0)
         return 0;
 
-    uint8_t interrupt_flag = m_Memory.ReadMemory8(0xFF0F);
+    uint8_t interrupt_flag = *m_Memory.PeekPtrAt(0xFF0F);
     if (interrupt_flag == 0)
         return 0;
 
@@ -587,21 +676,29 @@ uint8_t Cpu::GetInterruptJpAddress()
         }
     }
 
-    throw std::runtime_error("Cpu::GetInterruptJpAddress failed, enable and flag are non-zero, but no match?");
+    // requested, but none of them enabled
+    return 0;
+}
+
+void Cpu::AcknowledgeInterrupt(uint8_t jp_address)
+{
+    // 0x40 -> bit 0, 0x48 -> bit 1, ...
+    const uint8_t flag = 1 << ((jp_address - 0x40) / 8);
+    m_Memory.ClearInterrupt(static_cast<InterruptFlags>(flag));
 }
 
 void Cpu::ElapseCycles(uint8_t cycles)
 {
-    auto* lcdc_status = m_Memory.GetPtrAt(0xFF40);
-    const bool display_enabled = (*lcdc_status & 0b10000000) == 0b10000000;
+    m_Scheduler.Advance(cycles);
 
-    if (display_enabled)
-    {
-        CycleRenderingState(cycles);
-        CycleRenderingLines(cycles);
-    }
+    if (throttled)
+        SleepFor(cycles);
+}
 
-    SleepFor(cycles);
+void Cpu::SetThrottled(bool throttled)
+{
+    this->throttled = throttled;
+    this->last_tick = std::chrono::steady_clock::now();
 }
 
 void Cpu::Execute_Nop()
@@ -711,7 +808,8 @@ void Cpu::Execute_Load_8_Val(uint8_t opCode)
 
 void Cpu::Execute_Load_8_Operand(uint8_t opCode)
 {
-    uint8_t* operandDest = nullptr;
+    uint8_t* operandDest = nullptr; // register destination
+    uint16_t destAddress = 0; // memory destination, used when operandDest stays null
     uint8_t srcVal = 0;
     uint8_t cycles = 4; // most operations, HL related use 8, n load uses 12
     uint8_t jp_counter = 1;
@@ -949,58 +1047,58 @@ void Cpu::Execute_Load_8_Operand(uint8_t opCode)
         cycles = 8;
         break;
     case 0x70: // LD (HL), B
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = bc.first;
         cycles = 8;
         break;
     case 0x71: // LD (HL), C
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = bc.second;
         cycles = 8;
         break;
     case 0x72: // LD (HL), D
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = de.first;
         cycles = 8;
         break;
     case 0x73: // LD (HL), E
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = de.second;
         cycles = 8;
         break;
     case 0x74: // LD (HL), H
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = hl.first;
         cycles = 8;
         break;
     case 0x75: // LD (HL), L
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = hl.second;
         cycles = 8;
         break;
     case 0x02: // LD (BC), A
-        operandDest = this->m_Memory.GetPtrAt(bc.both);
+        destAddress = bc.both;
         srcVal = af.first;
         cycles = 8;
         break;
     case 0x12: // LD (DE), A
-        operandDest = this->m_Memory.GetPtrAt(de.both);
+        destAddress = de.both;
         srcVal = af.first;
         cycles = 8;
         break;
     case 0x77: // LD (HL), A
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = af.first;
         cycles = 8;
         break;
     case 0x36: // LD (HL), n
-        operandDest = this->m_Memory.GetPtrAt(hl.both);
+        destAddress = hl.both;
         srcVal = this->m_Memory.ReadMemory8(pc + 1);
         cycles = 12;
         jp_counter = 2;
         break;
     case 0xEA: // LD (nn), A
-        operandDest = this->m_Memory.GetPtrAt(this->m_Memory.ReadMemory16(pc + 1));
+        destAddress = this->m_Memory.ReadMemory16(pc + 1);
         srcVal = af.first;
         cycles = 16;
         jp_counter = 3;
@@ -1025,7 +1123,11 @@ void Cpu::Execute_Load_8_Operand(uint8_t opCode)
         throw std::runtime_error("Unimplemented opCode " + opCode);
     }
 
-    *operandDest = srcVal;
+    // stores go through the bus like everything else, IO registers and the cartridge have to see them
+    if (operandDest != nullptr)
+        *operandDest = srcVal;
+    else
+        m_Memory.SetMemory8(destAddress, srcVal);
     pc += jp_counter;
 
     ElapseCycles(cycles);
@@ -1099,6 +1201,7 @@ void Cpu::Execute_Load_FF00_C_A()
 void Cpu::Execute_Dec_8(uint8_t opCode)
 {
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0; // (HL) goes through the bus, read here and written back once it's done
     uint8_t cycles = 4;
     switch (opCode) 
     {
@@ -1126,7 +1229,8 @@ void Cpu::Execute_Dec_8(uint8_t opCode)
         break;
     case 0x35: // DEC (HL)
         cycles = 12;
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         break;
     default:
         throw std::runtime_error("Unimplemented opCode " + opCode);
@@ -1135,6 +1239,8 @@ void Cpu::Execute_Dec_8(uint8_t opCode)
     flags.h = (HalfCarryOnSubtraction(*operand, *operand - 1));
 
     *operand -= 1;
+    if (operand == &memory_val)
+        m_Memory.SetMemory8(hl.both, memory_val);
 
     flags.z = *operand == 0;
     flags.n = true;
@@ -1182,6 +1288,7 @@ void Cpu::Execute_Inc_8(uint8_t opCode)
 {
     // 4 cycles
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0; // (HL) goes through the bus, read here and written back once it's done
     uint8_t cycles = 4;
     switch(opCode)
     {
@@ -1208,7 +1315,8 @@ void Cpu::Execute_Inc_8(uint8_t opCode)
         break;
     case 0x34: // INC (HL)
         cycles = 12;
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         break;
     default: 
         throw std::runtime_error("Unimplemented opCode " + opCode);
@@ -1218,6 +1326,8 @@ void Cpu::Execute_Inc_8(uint8_t opCode)
     flags.n = false;
 
     *operand += 1;
+    if (operand == &memory_val)
+        m_Memory.SetMemory8(hl.both, memory_val);
     flags.z = *operand == 0;
     UpdateFlagRegister();
 
@@ -1263,6 +1373,7 @@ void Cpu::Execute_Inc_16(uint8_t opCode, bool suppress_pc_inc)
 void Cpu::Execute_Sub_8(uint8_t opCode)
 {
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0;
     uint8_t cycles = 4;
     switch(opCode)
     {
@@ -1288,7 +1399,8 @@ void Cpu::Execute_Sub_8(uint8_t opCode)
         operand = &hl.second;
         break;
     case 0x96: // SUB (HL)
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         cycles = 8;
         break;
     case 0xD6: // SUB # ???
@@ -1313,6 +1425,7 @@ void Cpu::Execute_Sub_8(uint8_t opCode)
 void Cpu::Execute_SBC_8(uint8_t opCode)
 {
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0;
     uint8_t cycles = 4;
 
     switch(opCode)
@@ -1339,7 +1452,8 @@ void Cpu::Execute_SBC_8(uint8_t opCode)
         operand = &hl.second;
         break;
     case 0x9E: // SBC A, (HL)
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         cycles = 8;
         break;
     default:
@@ -1452,6 +1566,7 @@ void Cpu::Execute_Or_N(uint8_t opCode)
 {
     uint8_t cycles = 4;
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0;
     uint8_t jp_counter = 1;
     switch(opCode)
     {
@@ -1477,11 +1592,13 @@ void Cpu::Execute_Or_N(uint8_t opCode)
         operand = &hl.second;
         break;
     case 0xB6: // OR (HL)
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         cycles = 8;
         break;
     case 0xF6: // OR (#)
-        operand = m_Memory.GetPtrAt(pc + 1);
+        memory_val = m_Memory.ReadMemory8(pc + 1);
+        operand = &memory_val;
         cycles = 8;
         jp_counter = 2;
         break;
@@ -1507,6 +1624,7 @@ void Cpu::Execute_And_N(uint8_t opCode)
 {
     uint8_t cycles = 4;
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0;
     uint8_t jp_counter = 1;
     switch(opCode)
     {
@@ -1532,11 +1650,13 @@ void Cpu::Execute_And_N(uint8_t opCode)
         operand = &hl.second;
         break;
     case 0xA6: // AND (HL)
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         cycles = 8;
         break;
     case 0xE6: // AND #
-        operand = m_Memory.GetPtrAt(pc + 1);
+        memory_val = m_Memory.ReadMemory8(pc + 1);
+        operand = &memory_val;
         cycles = 8;
         jp_counter = 2;
         break;
@@ -1561,6 +1681,7 @@ void Cpu::Execute_Swap(uint8_t second_opcode)
 {
     uint8_t cycles = 8;
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0; // (HL) goes through the bus, read here and written back once it's done
     switch(second_opcode)
     {
     case 0x37: // SWAP A
@@ -1585,7 +1706,8 @@ void Cpu::Execute_Swap(uint8_t second_opcode)
         operand = &hl.second;
         break;
     case 0x36: // SWAP (HL)
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         cycles = 16;
         break;
     default:
@@ -1593,6 +1715,8 @@ void Cpu::Execute_Swap(uint8_t second_opcode)
     }
 
     *operand = Swap(*operand);
+    if (operand == &memory_val)
+        m_Memory.SetMemory8(hl.both, memory_val);
 
     flags.z = *operand == 0;
 
@@ -1654,6 +1778,7 @@ void Cpu::Execute_Bit_Test(uint8_t second_opcode)
 
     uint8_t cycles = 8;
     uint8_t* operand = nullptr;
+    uint8_t memory_val = 0;
     uint8_t bit_index;
 
     const uint8_t opcode_base = second_opcode - 0x40;
@@ -1690,7 +1815,8 @@ void Cpu::Execute_Bit_Test(uint8_t second_opcode)
     }
     else if (opcode_base % 8 == 6) // b, (HL)
     {
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         bit_index = (opcode_base - 6) / 8;
         cycles = 16;
     }
@@ -1723,6 +1849,7 @@ void Cpu::Execute_Reset_Bit(uint8_t second_opcode)
 
     uint8_t cycles = 8;
     uint8_t* operand;
+    uint8_t memory_val = 0; // (HL) goes through the bus, read here and written back once it's done
     uint8_t bit_index;
 
     const uint8_t opcode_base = second_opcode - 0x80;
@@ -1759,7 +1886,8 @@ void Cpu::Execute_Reset_Bit(uint8_t second_opcode)
     }
     else if (opcode_base % 8 == 6) // b, (HL)
     {
-        operand = m_Memory.GetPtrAt(hl.both);
+        memory_val = m_Memory.ReadMemory8(hl.both);
+        operand = &memory_val;
         bit_index = (opcode_base - 6) / 8;
         cycles = 16;
     }
@@ -1775,6 +1903,8 @@ void Cpu::Execute_Reset_Bit(uint8_t second_opcode)
 
     const uint8_t aligned_bit_inverted = ~(0x1 << bit_index);
     *operand = *operand & aligned_bit_inverted;
+    if (operand == &memory_val)
+        m_Memory.SetMemory8(hl.both, memory_val);
 
     pc += 2;
 
@@ -1824,7 +1954,9 @@ void Cpu::Execute_SCF()
     flags.c = true;
     UpdateFlagRegister();
 
-    sp += 1;
+    pc += 1;
+
+    ElapseCycles(cycles);
 }
 
 void Cpu::Execute_EI()
@@ -2094,99 +2226,6 @@ void Cpu::PowerUpSequence()
     m_Memory.SetMemory8(0xFFFF, 0); // IE
 }
 
-void Cpu::CycleRenderingState(uint8_t cycles)
-{
-    bool changed = false;
-    rendering_counter_total += cycles;
-    rendering_counter_current_cycle += cycles;
-
-    if (rendering_counter_current_cycle < OAM_USED_CYCLES) // lowest number of cycles to trigger anything
-        return;
-
-    switch(current_rendering_state)
-    {
-    case RenderingState::HBlank:
-        if(rendering_counter_current_cycle >= HBLANK_CYCLES && rendering_counter_total < VBLANK_START_CYCLE)
-        {
-            rendering_counter_current_cycle -= HBLANK_CYCLES;
-            current_rendering_state = RenderingState::OAM_Used;
-            changed = true;
-        }
-        else if(rendering_counter_current_cycle >= HBLANK_CYCLES && rendering_counter_total >= VBLANK_START_CYCLE)
-        {
-            rendering_counter_current_cycle -= HBLANK_CYCLES;
-            current_rendering_state = RenderingState::VBlank;
-            changed = true;
-        }
-        break;
-    case RenderingState::VBlank: 
-        if(rendering_counter_current_cycle >= VBLANK_CYCLES && rendering_counter_total >= VBLANK_END_CYCLE)
-        {
-            rendering_counter_total -= VBLANK_END_CYCLE;
-            rendering_counter_current_cycle -= VBLANK_CYCLES;
-            current_rendering_state = RenderingState::HBlank;
-            changed = true;
-        }
-        break;
-    case RenderingState::OAM_Used:
-        if(rendering_counter_current_cycle >= OAM_USED_CYCLES)
-        {
-            rendering_counter_current_cycle -= OAM_USED_CYCLES;
-            current_rendering_state = RenderingState::OAM_RAM_Used;
-            changed = true;
-        }
-        break;
-    case RenderingState::OAM_RAM_Used: 
-        if(rendering_counter_current_cycle >= OAM_RAM_USED_CYCLES)
-        {
-            rendering_counter_current_cycle -= OAM_RAM_USED_CYCLES;
-            current_rendering_state = RenderingState::HBlank;
-            changed = true;
-        }
-        break;
-    }
-
-    if(changed)
-    {
-        auto* lcdc_stat = m_Memory.GetPtrAt(0xFF41);
-        *lcdc_stat |= static_cast<uint8_t>(current_rendering_state);
-    }
-}
-
-void Cpu::CycleRenderingLines(uint8_t cycles)
-{
-    display_info.rendering_current_cycle += cycles;
-
-    if (display_info.rendering_current_cycle < 456)
-        return;
-
-    display_info.rendering_current_cycle -= 456;
-    if(display_info.currently_render_y < 153)
-    {
-        display_info.currently_render_y += 1;
-    }
-    else
-    {
-        display_info.currently_render_y = 0;
-    }
-
-    m_Memory.SetMemory8(0xFF44, display_info.currently_render_y); // set LY
-
-    const uint8_t lyc_compare = m_Memory.ReadMemory8(0xFF45);
-    uint8_t stat = m_Memory.ReadMemory8(0xFF41);
-    if(display_info.currently_render_y == lyc_compare)
-    {
-        stat = stat | 0b100; // set coincidence flag
-        m_Memory.SetMemory8(0xFF41, stat);
-    }
-    else
-    {
-        stat = stat & 0b11111011; // reset coincidence flag, keep everything else
-        m_Memory.SetMemory8(0xFF41, stat);
-    }
-}
-
-
 void Cpu::Execute_Jr_Flag(uint8_t opCode)
 {
     uint8_t cycles = 8;
@@ -2216,13 +2255,14 @@ void Cpu::Execute_Jr_Flag(uint8_t opCode)
     uint8_t orig_val = m_Memory.ReadMemory8(pc + 1);
     int8_t jump_relative = static_cast<int8_t>(orig_val);
     pc += 2 + jump_relative;
+    cycles = 12; // taken branch costs an extra M-cycle
 
     ElapseCycles(cycles);
 }
 
-void Cpu::Execute_Jr_n(uint8_t opCode)
+void Cpu::Execute_Jr_n()
 {
-    uint8_t cycles = 8;
+    uint8_t cycles = 12;
 
     int8_t jump_relative = static_cast<int8_t>(m_Memory.ReadMemory8(pc + 1)) + 2;
     pc += jump_relative;
@@ -2308,7 +2348,7 @@ void Cpu::Execute_Add_HL_Operand(uint8_t opCode)
     hl.both += srcVal;
     pc += 1;
 
-    ElapseCycles(8);
+    ElapseCycles(cycles);
 }
 
 void Cpu::Execute_Add_8(uint8_t opCode)
@@ -2366,3 +2406,84 @@ void Cpu::Execute_Add_8(uint8_t opCode)
 
     ElapseCycles(cycles);
 }
+
+namespace
+{
+    struct CpuState
+    {
+        uint16_t af;
+        uint16_t bc;
+        uint16_t de;
+        uint16_t hl;
+        uint16_t sp;
+        uint16_t pc;
+        bool flag_z;
+        bool flag_n;
+        bool flag_h;
+        bool flag_c;
+        uint8_t remaining_ei_instructions;
+        uint8_t remaining_di_instructions;
+        bool interrupts_enabled;
+    };
+}
+
+void Cpu::SaveState(StateWriter& writer, bool with_memory) const
+{
+    CpuState saved;
+    std::memset(&saved, 0, sizeof(saved)); // no stray padding bytes in the state
+    saved.af = af.both;
+    saved.bc = bc.both;
+    saved.de = de.both;
+    saved.hl = hl.both;
+    saved.sp = sp;
+    saved.pc = pc;
+    saved.flag_z = flags.z;
+    saved.flag_n = flags.n;
+    saved.flag_h = flags.h;
+    saved.flag_c = flags.c;
+    saved.remaining_ei_instructions = remaining_ei_instructions;
+    saved.remaining_di_instructions = remaining_di_instructions;
+    saved.interrupts_enabled = interrupts_enabled;
+    writer.Write("CPU ", saved);
+
+    m_Scheduler.SaveState(writer);
+    m_Memory.SaveState(writer, with_memory);
+}
+
+void Cpu::LoadState(StateReader& reader, bool with_memory)
+{
+    // every chunk is checked before the first one is applied, a state that doesn't fit leaves the machine as it was
+    reader.Expect(ExpectedLayout(with_memory));
+
+    CpuState saved;
+    reader.Read("CPU ", saved);
+    af.both = saved.af;
+    bc.both = saved.bc;
+    de.both = saved.de;
+    hl.both = saved.hl;
+    sp = saved.sp;
+    pc = saved.pc;
+    remaining_ei_instructions = saved.remaining_ei_instructions;
+    remaining_di_instructions = saved.remaining_di_instructions;
+    interrupts_enabled = saved.interrupts_enabled;
+    flags.z = saved.flag_z;
+    flags.n = saved.flag_n;
+    flags.h = saved.flag_h;
+    flags.c = saved.flag_c;
+
+    m_Scheduler.LoadState(reader);
+    m_Memory.LoadState(reader, with_memory);
+}
+
+const StateLayout& Cpu::ExpectedLayout(bool with_memory)
+{
+    StateLayout& layout = state_layouts[with_memory ? 1 : 0];
+    if (layout.empty())
+    {
+        std::vector<uint8_t> buffer;
+        StateWriter writer(buffer);
+        SaveState(writer, with_memory);
+        layout = StateReader(buffer).Layout();
+    }
+    return layout;
+}
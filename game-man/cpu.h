@@ -2,23 +2,64 @@
 #include <chrono>
 
 #include "memory.h"
+#include "scheduler.h"
 #define GB_ROM_ENTRY_POINT 0x100
-#define GB_CLOCK 4194304
-
-#define HBLANK_CYCLES 204
-#define VBLANK_START_CYCLE 65664
-#define VBLANK_CYCLES 4560
-#define VBLANK_END_CYCLE (VBLANK_START_CYCLE + VBLANK_CYCLES)
-#define OAM_USED_CYCLES 80
-#define OAM_RAM_USED_CYCLES 172
-#define FRAME_CYCLES_TOTAL 70224
+#ifdef GAMEMAN_COMPACT
+#define PC_HISTORY_SIZE 64 // power of two, just enough to see how it got to a crash
+#else
+#define PC_HISTORY_SIZE 4096 // power of two
+#endif
+
+// the register file as instructions see it
+// F is only rebuilt from the flag bools by the instructions that call UpdateFlagRegister, so both are carried
+struct CpuRegisters
+{
+    uint8_t a;
+    uint8_t f;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+    uint16_t sp;
+    uint16_t pc;
+    bool flag_z;
+    bool flag_n;
+    bool flag_h;
+    bool flag_c;
+};
 
 class Cpu
 {
 public:
-    Cpu(Memory& memory);
+    Cpu(Memory& memory, Scheduler& scheduler);
     void StartExecution();
+    // power up state, pc at the cartridge entry point
+    void Reset();
+    // one instruction plus whatever interrupt it let through
+    void Step();
+    // every Step so far, for throughput numbers
+    uint64_t InstructionCount() const;
     void ExecuteInstruction();
+    // off = run as fast as the host allows, movie playback and benchmarks want that
+    void SetThrottled(bool throttled);
+
+    // the whole machine, registers, then the scheduler, then memory and everything hanging off it
+    // only valid between two instructions
+    void SaveState(StateWriter& writer, bool with_memory = true) const;
+    void LoadState(StateReader& reader, bool with_memory = true);
+
+    CpuRegisters GetRegisters() const;
+    void SetRegisters(const CpuRegisters& registers);
+
+    // for engines that execute an instruction somewhere else (LockstepBatch), the bookkeeping Step does around it
+    // RetireInstruction is history, cycles and the count, it doesn't look at the registers
+    void RetireInstruction(uint16_t instruction_pc, uint8_t cycles);
+    // true when FinishStep has something to do, EI/DI countdown or an interrupt to take,
+    // which needs the current registers set first
+    bool ControlPending();
+    void FinishStep();
 private:
 
     static constexpr uint8_t Swap(uint8_t val)
@@ -68,12 +109,12 @@ private:
         return (int)(first_num & 0x00FF) - (int)(second_num & 0x00FF) < 0;
     }
 
-    enum class InterruptFlags{VBlank = 1, LCDC = 2, TimerOverflow = 4, SerialIOTransferComplete = 8, TransitionPin = 16};
     static constexpr bool IsInterruptFlagEnabled(uint8_t flag_byte, InterruptFlags requested_flag)
     {
         return (flag_byte & static_cast<uint8_t>(requested_flag)) == static_cast<uint8_t>(requested_flag);
     }
     uint8_t GetInterruptJpAddress();
+    void AcknowledgeInterrupt(uint8_t jp_address);
 
     void ElapseCycles(uint8_t cycles);
 
@@ -89,7 +130,7 @@ private:
     void Execute_Dec_8(uint8_t opCode);
     void Execute_Dec_16(uint8_t opCode, bool suppress_pc_inc = false);
     void Execute_Jr_Flag(uint8_t opCode);
-    void Execute_Jr_n(uint8_t opCode);
+    void Execute_Jr_n();
     void Execute_Jp_HL();
     void Execute_Jp_16();
     void Execute_Jp_16_Flag(uint8_t opCode);
@@ -129,11 +170,17 @@ private:
 
     void SleepFor(uint8_t cycles);
     std::chrono::steady_clock::time_point last_tick;
+    bool throttled;
 
     void UpdateFlagRegister();
     void PowerUpSequence();
 
+    // what SaveState writes for this machine, the peripherals and cartridge RAM size never change so it's worked out once
+    const StateLayout& ExpectedLayout(bool with_memory);
+    StateLayout state_layouts[2]; // without memory, with memory
+
     Memory& m_Memory;
+    Scheduler& m_Scheduler;
 
     union TwinRegister
     {
@@ -153,24 +200,10 @@ private:
     uint16_t sp; // stack pointer register
     uint16_t pc; // program counter
 
-    // debug
-    std::vector<uint16_t> pc_history;
-
-
-    // rendering emulation
-    enum class RenderingState{ HBlank, VBlank, OAM_Used, OAM_RAM_Used};
-    int rendering_counter_total;
-    RenderingState current_rendering_state;
-    uint16_t rendering_counter_current_cycle;
-    void CycleRenderingState(uint8_t cycles);
-
-    struct DisplayInfo
-    {
-        uint8_t currently_render_y;
-        uint16_t rendering_current_cycle;
-    };
-    DisplayInfo display_info;
-    void CycleRenderingLines(uint8_t cycles);
+    // debug, last PC_HISTORY_SIZE program counters, pc_history_pos is where the next one goes
+    uint16_t pc_history[PC_HISTORY_SIZE];
+    uint16_t pc_history_pos;
+    uint64_t instruction_count;
 
     struct cpu_flags
     {
@@ -1,5 +1,7 @@
 #include "file_handle.h"
 
+#include <cstring>
+
 FileHandle::FileHandle(std::string const& path): m_Handle(new std::ifstream(path, std::ios::binary | std::ios::ate))
 {
 }
@@ -17,8 +19,8 @@ std::vector<uint8_t>& FileHandle::GetFileContentsVector()
     this->m_Handle->seekg(0, std::ios::beg);
 
     auto size = static_cast<std::size_t>(end - this->m_Handle->tellg());
-    if (size > 0x8000)
-        throw std::runtime_error("FileHandle::m_Handle size is over 0x8000");
+    if (size > 0x800000)
+        throw std::runtime_error("FileHandle::m_Handle size is over 8MB, no cartridge is that big");
 
     this->m_fileContents.resize(size);
 
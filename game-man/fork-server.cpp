@@ -0,0 +1,153 @@
+#include "fork-server.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "cartridge.h"
+
+ForkServer::ForkServer(std::shared_ptr<const std::vector<uint8_t>> rom, std::size_t slots, const MachineConfig& config):
+    machines(std::move(rom), slots + 1, config), slot_generation(slots + 1, 0), slot_out(slots + 1, false), generation(0), parent_memory(GB_MEMORY_BUFFER_SIZE + 1), stats{}
+{
+    if (slots == 0)
+        throw std::runtime_error("ForkServer needs at least one slot");
+
+    const Cartridge& cartridge = machines[0].GetCartridge();
+    parent_ram.resize(cartridge.RamBankCount() * cartridge.RamBankSize());
+    ram_versions.resize((slots + 1) * cartridge.RamBankCount());
+
+    free_slots.reserve(slots);
+    for (std::size_t slot = slots; slot > 0; --slot)
+        free_slots.push_back(slot);
+
+    // a fresh machine is a parent too
+    std::vector<uint8_t> state;
+    machines[0].SaveState(state);
+    SetParent(state);
+}
+
+void ForkServer::SetParent(const Machine& machine)
+{
+    std::vector<uint8_t> state;
+    machine.SaveState(state);
+    SetParent(state);
+}
+
+void ForkServer::SetParent(const std::vector<uint8_t>& state)
+{
+    // slots keep their dirty page resets instead of all going back to full loads
+    if (generation != 0 && state == parent_state)
+        return;
+
+    Machine& parent = machines[0];
+    parent.LoadState(state);
+    parent_state = state;
+
+    parent_devices.clear();
+    StateWriter writer(parent_devices);
+    parent.GetCpu().SaveState(writer, false);
+    std::memcpy(parent_memory.data(), parent.GetMemory().PeekPtrAt(0), parent_memory.size());
+    const Cartridge& cartridge = parent.GetCartridge();
+    for (std::size_t bank = 0; bank < cartridge.RamBankCount(); ++bank)
+        std::memcpy(parent_ram.data() + bank * cartridge.RamBankSize(), cartridge.RamBank(bank), cartridge.RamBankSize());
+
+    // every slot that isn't out gets a full load the next time, children that are out too once they come back
+    ++generation;
+}
+
+ForkStats ForkServer::ResetSlot(std::size_t slot)
+{
+    Machine& child = machines[slot];
+    Memory& memory = child.GetMemory();
+    Cartridge& cartridge = child.GetCartridge();
+    uint64_t* versions = SlotRamVersions(slot);
+    ForkStats counts{};
+
+    if (slot_generation[slot] != generation)
+    {
+        child.LoadState(parent_state);
+        slot_generation[slot] = generation;
+        ++counts.full_loads;
+    }
+    else
+    {
+        StateReader reader(parent_devices);
+        child.GetCpu().LoadState(reader, false);
+
+        DirtyPages pages = memory.TakeDirtyPages();
+        // IO and HRAM get poked from all over the place without going through the cpu (IF, the timer, joypad
+        // and lcd registers), always take them, same as CheckpointLog
+        pages.bits[0xFF >> 6] |= 1ull << (0xFF & 63);
+        for (uint16_t page = 0; page < MEMORY_PAGE_COUNT; ++page)
+        {
+            if (!pages.IsDirty(page))
+                continue;
+            memory.WritePage(static_cast<uint8_t>(page), parent_memory.data() + page * MEMORY_PAGE_SIZE);
+            ++counts.pages_restored;
+        }
+
+        // the device state leaves cart RAM out, the banks that aren't mapped only change when one gets mapped out
+        for (std::size_t bank = 0; bank < cartridge.RamBankCount(); ++bank)
+        {
+            if (cartridge.RamBankVersion(bank) == versions[bank])
+                continue;
+            cartridge.WriteRamBank(bank, parent_ram.data() + bank * cartridge.RamBankSize());
+            ++counts.ram_banks_restored;
+        }
+    }
+
+    // from here on the dirty pages and RAM bank versions are exactly what this child changes
+    memory.TakeDirtyPages();
+    memory.TakeCartRamWritten();
+    for (std::size_t bank = 0; bank < cartridge.RamBankCount(); ++bank)
+        versions[bank] = cartridge.RamBankVersion(bank);
+    return counts;
+}
+
+uint64_t* ForkServer::SlotRamVersions(std::size_t slot)
+{
+    return ram_versions.data() + slot * machines[0].GetCartridge().RamBankCount();
+}
+
+Machine& ForkServer::Fork()
+{
+    if (free_slots.empty())
+        throw std::runtime_error("ForkServer: every slot is taken");
+
+    const std::size_t slot = free_slots.back();
+    free_slots.pop_back();
+    slot_out[slot] = true;
+    const ForkStats counts = ResetSlot(slot);
+    stats.full_loads += counts.full_loads;
+    stats.pages_restored += counts.pages_restored;
+    stats.ram_banks_restored += counts.ram_banks_restored;
+    ++stats.forks;
+    return machines[slot];
+}
+
+void ForkServer::Release(Machine& child)
+{
+    const std::size_t slot = machines.IndexOf(child);
+    if (!slot_out[slot])
+        throw std::runtime_error("ForkServer: released a machine that isn't out");
+    slot_out[slot] = false;
+    // capacity was reserved for every slot, this never reallocates
+    free_slots.push_back(slot);
+}
+
+ForkStats ForkServer::Rewind(Machine& child)
+{
+    const std::size_t slot = machines.IndexOf(child);
+    if (!slot_out[slot])
+        throw std::runtime_error("ForkServer: rewound a machine that isn't out");
+    return ResetSlot(slot);
+}
+
+std::size_t ForkServer::FreeSlots() const
+{
+    return free_slots.size();
+}
+
+const ForkStats& ForkServer::Stats() const
+{
+    return stats;
+}
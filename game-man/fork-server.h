@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "machine-arena.h"
+
+struct ForkStats
+{
+    uint64_t forks;
+    uint64_t full_loads; // slot was from an older parent (or new), got the whole state
+    uint64_t pages_restored; // 256 byte pages copied back over what children wrote
+    uint64_t ram_banks_restored; // cart RAM banks a child changed while they weren't mapped in
+};
+
+// hands out children that start exactly at a parent snapshot, for trying many inputs from one point
+// children live in a fixed pool of slots, a released slot is only reset when it's handed out again, and then
+// only the memory pages it wrote since its last reset (dirty page tracking), the cart RAM banks whose version moved
+// and the small non-memory state are put back, nothing on the Fork/Release path allocates
+class ForkServer
+{
+public:
+    ForkServer(std::shared_ptr<const std::vector<uint8_t>> rom, std::size_t slots, const MachineConfig& config = MachineConfig());
+
+    ForkServer(const ForkServer&) = delete;
+    ForkServer& operator=(const ForkServer&) = delete;
+
+    // a save state from any machine running the same ROM, children handed out from here on start from it
+    // children already out keep running their own branch, the same parent again changes nothing
+    void SetParent(const std::vector<uint8_t>& state);
+    void SetParent(const Machine& machine);
+
+    // throws when every slot is out
+    Machine& Fork();
+    void Release(Machine& child);
+    // puts a child that's out back at the parent, same as releasing and forking it again but it keeps the slot
+    // only touches that child's slot, so different children can be rewound on different threads at once
+    // (not while Fork/Release/SetParent run), what it did is returned instead of going into Stats
+    ForkStats Rewind(Machine& child);
+
+    std::size_t FreeSlots() const;
+    const ForkStats& Stats() const;
+private:
+    ForkStats ResetSlot(std::size_t slot);
+    uint64_t* SlotRamVersions(std::size_t slot);
+
+    // slot 0 holds the parent, 1..n are children
+    MachineArena machines;
+    std::vector<std::size_t> free_slots;
+    std::vector<uint64_t> slot_generation; // which parent a slot was last reset to
+    std::vector<bool> slot_out;
+
+    uint64_t generation;
+    std::vector<uint8_t> parent_state; // full, for slots coming from an older parent
+    std::vector<uint8_t> parent_devices; // everything but memory, loaded on every fork
+    std::vector<uint8_t> parent_memory; // the whole address space, dirty pages come back from here
+    std::vector<uint8_t> parent_ram; // every cart RAM bank, changed ones come back from here
+    std::vector<uint64_t> ram_versions; // per slot, every bank's version right after its last reset
+
+    ForkStats stats;
+};
@@ -0,0 +1,39 @@
+#include "frame-exchange.h"
+
+FrameExchange::FrameExchange(): buffers{}, frame_numbers{}, middle(1), published_frames(0), back(0), front(2)
+{
+}
+
+uint8_t* FrameExchange::BackBuffer()
+{
+    return buffers[back];
+}
+
+void FrameExchange::Publish(uint64_t frame_number)
+{
+    frame_numbers[back] = frame_number;
+
+    // release so the pixels are visible before the index, acquire so we don't reuse a buffer the consumer still reads
+    const uint8_t previous_middle = middle.exchange(back | FRESH_BIT, std::memory_order_acq_rel);
+    back = previous_middle & INDEX_MASK;
+
+    published_frames.fetch_add(1, std::memory_order_release);
+}
+
+bool FrameExchange::AcquireLatest(FrameView& view)
+{
+    if ((middle.load(std::memory_order_relaxed) & FRESH_BIT) == 0)
+        return false;
+
+    const uint8_t previous_middle = middle.exchange(front, std::memory_order_acq_rel);
+    front = previous_middle & INDEX_MASK;
+
+    view.pixels = buffers[front];
+    view.frame_number = frame_numbers[front];
+    return true;
+}
+
+uint64_t FrameExchange::PublishedFrames() const
+{
+    return published_frames.load(std::memory_order_acquire);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#include "scanline-renderer.h"
+
+#define FRAMEBUFFER_SIZE (LCD_WIDTH * LCD_HEIGHT)
+
+// read-only view of a published frame, one shade (0-3) per byte, row after row
+// stays valid until the same consumer calls AcquireLatest again
+struct FrameView
+{
+    const uint8_t* pixels;
+    uint64_t frame_number; // emulated frame, a gap to the previous view means frames were skipped
+};
+
+// triple buffering between one producer and one consumer, nothing is ever copied or allocated
+// the producer draws into the back buffer and swaps it with the middle one, the consumer swaps
+// the middle one with its front buffer when a newer frame is there
+class FrameExchange
+{
+public:
+    FrameExchange();
+    FrameExchange(const FrameExchange&) = delete;
+    FrameExchange& operator=(const FrameExchange&) = delete;
+
+    // producer side
+    uint8_t* BackBuffer();
+    void Publish(uint64_t frame_number);
+
+    // consumer side, returns false if nothing newer than the last view was published
+    bool AcquireLatest(FrameView& view);
+    // frames published so far, can be polled from any thread
+    uint64_t PublishedFrames() const;
+private:
+    static constexpr uint8_t FRESH_BIT = 0b100;
+    static constexpr uint8_t INDEX_MASK = 0b011;
+
+    alignas(64) uint8_t buffers[3][FRAMEBUFFER_SIZE];
+    uint64_t frame_numbers[3];
+
+    alignas(64) std::atomic<uint8_t> middle; // index of the middle buffer, FRESH_BIT set if the consumer hasn't taken it
+    std::atomic<uint64_t> published_frames;
+
+    alignas(64) uint8_t back; // producer only
+    alignas(64) uint8_t front; // consumer only
+};
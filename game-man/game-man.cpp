@@ -1,25 +1,364 @@
 ﻿// game-man.cpp : Defines the entry point for the application.
 //
+// headless runner, runs a ROM for a number of frames as fast as it's allowed to and reports how fast that was
 
 #include "game-man.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
-#include "cpu.h"
+#include "audio-writer.h"
+#include "batch-runner.h"
+#include "battery-saver.h"
 #include "file_handle.h"
-#include "memory.h"
+#include "lockstep-batch.h"
+#include "machine-arena.h"
+#include "machine.h"
+#include "movie.h"
+#include "state-hash.h"
 
 using namespace std;
 
-int main()
+namespace
 {
-	cout << "Hello CMake." << endl;
-	auto gc = GamepadController();
-	auto mem = Memory(gc);
-	auto fh = FileHandle("E:\\tetris-rom\\tetris-rom.gb");
-	auto& vec = fh.GetFileContentsVector();
-	mem.SetRomMemory(vec);
-	auto gb_cpu = Cpu(mem);
-	gb_cpu.StartExecution();
-	scanf_s("%s");
-	return 0;
+	struct Options
+	{
+		string rom_path;
+		uint64_t frames = 0; // 0 = as long as the movie, or DEFAULT_FRAMES without one
+		double speed = 0.0; // multiple of real time, 0 = unlimited
+		string movie_in;
+		string movie_out;
+		string audio_out;
+		uint32_t audio_rate = 48000;
+		string state_out;
+		string battery;
+		string hash_log;
+		uint32_t instances = 1; // more than one runs them all on a work stealing pool
+		unsigned threads = 0; // 0 = one per core
+		uint32_t slice_frames = 1;
+		bool pin = false;
+		bool lockstep = false;
+	};
+
+	constexpr uint64_t DEFAULT_FRAMES = 3600;
+
+	void PrintUsage()
+	{
+		cout << "usage: game-man <rom> [options]\n"
+			"  --frames N          frames to run (default: the movie's length, or " << DEFAULT_FRAMES << ")\n"
+			"  --speed S           unlimited (default), realtime, or a multiple of real time like 2x\n"
+			"  --play FILE         replay an input movie\n"
+			"  --record FILE       record the input into a movie\n"
+			"  --audio-out FILE    write audio, .wav gets a header, anything else is raw s16le stereo\n"
+			"  --audio-rate HZ     audio output rate (default 48000)\n"
+			"  --state-out FILE    save state at the end\n"
+			"  --battery FILE      load/store battery backed cartridge RAM\n"
+			"  --hash-log FILE     write a hash of the whole machine state after every frame, compare with game-man-hash-compare\n"
+			"  --instances N       run N copies of the ROM in parallel and report the total throughput\n"
+			"  --threads N         worker threads for --instances (default: one per core)\n"
+			"  --slice N           frames a copy runs before going back to the pool (default 1)\n"
+			"  --pin               pin every worker thread to its own core\n"
+			"  --lockstep          run the --instances in lockstep groups of up to " << LOCKSTEP_MAX_LANES << ", SIMD where they agree\n";
+	}
+
+	double ParseSpeed(const string& val)
+	{
+		if (val == "unlimited")
+			return 0.0;
+		if (val == "realtime")
+			return 1.0;
+
+		const double speed = strtod(val.c_str(), nullptr);
+		if (speed <= 0.0)
+			throw runtime_error("--speed has to be unlimited, realtime or a positive multiple like 2x");
+		return speed;
+	}
+
+	Options ParseOptions(int argc, char** argv)
+	{
+		Options options;
+		for (int i = 1; i < argc; ++i)
+		{
+			const string arg = argv[i];
+			auto next = [&]() -> string
+			{
+				if (i + 1 >= argc)
+					throw runtime_error(arg + " needs a value");
+				return argv[++i];
+			};
+
+			if (arg == "--frames")
+				options.frames = strtoull(next().c_str(), nullptr, 10);
+			else if (arg == "--speed")
+				options.speed = ParseSpeed(next());
+			else if (arg == "--play")
+				options.movie_in = next();
+			else if (arg == "--record")
+				options.movie_out = next();
+			else if (arg == "--audio-out")
+				options.audio_out = next();
+			else if (arg == "--audio-rate")
+				options.audio_rate = static_cast<uint32_t>(strtoul(next().c_str(), nullptr, 10));
+			else if (arg == "--state-out")
+				options.state_out = next();
+			else if (arg == "--battery")
+				options.battery = next();
+			else if (arg == "--hash-log")
+				options.hash_log = next();
+			else if (arg == "--instances")
+				options.instances = static_cast<uint32_t>(strtoul(next().c_str(), nullptr, 10));
+			else if (arg == "--threads")
+				options.threads = static_cast<unsigned>(strtoul(next().c_str(), nullptr, 10));
+			else if (arg == "--slice")
+				options.slice_frames = static_cast<uint32_t>(strtoul(next().c_str(), nullptr, 10));
+			else if (arg == "--pin")
+				options.pin = true;
+			else if (arg == "--lockstep")
+				options.lockstep = true;
+			else if (!arg.empty() && arg[0] != '-' && options.rom_path.empty())
+				options.rom_path = arg;
+			else
+				throw runtime_error("unknown option " + arg);
+		}
+
+		if (options.rom_path.empty())
+			throw runtime_error("no ROM given");
+		if (options.instances == 0)
+			throw runtime_error("--instances has to be at least 1");
+		if (options.instances > 1 && (!options.movie_out.empty() || !options.audio_out.empty() || !options.state_out.empty()
+			|| !options.battery.empty() || !options.hash_log.empty() || options.speed > 0.0))
+			throw runtime_error("--instances only goes with --frames, --play, --threads, --slice, --pin and --lockstep");
+		return options;
+	}
+
+	bool EndsWith(const string& val, const string& suffix)
+	{
+		return val.size() >= suffix.size() && val.compare(val.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	template <typename T>
+	T Percentile(const vector<T>& sorted, double percentile)
+	{
+		return sorted[min(sorted.size() - 1, static_cast<size_t>(percentile * sorted.size()))];
+	}
+
+	// every copy gets the same ROM and, with --play, its own player over the same movie
+	int RunBatch(const Options& options)
+	{
+		auto fh = FileHandle(options.rom_path);
+		auto& rom = fh.GetFileContentsVector();
+
+		InputMovie movie;
+		if (!options.movie_in.empty())
+			movie = InputMovie::Load(options.movie_in);
+
+		MachineArena machines(make_shared<const vector<uint8_t>>(rom), options.instances);
+		vector<unique_ptr<MoviePlayer>> players;
+		vector<Machine*> batch = machines.Machines();
+		for (Machine* machine : batch)
+		{
+			if (!options.movie_in.empty())
+			{
+				players.push_back(make_unique<MoviePlayer>(movie));
+				machine->GetGamepad().SetInputHook(players.back().get());
+			}
+		}
+
+		uint64_t frames = options.frames;
+		if (frames == 0)
+			frames = options.movie_in.empty() ? DEFAULT_FRAMES : movie.end_frame + 1;
+
+		WorkStealingPool pool(options.threads, options.pin);
+		BatchStats stats = {};
+		vector<unique_ptr<LockstepBatch>> groups;
+		if (options.lockstep)
+		{
+			// one task per group, a group is one thread's worth of lanes
+			for (size_t i = 0; i < batch.size(); i += LOCKSTEP_MAX_LANES)
+			{
+				const vector<Machine*> lanes(batch.begin() + i, batch.begin() + min(batch.size(), i + LOCKSTEP_MAX_LANES));
+				groups.push_back(make_unique<LockstepBatch>(lanes));
+			}
+
+			const auto start = chrono::steady_clock::now();
+			for (auto& group : groups)
+				pool.Submit([&group, frames] { group->RunFrames(frames); });
+			pool.Wait();
+			stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			stats.frames = frames * batch.size();
+		}
+		else
+		{
+			BatchRunner runner(pool, options.slice_frames);
+			stats = runner.Run(batch, frames);
+		}
+
+		uint64_t instructions = 0;
+		uint64_t cycles = 0;
+		for (Machine* machine : batch)
+		{
+			instructions += machine->GetCpu().InstructionCount();
+			cycles += machine->Cycles();
+		}
+		const double emulated_seconds = static_cast<double>(cycles) / GB_CLOCK;
+
+		cout << "instances:     " << options.instances << " x " << MachineArena::SLOT_SIZE / 1024 << " KiB on " << pool.WorkerCount() << " threads, "
+			<< options.slice_frames << " frame slices" << (options.pin ? ", pinned" : "") << "\n";
+		cout << "frames:        " << stats.frames << " in " << stats.seconds << " s, " << stats.frames / stats.seconds
+			<< " frames/s, " << emulated_seconds / stats.seconds << "x real time\n";
+		cout << "instructions:  " << instructions << ", " << instructions / stats.seconds / 1e6 << " M/s\n";
+		if (!options.lockstep)
+			cout << "scheduling:    " << stats.slices << " slices, " << stats.steals << " moved to another thread\n";
+		for (size_t i = 0; i < groups.size(); ++i)
+		{
+			const LockstepStats& lockstep = groups[i]->Stats();
+			cout << "lockstep " << i << ":    " << groups[i]->Lanes() << " lanes" << (groups[i]->UsesAvx2() ? " AVX2" : " scalar")
+				<< ", " << lockstep.Utilization() * 100.0 << "% of lane instructions vectorized, "
+				<< lockstep.AverageVectorWidth() << " lanes/vector step, " << lockstep.divergent_steps << " divergent and "
+				<< lockstep.unsupported_steps << " scalar-only of " << lockstep.steps << " steps\n";
+		}
+		return 0;
+	}
+
+	int Run(const Options& options)
+	{
+		if (options.instances > 1)
+			return RunBatch(options);
+
+		auto fh = FileHandle(options.rom_path);
+		auto& rom = fh.GetFileContentsVector();
+
+		unique_ptr<BatterySaver> battery;
+		if (!options.battery.empty())
+			battery = make_unique<BatterySaver>(options.battery);
+
+		auto machine = Machine(rom);
+		if (battery)
+			machine.GetCartridge().AttachBattery(*battery);
+
+		InputMovie movie;
+		unique_ptr<MoviePlayer> player;
+		MovieRecorder recorder;
+		if (!options.movie_in.empty())
+		{
+			movie = InputMovie::Load(options.movie_in);
+			player = make_unique<MoviePlayer>(movie);
+			machine.GetGamepad().SetInputHook(player.get());
+		}
+		else if (!options.movie_out.empty())
+		{
+			machine.GetGamepad().SetInputHook(&recorder);
+		}
+
+		unique_ptr<AudioWriter> audio;
+		if (!options.audio_out.empty())
+		{
+			const auto format = EndsWith(options.audio_out, ".wav") ? AudioFileFormat::Wav : AudioFileFormat::RawPcm;
+			audio = make_unique<AudioWriter>(machine.GetApu(), options.audio_out, format, options.audio_rate);
+		}
+
+		uint64_t frames = options.frames;
+		if (frames == 0)
+			frames = player ? movie.end_frame + 1 : DEFAULT_FRAMES;
+
+		// pacing happens once per frame against an absolute schedule, so oversleeping one frame is made up in the next
+		using clock = chrono::steady_clock;
+		const auto frame_time = chrono::duration_cast<clock::duration>(
+			chrono::duration<double>(static_cast<double>(FRAME_CYCLES_TOTAL) / GB_CLOCK / max(options.speed, 1e-9)));
+
+		vector<uint64_t> frame_cycles;
+		vector<double> frame_micros;
+		frame_cycles.reserve(frames);
+		frame_micros.reserve(frames);
+
+		FrameHasher hasher;
+		FrameHashLog hash_log;
+		const bool hashing = !options.hash_log.empty();
+		if (hashing)
+		{
+			hash_log.first_frame = machine.FrameCount() + 1;
+			hash_log.hashes.reserve(frames);
+		}
+
+		const auto start = clock::now();
+		auto deadline = start;
+		for (uint64_t frame = 0; frame < frames; ++frame)
+		{
+			const auto frame_start = clock::now();
+			frame_cycles.push_back(machine.RunFrame());
+			if (hashing)
+				hash_log.hashes.push_back(hasher.Hash(machine));
+			frame_micros.push_back(chrono::duration<double, micro>(clock::now() - frame_start).count());
+
+			if (options.speed > 0.0)
+			{
+				deadline += frame_time;
+				this_thread::sleep_until(deadline);
+			}
+		}
+		const double elapsed = chrono::duration<double>(clock::now() - start).count();
+
+		if (audio)
+			audio->Stop();
+		if (battery)
+		{
+			// the last write has to happen here and not in the destructors, that's where its errors get reported
+			machine.GetCartridge().FlushBattery();
+			battery->Stop();
+		}
+		if (hashing)
+			hash_log.Save(options.hash_log);
+		if (!options.movie_out.empty() && !player)
+			recorder.Movie().Save(options.movie_out);
+		if (!options.state_out.empty())
+		{
+			vector<uint8_t> state;
+			machine.SaveState(state);
+			ofstream file(options.state_out, ios::binary | ios::trunc);
+			if (!file.write(reinterpret_cast<const char*>(state.data()), state.size()))
+				throw runtime_error("couldn't write " + options.state_out);
+		}
+
+		const uint64_t instructions = machine.GetCpu().InstructionCount();
+		const double emulated_seconds = static_cast<double>(machine.Cycles()) / GB_CLOCK;
+		sort(frame_cycles.begin(), frame_cycles.end());
+		sort(frame_micros.begin(), frame_micros.end());
+
+		cout << "frames:        " << frames << " in " << elapsed << " s, " << frames / elapsed << " frames/s, "
+			<< emulated_seconds / elapsed << "x real time\n";
+		cout << "instructions:  " << instructions << ", " << instructions / elapsed / 1e6 << " M/s\n";
+		if (!frame_cycles.empty())
+		{
+			cout << "cycles/frame:  min " << frame_cycles.front() << "  p50 " << Percentile(frame_cycles, 0.5)
+				<< "  p99 " << Percentile(frame_cycles, 0.99) << "  max " << frame_cycles.back() << "\n";
+			cout << "host us/frame: min " << frame_micros.front() << "  p50 " << Percentile(frame_micros, 0.5)
+				<< "  p99 " << Percentile(frame_micros, 0.99) << "  max " << frame_micros.back() << "\n";
+		}
+		cout << "dropped:       " << machine.GetCompositor().DroppedFrames() << " video frames, "
+			<< machine.GetApu().DroppedSamples() << " audio samples\n";
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		return Run(ParseOptions(argc, argv));
+	}
+	catch (const exception& e)
+	{
+		cerr << "game-man: " << e.what() << "\n";
+		if (argc < 2)
+			PrintUsage();
+		return 1;
+	}
 }
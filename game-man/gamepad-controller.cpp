@@ -1,68 +1,82 @@
 #include "gamepad-controller.h"
 
-#include <stdexcept>
+GamepadController::GamepadController(): input_hook(nullptr), host_buttons(0), latched(0), select(0x30), direction_mask(0), button_mask(0), lines_low(0)
+{
+}
 
-GamepadController::GamepadController():output_state(OutputState::None)
+bool GamepadController::UpdateLines()
 {
-    this->pressed_buttons = {
-        {Button::Right, false},
-        {Button::Left, false},
-        {Button::Up, false},
-        {Button::Down, false},
-        {Button::A, false},
-        {Button::B, false},
-        {Button::Select, false},
-        {Button::Start, false}
-    };
+    const uint8_t lines = (latched & direction_mask) | ((latched >> 4) & button_mask);
+    const bool falling_edge = (lines & ~lines_low) != 0;
+    lines_low = lines;
+    return falling_edge;
 }
 
-void GamepadController::SetOutputState(uint8_t mode)
+bool GamepadController::SetOutputState(uint8_t mode)
 {
-    if ((mode & 0x20) == 0x20)
-        this->output_state = OutputState::P14;
+    this->select = mode & 0x30;
+    this->direction_mask = (mode & 0x10) == 0 ? 0x0F : 0;
+    this->button_mask = (mode & 0x20) == 0 ? 0x0F : 0;
+    return UpdateLines();
+}
 
-    if ((mode & 0x10) == 0x10)
-        this->output_state = OutputState::P15;
+bool GamepadController::Latch(uint64_t frame)
+{
+    const uint8_t host = host_buttons.load(std::memory_order_acquire);
+    this->latched = input_hook != nullptr ? input_hook->OnLatch(frame, host) : host;
+    return UpdateLines();
+}
 
-    if ((mode & 0x30) == 0x30)
-    {
-        this->output_state = OutputState::None;
-    }
+void GamepadController::SetInputHook(InputHook* hook)
+{
+    this->input_hook = hook;
 }
 
-uint8_t GamepadController::GetOutput()
+void GamepadController::SetButtonValue(const Button b, const bool val)
 {
-    if (this->output_state == OutputState::P15)
-        return static_cast<uint8_t>(~(static_cast<uint8_t>(Button::Right) | static_cast<uint8_t>(Button::Left) |
-            static_cast<uint8_t>(Button::Up) | static_cast<uint8_t>(Button::Down))
-            & 0x0F) | HiBit();
+    if (val)
+        host_buttons.fetch_or(static_cast<uint8_t>(b), std::memory_order_release);
+    else
+        host_buttons.fetch_and(static_cast<uint8_t>(~static_cast<uint8_t>(b)), std::memory_order_release);
+}
 
-    if (this->output_state == OutputState::P14)
-        return static_cast<uint8_t>(~((static_cast<uint8_t>(Button::A) | static_cast<uint8_t>(Button::B) |
-                static_cast<uint8_t>(Button::Select) | static_cast<uint8_t>(Button::Start)) >> 4) // shift right 4, as we only want to output low 4 bits
-            & 0x0F) | HiBit();
+void GamepadController::SetButtons(uint8_t mask)
+{
+    host_buttons.store(mask, std::memory_order_release);
+}
 
-    return 0x0F | HiBit();
+uint8_t GamepadController::GetButtons() const
+{
+    return host_buttons.load(std::memory_order_acquire);
 }
 
-void GamepadController::SetButtonValue(const Button b, const bool val)
+uint8_t GamepadController::GetLatchedButtons() const
 {
-    this->pressed_buttons[b] = val;
+    return latched;
 }
 
-uint8_t GamepadController::HiBit()
+namespace
 {
-    switch(this->output_state)
+    struct GamepadState
     {
-    case OutputState::None: 
-        return 0xF0;
-    case OutputState::P15:
-        return 0b11010000;
-    case OutputState::P14:
-        return 0b11100000;
-    }
-
-    throw std::runtime_error("Unexpected OutputState");
+        uint8_t latched;
+        uint8_t select;
+        uint8_t lines_low;
+    };
 }
 
+void GamepadController::SaveState(StateWriter& writer) const
+{
+    writer.Write("JOYP", GamepadState{ latched, select, lines_low });
+}
 
+void GamepadController::LoadState(StateReader& reader)
+{
+    GamepadState saved;
+    reader.Read("JOYP", saved);
+    this->latched = saved.latched;
+    this->select = saved.select;
+    this->lines_low = saved.lines_low;
+    this->direction_mask = (select & 0x10) == 0 ? 0x0F : 0;
+    this->button_mask = (select & 0x20) == 0 ? 0x0F : 0;
+}
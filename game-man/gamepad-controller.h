@@ -1,29 +1,69 @@
 #pragma once
-#include <unordered_map>
+#include <atomic>
+#include <cstdint>
 
+#include "save-state.h"
+
+// sits between the host's buttons and what the game gets to see, movies record/replay through this
+// called on the emulation thread at every latch, frame is the Ppu's frame counter
+class InputHook
+{
+public:
+    virtual ~InputHook() = default;
+    virtual uint8_t OnLatch(uint64_t frame, uint8_t host_buttons) = 0;
+};
+
+// buttons are one bit each in a single byte, 1 = pressed
+// any thread may press/release through the atomic host mask, the emulation thread only sees it
+// once it gets latched (once per frame), so a game reading 0xFF00 twice in a row gets the same answer
 class GamepadController
 {
 public:
-    enum class OutputState{None, P14, P15};
     enum class Button
     {
-        // P15
+        // P14 low
         Right = 0x1,
         Left = 0x2,
         Up = 0x4,
         Down = 0x8,
-        // P14
+        // P15 low
         A = 0x10,
         B = 0x20,
         Select = 0x40,
         Start = 0x80
     };
     GamepadController();
-    void SetOutputState(uint8_t mode);
-    uint8_t GetOutput();
+
+    // emulation thread, both return true if any of P10-P13 went from high to low (joypad interrupt)
+    bool SetOutputState(uint8_t mode);
+    bool Latch(uint64_t frame);
+    // nullptr to detach, not owned
+    void SetInputHook(InputHook* hook);
+
+    uint8_t GetOutput() const
+    {
+        const uint8_t lines = (latched & direction_mask) | ((latched >> 4) & button_mask);
+        return static_cast<uint8_t>(0xC0 | select | (~lines & 0x0F));
+    }
+
+    // any thread, lock free
     void SetButtonValue(Button b, bool val);
+    void SetButtons(uint8_t mask);
+    uint8_t GetButtons() const;
+    uint8_t GetLatchedButtons() const;
+
+    // emulation thread side only, the host mask and the hook stay as they are
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
 private:
-    OutputState output_state;
-    std::unordered_map<Button, bool> pressed_buttons;
-    uint8_t HiBit();
-};
\ No newline at end of file
+    bool UpdateLines();
+
+    InputHook* input_hook;
+    std::atomic<uint8_t> host_buttons;
+    uint8_t latched;
+    uint8_t select; // P14/P15 as last written, bits 4-5
+    // precomputed from select, so reading 0xFF00 is just masks, no branches
+    uint8_t direction_mask;
+    uint8_t button_mask;
+    uint8_t lines_low; // P10-P13 currently pulled low, 1 = low
+};
@@ -0,0 +1,60 @@
+// hash-compare.cpp : compares two --hash-log files
+//
+// exits 0 when they agree on every frame both of them have, 1 at the first frame where they don't, 2 on bad arguments
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+
+#include "state-hash.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		cerr << "usage: game-man-hash-compare <log a> <log b>\n";
+		return 2;
+	}
+
+	try
+	{
+		const FrameHashLog a = FrameHashLog::Load(argv[1]);
+		const FrameHashLog b = FrameHashLog::Load(argv[2]);
+
+		// only the frames both logs cover count, one of them may have started later or run longer
+		const uint64_t first = max(a.first_frame, b.first_frame);
+		const uint64_t end = min(a.first_frame + a.hashes.size(), b.first_frame + b.hashes.size());
+		if (first >= end)
+		{
+			cerr << "game-man-hash-compare: the logs have no frame in common\n";
+			return 2;
+		}
+
+		for (uint64_t frame = first; frame < end; ++frame)
+		{
+			const uint64_t hash_a = a.hashes[frame - a.first_frame];
+			const uint64_t hash_b = b.hashes[frame - b.first_frame];
+			if (hash_a != hash_b)
+			{
+				cout << "diverged at frame " << frame << ": " << hex << setfill('0') << setw(16) << hash_a << " vs " << setw(16) << hash_b << dec
+					<< " (" << frame - first << " matching frames before it)\n";
+				return 1;
+			}
+		}
+
+		cout << "identical over frames " << first << "-" << end - 1 << " (" << end - first << " frames)\n";
+		if (a.first_frame != b.first_frame || a.hashes.size() != b.hashes.size())
+			cout << "the logs cover different ranges, " << a.first_frame << "-" << a.first_frame + a.hashes.size() - 1
+				<< " and " << b.first_frame << "-" << b.first_frame + b.hashes.size() - 1 << "\n";
+		return 0;
+	}
+	catch (const exception& e)
+	{
+		cerr << "game-man-hash-compare: " << e.what() << "\n";
+		return 2;
+	}
+}
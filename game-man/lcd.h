@@ -0,0 +1,8 @@
+#pragma once
+
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 144
+#define VRAM_SIZE 0x2000
+#define OAM_SIZE 0xA0
+#define OAM_SPRITE_COUNT 40
+#define MAX_SPRITES_PER_LINE 10
@@ -0,0 +1,35 @@
+// built with AVX2 enabled (see CMakeLists.txt), nothing in here may run before LockstepBatch checked the cpu
+#include "lockstep-kernel.h"
+
+#include <immintrin.h>
+
+namespace
+{
+    struct Avx2Ops
+    {
+        using Vector = __m256i;
+        static constexpr std::size_t WIDTH = 32;
+
+        static Vector Load(const uint8_t* src) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(src)); }
+        static void Store(uint8_t* dst, Vector val) { _mm256_store_si256(reinterpret_cast<__m256i*>(dst), val); }
+        static Vector Splat(uint8_t val) { return _mm256_set1_epi8(static_cast<char>(val)); }
+        static Vector Add(Vector a, Vector b) { return _mm256_add_epi8(a, b); }
+        static Vector Sub(Vector a, Vector b) { return _mm256_sub_epi8(a, b); }
+        static Vector AddSaturate(Vector a, Vector b) { return _mm256_adds_epu8(a, b); }
+        static Vector And(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+        static Vector Or(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+        static Vector Xor(Vector a, Vector b) { return _mm256_xor_si256(a, b); }
+        static Vector Eq(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+        // unsigned a >= b, there's no unsigned byte compare but max(a, b) == a is the same thing
+        static Vector GreaterEqual(Vector a, Vector b) { return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a); }
+        // no byte shifts either, shift 16 bit words and drop what crossed over from the neighbour
+        static Vector ShiftRight1(Vector a) { return _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F)); }
+        static Vector Blend(Vector old_val, Vector new_val, Vector mask) { return _mm256_blendv_epi8(old_val, new_val, mask); }
+    };
+}
+
+void ExecuteLockstepAvx2(LockstepRegisters& regs, std::size_t lanes, const LockstepInstruction& instruction, uint8_t immediate)
+{
+    // padding lanes past `lanes` are inactive, so rounding up to whole registers is safe
+    ExecuteLockstep<Avx2Ops>(regs, (lanes + Avx2Ops::WIDTH - 1) / Avx2Ops::WIDTH * Avx2Ops::WIDTH, instruction, immediate);
+}
@@ -0,0 +1,317 @@
+#include "lockstep-batch.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(LOCKSTEP_AVX2) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // the same kernel a lane at a time, for cpus without AVX2, compilers vectorize it with whatever they may use
+    struct ScalarOps
+    {
+        using Vector = uint8_t;
+        static constexpr std::size_t WIDTH = 1;
+
+        static Vector Load(const uint8_t* src) { return *src; }
+        static void Store(uint8_t* dst, Vector val) { *dst = val; }
+        static Vector Splat(uint8_t val) { return val; }
+        static Vector Add(Vector a, Vector b) { return static_cast<uint8_t>(a + b); }
+        static Vector Sub(Vector a, Vector b) { return static_cast<uint8_t>(a - b); }
+        static Vector AddSaturate(Vector a, Vector b) { return a + b > 0xFF ? 0xFF : static_cast<uint8_t>(a + b); }
+        static Vector And(Vector a, Vector b) { return a & b; }
+        static Vector Or(Vector a, Vector b) { return a | b; }
+        static Vector Xor(Vector a, Vector b) { return a ^ b; }
+        static Vector Eq(Vector a, Vector b) { return a == b ? 0xFF : 0x00; }
+        static Vector GreaterEqual(Vector a, Vector b) { return a >= b ? 0xFF : 0x00; }
+        static Vector ShiftRight1(Vector a) { return a >> 1; }
+        static Vector Blend(Vector old_val, Vector new_val, Vector mask) { return (old_val & ~mask) | (new_val & mask); }
+    };
+
+    constexpr std::array<LockstepInstruction, 256> BuildDecodeTable()
+    {
+        std::array<LockstepInstruction, 256> table = {};
+        for (int opcode = 0; opcode < 256; ++opcode)
+            table[opcode] = DecodeLockstep(static_cast<uint8_t>(opcode));
+        return table;
+    }
+
+    constexpr std::array<LockstepInstruction, 256> DECODE_TABLE = BuildDecodeTable();
+
+    uint8_t FlagMask(bool flag)
+    {
+        return flag ? 0xFF : 0x00;
+    }
+
+    // whatever bytes follow the opcode, little endian
+    uint16_t ReadOperand(Memory& memory, uint16_t pc, uint8_t length)
+    {
+        if (length == 3)
+            return memory.ReadMemory16(pc + 1);
+        if (length == 2)
+            return memory.ReadMemory8(pc + 1);
+        return 0;
+    }
+}
+
+bool LockstepBatch::Taken(uint8_t condition, std::size_t lane) const
+{
+    switch (condition)
+    {
+    case LOCKSTEP_COND_NZ: return regs.z[lane] == 0;
+    case LOCKSTEP_COND_Z: return regs.z[lane] != 0;
+    case LOCKSTEP_COND_NC: return regs.c[lane] == 0;
+    default: return regs.c[lane] != 0;
+    }
+}
+
+// jumps exactly like Execute_Jr_n/Jr_Flag/Jp_16/Jp_16_Flag, the rest just moves on
+uint16_t LockstepBatch::NextPc(const LockstepInstruction& instruction, uint16_t pc, uint16_t operand, std::size_t lane, uint8_t& cycles) const
+{
+    cycles = instruction.cycles;
+    switch (instruction.op)
+    {
+    case LockstepOp::Jr:
+        // Execute_Jr_n adds the 2 before widening, so the offset wraps as an int8_t
+        return pc + static_cast<int8_t>(static_cast<int8_t>(operand) + 2);
+    case LockstepOp::JrCond:
+        if (!Taken(instruction.src, lane))
+            return pc + 2;
+        cycles = 12;
+        return pc + 2 + static_cast<int8_t>(operand);
+    case LockstepOp::Jp:
+        return operand;
+    case LockstepOp::JpCond:
+        return Taken(instruction.src, lane) ? operand : pc + 3;
+    default:
+        return pc + instruction.length;
+    }
+}
+
+double LockstepStats::Utilization() const
+{
+    const uint64_t total = vector_lane_instructions + scalar_lane_instructions;
+    return total == 0 ? 0.0 : static_cast<double>(vector_lane_instructions) / total;
+}
+
+double LockstepStats::AverageVectorWidth() const
+{
+    return vector_steps == 0 ? 0.0 : static_cast<double>(vector_lane_instructions) / vector_steps;
+}
+
+LockstepBatch::LockstepBatch(const std::vector<Machine*>& machines, bool allow_avx2): machines(machines), target_frames(machines.size())
+{
+    if (machines.empty() || machines.size() > LOCKSTEP_MAX_LANES)
+        throw std::runtime_error("A lockstep batch takes 1 to " + std::to_string(LOCKSTEP_MAX_LANES) + " machines");
+
+    this->avx2 = allow_avx2 && CpuHasAvx2();
+    std::memset(&this->regs, 0, sizeof(this->regs));
+    ResetStats();
+}
+
+bool LockstepBatch::CpuHasAvx2()
+{
+#if defined(LOCKSTEP_AVX2) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2");
+#elif defined(LOCKSTEP_AVX2) && defined(_MSC_VER)
+    // cpuid says the cpu can, xgetbv says the OS saves the ymm registers
+    int info[4];
+    __cpuid(info, 1);
+    const bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0b110) == 0b110;
+    __cpuidex(info, 7, 0);
+    return os_saves_avx && (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+void LockstepBatch::LoadLane(std::size_t lane)
+{
+    const CpuRegisters cpu = machines[lane]->GetCpu().GetRegisters();
+    regs.r[LOCKSTEP_A][lane] = cpu.a;
+    regs.r[LOCKSTEP_F][lane] = cpu.f;
+    regs.r[LOCKSTEP_B][lane] = cpu.b;
+    regs.r[LOCKSTEP_C][lane] = cpu.c;
+    regs.r[LOCKSTEP_D][lane] = cpu.d;
+    regs.r[LOCKSTEP_E][lane] = cpu.e;
+    regs.r[LOCKSTEP_H][lane] = cpu.h;
+    regs.r[LOCKSTEP_L][lane] = cpu.l;
+    regs.sp[lane] = cpu.sp;
+    regs.pc[lane] = cpu.pc;
+    regs.z[lane] = FlagMask(cpu.flag_z);
+    regs.n[lane] = FlagMask(cpu.flag_n);
+    regs.h[lane] = FlagMask(cpu.flag_h);
+    regs.c[lane] = FlagMask(cpu.flag_c);
+}
+
+void LockstepBatch::StoreLane(std::size_t lane)
+{
+    CpuRegisters cpu;
+    cpu.a = regs.r[LOCKSTEP_A][lane];
+    cpu.f = regs.r[LOCKSTEP_F][lane];
+    cpu.b = regs.r[LOCKSTEP_B][lane];
+    cpu.c = regs.r[LOCKSTEP_C][lane];
+    cpu.d = regs.r[LOCKSTEP_D][lane];
+    cpu.e = regs.r[LOCKSTEP_E][lane];
+    cpu.h = regs.r[LOCKSTEP_H][lane];
+    cpu.l = regs.r[LOCKSTEP_L][lane];
+    cpu.sp = regs.sp[lane];
+    cpu.pc = regs.pc[lane];
+    cpu.flag_z = regs.z[lane] != 0;
+    cpu.flag_n = regs.n[lane] != 0;
+    cpu.flag_h = regs.h[lane] != 0;
+    cpu.flag_c = regs.c[lane] != 0;
+    machines[lane]->GetCpu().SetRegisters(cpu);
+}
+
+void LockstepBatch::LoadLanes()
+{
+    for (std::size_t lane = 0; lane < machines.size(); ++lane)
+        LoadLane(lane);
+}
+
+void LockstepBatch::StoreLanes()
+{
+    for (std::size_t lane = 0; lane < machines.size(); ++lane)
+        StoreLane(lane);
+}
+
+bool LockstepBatch::FinishLane(std::size_t lane)
+{
+    if (machines[lane]->FrameCount() < target_frames[lane])
+        return false;
+
+    regs.active[lane] = 0x00;
+    return true;
+}
+
+std::size_t LockstepBatch::Step()
+{
+    const std::size_t lanes = machines.size();
+    ++stats.steps;
+
+    std::size_t first = 0;
+    while (regs.active[first] == 0)
+        ++first;
+
+    // all active lanes have to be at the same pc looking at the same bytes, banked ROM or code in RAM can differ
+    // after that they may still part ways on a conditional jump
+    const uint16_t pc = regs.pc[first];
+    const uint8_t opcode = machines[first]->GetMemory().ReadMemory8(pc);
+    const LockstepInstruction& instruction = DECODE_TABLE[opcode];
+    const uint16_t operand = ReadOperand(machines[first]->GetMemory(), pc, instruction.length);
+
+    bool same_code = true;
+    for (std::size_t lane = first + 1; lane < lanes && same_code; ++lane)
+    {
+        if (regs.active[lane] == 0)
+            continue;
+
+        Memory& memory = machines[lane]->GetMemory();
+        same_code = regs.pc[lane] == pc && memory.ReadMemory8(pc) == opcode
+            && ReadOperand(memory, pc, instruction.length) == operand;
+    }
+
+    std::size_t finished = 0;
+    if (same_code && instruction.op != LockstepOp::Scalar)
+    {
+        ++stats.vector_steps;
+#ifdef LOCKSTEP_AVX2
+        if (avx2)
+            ExecuteLockstepAvx2(regs, lanes, instruction, static_cast<uint8_t>(operand));
+        else
+#endif
+            ExecuteLockstep<ScalarOps>(regs, lanes, instruction, static_cast<uint8_t>(operand));
+
+        // the instruction itself is done, the rest of a Step is per machine
+        for (std::size_t lane = first; lane < lanes; ++lane)
+        {
+            if (regs.active[lane] == 0)
+                continue;
+
+            Cpu& cpu = machines[lane]->GetCpu();
+            uint8_t cycles;
+            regs.pc[lane] = NextPc(instruction, pc, operand, lane, cycles);
+            cpu.RetireInstruction(pc, cycles);
+            if (cpu.ControlPending())
+            {
+                StoreLane(lane);
+                cpu.FinishStep();
+                LoadLane(lane);
+            }
+
+            ++stats.vector_lane_instructions;
+            finished += FinishLane(lane);
+        }
+        return finished;
+    }
+
+    if (same_code)
+    {
+        ++stats.unsupported_steps;
+        ++stats.unsupported_opcodes[opcode];
+    }
+    else
+    {
+        ++stats.divergent_steps;
+    }
+
+    for (std::size_t lane = first; lane < lanes; ++lane)
+    {
+        if (regs.active[lane] == 0)
+            continue;
+
+        StoreLane(lane);
+        machines[lane]->GetCpu().Step();
+        LoadLane(lane);
+
+        ++stats.scalar_lane_instructions;
+        finished += FinishLane(lane);
+    }
+    return finished;
+}
+
+void LockstepBatch::RunFrames(uint64_t frames)
+{
+    LoadLanes();
+
+    for (uint64_t frame = 0; frame < frames; ++frame)
+    {
+        for (std::size_t lane = 0; lane < machines.size(); ++lane)
+        {
+            target_frames[lane] = machines[lane]->FrameCount() + 1;
+            regs.active[lane] = 0xFF;
+        }
+
+        std::size_t remaining = machines.size();
+        while (remaining != 0)
+            remaining -= Step();
+    }
+
+    StoreLanes();
+}
+
+const LockstepStats& LockstepBatch::Stats() const
+{
+    return stats;
+}
+
+void LockstepBatch::ResetStats()
+{
+    std::memset(&stats, 0, sizeof(stats));
+}
+
+bool LockstepBatch::UsesAvx2() const
+{
+    return avx2;
+}
+
+std::size_t LockstepBatch::Lanes() const
+{
+    return machines.size();
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "lockstep-kernel.h"
+#include "machine.h"
+
+struct LockstepStats
+{
+    uint64_t steps; // one instruction on every active lane
+    uint64_t vector_steps; // all active lanes at the same pc on a register-only instruction or a jump
+    uint64_t divergent_steps; // active lanes at different pcs or different code there
+    uint64_t unsupported_steps; // same instruction, but one that touches memory or the stack
+    uint64_t vector_lane_instructions;
+    uint64_t scalar_lane_instructions;
+    uint64_t unsupported_opcodes[256]; // which instructions the unsupported steps were
+
+    // share of all lane instructions that ran vectorized
+    double Utilization() const;
+    // active lanes per vector step
+    double AverageVectorWidth() const;
+};
+
+// runs up to LOCKSTEP_MAX_LANES machines one instruction at a time, side by side
+// while a run is going the registers live here in structure-of-arrays form, one array per register,
+// when every active lane sits at the same pc on the same register-only instruction (or jump) it runs once over
+// all of them (AVX2 when the cpu has it), anything else runs per lane on that lane's own Cpu
+// memory, the scheduler and everything behind them always stay per machine
+// in between runs the machines are normal machines again, the registers are written back
+class LockstepBatch
+{
+public:
+    explicit LockstepBatch(const std::vector<Machine*>& machines, bool allow_avx2 = true);
+
+    LockstepBatch(const LockstepBatch&) = delete;
+    LockstepBatch& operator=(const LockstepBatch&) = delete;
+
+    // every lane runs until its next frame boundary, a lane that gets there first waits for the rest
+    void RunFrames(uint64_t frames = 1);
+
+    const LockstepStats& Stats() const;
+    void ResetStats();
+    bool UsesAvx2() const;
+    std::size_t Lanes() const;
+
+    static bool CpuHasAvx2();
+private:
+    void LoadLanes();
+    void StoreLanes();
+    void LoadLane(std::size_t lane);
+    void StoreLane(std::size_t lane);
+    // one instruction on every active lane, returns how many lanes finished their frame
+    std::size_t Step();
+    bool FinishLane(std::size_t lane);
+    bool Taken(uint8_t condition, std::size_t lane) const;
+    uint16_t NextPc(const LockstepInstruction& instruction, uint16_t pc, uint16_t operand, std::size_t lane, uint8_t& cycles) const;
+
+    std::vector<Machine*> machines;
+    std::vector<uint64_t> target_frames;
+    bool avx2;
+    LockstepRegisters regs;
+    LockstepStats stats;
+};
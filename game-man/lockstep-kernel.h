@@ -0,0 +1,300 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// shared between lockstep-batch.cpp and lockstep-avx2.cpp, which is built with AVX2 enabled
+// everything in here is either constexpr or a template over the vector ops, so the two never end up
+// sharing one inline function compiled for the wrong instruction set
+
+#define LOCKSTEP_MAX_LANES 64 // multiple of 32, one AVX2 register holds 32 lanes of an 8 bit register
+
+// the 3 bit register encoding of the instruction set, F sits where (HL) would be
+#define LOCKSTEP_B 0
+#define LOCKSTEP_C 1
+#define LOCKSTEP_D 2
+#define LOCKSTEP_E 3
+#define LOCKSTEP_H 4
+#define LOCKSTEP_L 5
+#define LOCKSTEP_F 6
+#define LOCKSTEP_A 7
+#define LOCKSTEP_IMMEDIATE 8 // as a source, the byte after the opcode
+
+// JR/JP conditions, in opcode order
+#define LOCKSTEP_COND_NZ 0
+#define LOCKSTEP_COND_Z 1
+#define LOCKSTEP_COND_NC 2
+#define LOCKSTEP_COND_C 3
+
+// register file of every lane, one array per register
+// flags are 0x00/0xFF masks so they can be used for blending directly
+struct alignas(32) LockstepRegisters
+{
+    uint8_t r[8][LOCKSTEP_MAX_LANES];
+    uint8_t z[LOCKSTEP_MAX_LANES];
+    uint8_t n[LOCKSTEP_MAX_LANES];
+    uint8_t h[LOCKSTEP_MAX_LANES];
+    uint8_t c[LOCKSTEP_MAX_LANES];
+    uint8_t active[LOCKSTEP_MAX_LANES]; // 0xFF = this lane takes part, padding lanes are always 0
+    uint16_t sp[LOCKSTEP_MAX_LANES];
+    uint16_t pc[LOCKSTEP_MAX_LANES];
+};
+
+// register-to-register instructions and jumps, anything touching memory or the stack runs per lane on the Cpu
+// jumps don't do anything in the kernel, the new pc is worked out per lane when the instruction retires
+enum class LockstepOp : uint8_t
+{
+    Scalar,
+    Nop,
+    Ld,
+    Inc,
+    Dec,
+    Inc16,
+    Dec16,
+    Add,
+    Sub,
+    Sbc,
+    And,
+    Xor,
+    Or,
+    Cp,
+    Cpl,
+    Rlca,
+    Rrca,
+    Jr,
+    JrCond,
+    Jp,
+    JpCond
+};
+
+struct LockstepInstruction
+{
+    LockstepOp op;
+    uint8_t dst;
+    uint8_t src; // register, LOCKSTEP_IMMEDIATE, or the condition for JrCond/JpCond
+    uint8_t length;
+    uint8_t cycles; // not taken, for conditional jumps
+};
+
+// mirrors what Cpu::ExecuteInstruction dispatches, opcodes it doesn't implement stay Scalar so they throw the same way
+constexpr LockstepInstruction DecodeLockstep(uint8_t opcode)
+{
+    const uint8_t x = opcode >> 6;
+    const uint8_t y = (opcode >> 3) & 0b111;
+    const uint8_t z = opcode & 0b111;
+
+    switch (opcode)
+    {
+    case 0x00: return { LockstepOp::Nop, 0, 0, 1, 4 };
+    case 0x07: return { LockstepOp::Rlca, LOCKSTEP_A, 0, 1, 4 };
+    case 0x0F: return { LockstepOp::Rrca, LOCKSTEP_A, 0, 1, 4 };
+    case 0x2F: return { LockstepOp::Cpl, LOCKSTEP_A, 0, 1, 4 };
+    case 0x03: return { LockstepOp::Inc16, LOCKSTEP_B, 0, 1, 8 };
+    case 0x13: return { LockstepOp::Inc16, LOCKSTEP_D, 0, 1, 8 };
+    case 0x23: return { LockstepOp::Inc16, LOCKSTEP_H, 0, 1, 8 };
+    case 0x0B: return { LockstepOp::Dec16, LOCKSTEP_B, 0, 1, 8 };
+    case 0x1B: return { LockstepOp::Dec16, LOCKSTEP_D, 0, 1, 8 };
+    case 0x2B: return { LockstepOp::Dec16, LOCKSTEP_H, 0, 1, 8 };
+    case 0xC6: return { LockstepOp::Add, LOCKSTEP_A, LOCKSTEP_IMMEDIATE, 2, 8 };
+    case 0xE6: return { LockstepOp::And, LOCKSTEP_A, LOCKSTEP_IMMEDIATE, 2, 8 };
+    case 0xF6: return { LockstepOp::Or, LOCKSTEP_A, LOCKSTEP_IMMEDIATE, 2, 8 };
+    case 0xFE: return { LockstepOp::Cp, LOCKSTEP_A, LOCKSTEP_IMMEDIATE, 2, 8 };
+    case 0x18: return { LockstepOp::Jr, 0, 0, 2, 12 };
+    case 0x20: return { LockstepOp::JrCond, 0, LOCKSTEP_COND_NZ, 2, 8 };
+    case 0x28: return { LockstepOp::JrCond, 0, LOCKSTEP_COND_Z, 2, 8 };
+    case 0x30: return { LockstepOp::JrCond, 0, LOCKSTEP_COND_NC, 2, 8 };
+    case 0x38: return { LockstepOp::JrCond, 0, LOCKSTEP_COND_C, 2, 8 };
+    case 0xC3: return { LockstepOp::Jp, 0, 0, 3, 12 };
+    case 0xC2: return { LockstepOp::JpCond, 0, LOCKSTEP_COND_NZ, 3, 12 };
+    case 0xCA: return { LockstepOp::JpCond, 0, LOCKSTEP_COND_Z, 3, 12 };
+    case 0xD2: return { LockstepOp::JpCond, 0, LOCKSTEP_COND_NC, 3, 12 };
+    case 0xDA: return { LockstepOp::JpCond, 0, LOCKSTEP_COND_C, 3, 12 };
+    case 0xAE: return { LockstepOp::Scalar, 0, 0, 0, 0 }; // XOR (HL) isn't implemented
+    default: break;
+    }
+
+    if (x == 0 && y != 6 && z == 4)
+        return { LockstepOp::Inc, y, 0, 1, 4 };
+    if (x == 0 && y != 6 && z == 5)
+        return { LockstepOp::Dec, y, 0, 1, 4 };
+    if (x == 0 && y != 6 && z == 6)
+        return { LockstepOp::Ld, y, LOCKSTEP_IMMEDIATE, 2, 8 };
+    if (x == 1 && y != 6 && z != 6)
+        return { LockstepOp::Ld, y, z, 1, 4 };
+
+    if (x == 2 && z != 6)
+    {
+        switch (y)
+        {
+        case 0: return { LockstepOp::Add, LOCKSTEP_A, z, 1, 4 };
+        case 2: return { LockstepOp::Sub, LOCKSTEP_A, z, 1, 4 };
+        case 3: return { LockstepOp::Sbc, LOCKSTEP_A, z, 1, 4 };
+        case 4: return { LockstepOp::And, LOCKSTEP_A, z, 1, 4 };
+        case 5: return { LockstepOp::Xor, LOCKSTEP_A, z, 1, 4 };
+        case 6: return { LockstepOp::Or, LOCKSTEP_A, z, 1, 4 };
+        case 7: return { LockstepOp::Cp, LOCKSTEP_A, z, 1, 4 };
+        default: break; // ADC isn't implemented
+        }
+    }
+
+    return { LockstepOp::Scalar, 0, 0, 0, 0 };
+}
+
+// one instruction over every lane, Ops is the vector backend (Ops::WIDTH lanes per Vector)
+// the flag rules, quirks included, are the ones in cpu.cpp, see the matching Execute_* there
+template <typename Ops>
+void ExecuteLockstep(LockstepRegisters& regs, std::size_t lanes, const LockstepInstruction& instruction, uint8_t immediate)
+{
+    using V = typename Ops::Vector;
+
+    const V zero = Ops::Splat(0x00);
+    const V ones = Ops::Splat(0xFF);
+    const V nibble = Ops::Splat(0x0F);
+
+    for (std::size_t i = 0; i < lanes; i += Ops::WIDTH)
+    {
+        const V active = Ops::Load(regs.active + i);
+
+        // writes only land in the active lanes
+        auto write = [&](uint8_t* dst, V val)
+        {
+            Ops::Store(dst + i, Ops::Blend(Ops::Load(dst + i), val, active));
+        };
+        // UpdateFlagRegister, ZNHC0000
+        auto write_flags = [&](V z, V n, V h, V c, bool update_f)
+        {
+            write(regs.z, z);
+            write(regs.n, n);
+            write(regs.h, h);
+            write(regs.c, c);
+            if (update_f)
+            {
+                const V f = Ops::Or(Ops::Or(Ops::And(z, Ops::Splat(0x80)), Ops::And(n, Ops::Splat(0x40))),
+                    Ops::Or(Ops::And(h, Ops::Splat(0x20)), Ops::And(c, Ops::Splat(0x10))));
+                write(regs.r[LOCKSTEP_F], f);
+            }
+        };
+
+        const V a = Ops::Load(regs.r[LOCKSTEP_A] + i);
+        const V src = instruction.src == LOCKSTEP_IMMEDIATE ? Ops::Splat(immediate) : Ops::Load(regs.r[instruction.src] + i);
+        const V z_old = Ops::Load(regs.z + i);
+        const V c_old = Ops::Load(regs.c + i);
+
+        switch (instruction.op)
+        {
+        case LockstepOp::Nop:
+        case LockstepOp::Jr:
+        case LockstepOp::JrCond:
+        case LockstepOp::Jp:
+        case LockstepOp::JpCond:
+            break;
+        case LockstepOp::Ld:
+            write(regs.r[instruction.dst], src);
+            break;
+        case LockstepOp::Inc:
+        {
+            const V val = Ops::Load(regs.r[instruction.dst] + i);
+            const V result = Ops::Add(val, Ops::Splat(1));
+            write(regs.r[instruction.dst], result);
+            write_flags(Ops::Eq(result, zero), zero, Ops::Eq(Ops::And(val, nibble), nibble), c_old, true);
+            break;
+        }
+        case LockstepOp::Dec:
+        {
+            const V val = Ops::Load(regs.r[instruction.dst] + i);
+            const V result = Ops::Sub(val, Ops::Splat(1));
+            write(regs.r[instruction.dst], result);
+            write_flags(Ops::Eq(result, zero), ones, Ops::Eq(Ops::And(val, nibble), zero), c_old, true);
+            break;
+        }
+        case LockstepOp::Inc16:
+        {
+            // low byte wraps to 0 -> carry into the high one, subtracting the 0xFF mask adds 1
+            const V low = Ops::Add(Ops::Load(regs.r[instruction.dst + 1] + i), Ops::Splat(1));
+            const V high = Ops::Sub(Ops::Load(regs.r[instruction.dst] + i), Ops::Eq(low, zero));
+            write(regs.r[instruction.dst + 1], low);
+            write(regs.r[instruction.dst], high);
+            break;
+        }
+        case LockstepOp::Dec16:
+        {
+            const V low = Ops::Load(regs.r[instruction.dst + 1] + i);
+            const V high = Ops::Add(Ops::Load(regs.r[instruction.dst] + i), Ops::Eq(low, zero));
+            write(regs.r[instruction.dst + 1], Ops::Sub(low, Ops::Splat(1)));
+            write(regs.r[instruction.dst], high);
+            break;
+        }
+        case LockstepOp::Add:
+        {
+            const V result = Ops::Add(a, src);
+            // saturating and wrapping sums only differ when it carried
+            const V carry = Ops::Xor(Ops::Eq(Ops::AddSaturate(a, src), result), ones);
+            const V half = Ops::GreaterEqual(Ops::Add(Ops::And(a, nibble), Ops::And(src, nibble)), Ops::Splat(0x10));
+            write(regs.r[LOCKSTEP_A], result);
+            write_flags(Ops::Eq(result, zero), zero, half, carry, true);
+            break;
+        }
+        case LockstepOp::Sub:
+        case LockstepOp::Sbc:
+        {
+            // SBC folds the carry into the subtrahend first, c is a 0xFF mask so subtracting it adds 1
+            const V subtrahend = instruction.op == LockstepOp::Sbc ? Ops::Sub(src, c_old) : src;
+            const V result = Ops::Sub(a, subtrahend);
+            // SUB/SBC set h and c when there was *no* borrow, that's what Execute_Sub_8 does
+            const V half = Ops::GreaterEqual(Ops::And(a, nibble), Ops::And(subtrahend, nibble));
+            const V carry = Ops::GreaterEqual(a, subtrahend);
+            write(regs.r[LOCKSTEP_A], result);
+            write_flags(Ops::Eq(result, zero), ones, half, carry, true);
+            break;
+        }
+        case LockstepOp::Cp:
+        {
+            // while CP sets them on a borrow
+            const V half = Ops::Xor(Ops::GreaterEqual(Ops::And(a, nibble), Ops::And(src, nibble)), ones);
+            const V carry = Ops::Xor(Ops::GreaterEqual(a, src), ones);
+            write_flags(Ops::Eq(a, src), ones, half, carry, true);
+            break;
+        }
+        case LockstepOp::And:
+        {
+            const V result = Ops::And(a, src);
+            write(regs.r[LOCKSTEP_A], result);
+            write_flags(Ops::Eq(result, zero), zero, ones, zero, true);
+            break;
+        }
+        case LockstepOp::Xor:
+        case LockstepOp::Or:
+        {
+            const V result = instruction.op == LockstepOp::Xor ? Ops::Xor(a, src) : Ops::Or(a, src);
+            write(regs.r[LOCKSTEP_A], result);
+            write_flags(Ops::Eq(result, zero), zero, zero, zero, true);
+            break;
+        }
+        case LockstepOp::Cpl:
+            // Execute_Cpl doesn't rebuild F
+            write(regs.r[LOCKSTEP_A], Ops::Xor(a, ones));
+            write_flags(z_old, ones, ones, c_old, false);
+            break;
+        case LockstepOp::Rlca:
+        {
+            const V bit_seven = Ops::Eq(Ops::And(a, Ops::Splat(0x80)), Ops::Splat(0x80));
+            const V result = Ops::Or(Ops::Add(a, a), Ops::And(bit_seven, Ops::Splat(0x01)));
+            write(regs.r[LOCKSTEP_A], result);
+            write_flags(Ops::Eq(result, zero), zero, zero, bit_seven, true);
+            break;
+        }
+        case LockstepOp::Rrca:
+        {
+            const V bit_zero = Ops::Eq(Ops::And(a, Ops::Splat(0x01)), Ops::Splat(0x01));
+            const V result = Ops::Or(Ops::ShiftRight1(a), Ops::And(bit_zero, Ops::Splat(0x80)));
+            write(regs.r[LOCKSTEP_A], result);
+            write_flags(Ops::Eq(result, zero), zero, zero, bit_zero, true);
+            break;
+        }
+        case LockstepOp::Scalar:
+            break;
+        }
+    }
+}
+
+// lockstep-avx2.cpp, only call it after checking the cpu has AVX2
+void ExecuteLockstepAvx2(LockstepRegisters& regs, std::size_t lanes, const LockstepInstruction& instruction, uint8_t immediate);
@@ -0,0 +1,65 @@
+#include "machine-arena.h"
+
+#include <new>
+#include <stdexcept>
+
+void MachineArena::AlignedFree::operator()(std::byte* block) const
+{
+    ::operator delete(block, std::align_val_t(MACHINE_ARENA_ALIGNMENT));
+}
+
+MachineArena::MachineArena(std::shared_ptr<const std::vector<uint8_t>> rom, std::size_t count, const MachineConfig& config):
+    block(static_cast<std::byte*>(::operator new(SLOT_SIZE * count, std::align_val_t(MACHINE_ARENA_ALIGNMENT)))), count(0)
+{
+    try
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            new (block.get() + i * SLOT_SIZE) Machine(rom, config);
+            ++this->count;
+        }
+    }
+    catch (...)
+    {
+        // no destructor runs for a half built arena, the machines that made it have to go here
+        DestroyMachines();
+        throw;
+    }
+}
+
+MachineArena::~MachineArena()
+{
+    DestroyMachines();
+}
+
+void MachineArena::DestroyMachines()
+{
+    for (; count > 0; --count)
+        (*this)[count - 1].~Machine();
+}
+
+Machine& MachineArena::operator[](std::size_t index)
+{
+    return *std::launder(reinterpret_cast<Machine*>(block.get() + index * SLOT_SIZE));
+}
+
+std::size_t MachineArena::IndexOf(const Machine& machine) const
+{
+    const std::byte* address = reinterpret_cast<const std::byte*>(&machine);
+    if (address < block.get() || address >= block.get() + count * SLOT_SIZE)
+        throw std::runtime_error("MachineArena: machine isn't from this arena");
+    return static_cast<std::size_t>(address - block.get()) / SLOT_SIZE;
+}
+
+std::size_t MachineArena::Size() const
+{
+    return count;
+}
+
+std::vector<Machine*> MachineArena::Machines()
+{
+    std::vector<Machine*> machines;
+    for (std::size_t i = 0; i < count; ++i)
+        machines.push_back(&(*this)[i]);
+    return machines;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "machine.h"
+
+#define MACHINE_ARENA_ALIGNMENT 64 // cache line, no two machines ever share one
+
+// a batch of machines for the same game in one allocation, back to back, each one starting on its own cache line
+// with the compact build that's the whole footprint of the batch apart from cartridge RAM
+// machines are built in place and never move, like any Machine
+class MachineArena
+{
+public:
+    MachineArena(std::shared_ptr<const std::vector<uint8_t>> rom, std::size_t count, const MachineConfig& config = MachineConfig());
+    ~MachineArena();
+
+    MachineArena(const MachineArena&) = delete;
+    MachineArena& operator=(const MachineArena&) = delete;
+
+    Machine& operator[](std::size_t index);
+    std::size_t Size() const;
+    // where in the arena a machine from this arena sits
+    std::size_t IndexOf(const Machine& machine) const;
+    // pointers to every machine, what BatchRunner and LockstepBatch take
+    std::vector<Machine*> Machines();
+
+    static constexpr std::size_t SLOT_SIZE = (sizeof(Machine) + MACHINE_ARENA_ALIGNMENT - 1) / MACHINE_ARENA_ALIGNMENT * MACHINE_ARENA_ALIGNMENT;
+private:
+    struct AlignedFree
+    {
+        void operator()(std::byte* block) const;
+    };
+
+    void DestroyMachines();
+
+    std::unique_ptr<std::byte, AlignedFree> block;
+    std::size_t count;
+};
@@ -0,0 +1,110 @@
+#include "machine.h"
+
+#include <stdexcept>
+
+Machine::Machine(std::vector<uint8_t>& rom, const MachineConfig& config): Machine(std::make_shared<const std::vector<uint8_t>>(rom), config)
+{
+}
+
+Machine::Machine(std::shared_ptr<const std::vector<uint8_t>> rom, const MachineConfig& config): memory(gamepad), compositor(config.threaded_compositor),
+    cartridge(memory, scheduler, std::move(rom)), ppu(memory, scheduler, compositor), oam_dma(memory, scheduler),
+    timer(memory, scheduler), apu(memory, scheduler), cpu(memory, scheduler), publisher(nullptr)
+{
+#ifdef GAMEMAN_COMPACT
+    if (config.threaded_compositor)
+        throw std::runtime_error("The compact build only has the inline compositor");
+#endif
+    cpu.SetThrottled(config.throttled);
+    cpu.Reset();
+}
+
+uint64_t Machine::RunCycles(uint64_t cycles)
+{
+    const uint64_t end = scheduler.Now() + cycles;
+    return RunUntil([end](Machine& machine) { return machine.scheduler.Now() >= end; });
+}
+
+uint64_t Machine::RunFrame()
+{
+    const uint64_t frame = ppu.FrameCount() + 1;
+    const uint64_t cycles = RunUntil([frame](Machine& machine) { return machine.ppu.FrameCount() >= frame; });
+    // games that never disable RAM again would otherwise only get saved on shutdown
+    if (frame % BATTERY_POLL_FRAMES == 0)
+        cartridge.FlushBattery();
+    if (publisher != nullptr)
+        publisher->Publish(cpu, memory, ppu.FrameCount(), scheduler.Now());
+    return cycles;
+}
+
+void Machine::SetInput(uint8_t buttons)
+{
+    gamepad.SetButtons(buttons);
+    memory.LatchJoypad(ppu.FrameCount());
+}
+
+uint64_t Machine::Cycles() const
+{
+    return scheduler.Now();
+}
+
+uint64_t Machine::FrameCount() const
+{
+    return ppu.FrameCount();
+}
+
+void Machine::SaveState(std::vector<uint8_t>& buffer) const
+{
+    StateWriter writer(buffer);
+    cpu.SaveState(writer);
+}
+
+void Machine::LoadState(const std::vector<uint8_t>& buffer)
+{
+    StateReader reader(buffer);
+    cpu.LoadState(reader);
+}
+
+Scheduler& Machine::GetScheduler()
+{
+    return scheduler;
+}
+
+GamepadController& Machine::GetGamepad()
+{
+    return gamepad;
+}
+
+Memory& Machine::GetMemory()
+{
+    return memory;
+}
+
+Compositor& Machine::GetCompositor()
+{
+    return compositor;
+}
+
+Cartridge& Machine::GetCartridge()
+{
+    return cartridge;
+}
+
+Ppu& Machine::GetPpu()
+{
+    return ppu;
+}
+
+Apu& Machine::GetApu()
+{
+    return apu;
+}
+
+Cpu& Machine::GetCpu()
+{
+    return cpu;
+}
+
+void Machine::SetStatePublisher(StatePublisher* publisher)
+{
+    this->publisher = publisher;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "apu.h"
+#include "battery-saver.h"
+#include "cartridge.h"
+#include "compositor.h"
+#include "cpu.h"
+#include "gamepad-controller.h"
+#include "memory.h"
+#include "oam-dma.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "state-publisher.h"
+#include "timer.h"
+
+struct MachineConfig
+{
+    bool threaded_compositor = false; // inline keeps everything on the caller's thread, the compact build only has inline
+    bool throttled = false; // sleep to real Game Boy speed
+};
+
+// one whole Game Boy, built and wired up in the right order
+// nothing runs on its own, every Run* call returns once it's done, so a harness can drive as many
+// frames as it likes in-process, no threads or sleeps unless the config asks for them
+// components hold references to each other, so a Machine never moves
+class Machine
+{
+public:
+    explicit Machine(std::vector<uint8_t>& rom, const MachineConfig& config = MachineConfig());
+    // machines running the same game can share the one ROM image
+    explicit Machine(std::shared_ptr<const std::vector<uint8_t>> rom, const MachineConfig& config = MachineConfig());
+
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    // all of these stop on an instruction boundary, so they can run a few cycles over
+    // and return how many cycles they actually ran
+    uint64_t RunCycles(uint64_t cycles);
+    uint64_t RunFrame();
+
+    // steps until done(machine) returns true, checked after every instruction
+    template <typename Predicate>
+    uint64_t RunUntil(Predicate&& done)
+    {
+        const uint64_t start = scheduler.Now();
+        while (!done(*this))
+            cpu.Step();
+        return scheduler.Now() - start;
+    }
+
+    uint64_t Cycles() const;
+    uint64_t FrameCount() const;
+
+    // the gamepad only latches at frame boundaries, so buttons set with GetGamepad().SetButtons before a RunFrame
+    // are latched at the end of that frame and only seen by the one after it
+    // this sets and latches them right away, right after a RunFrame that's the same point in time the regular
+    // latch was, so the next frame sees exactly these, for agents and rollouts that step frame by frame
+    void SetInput(uint8_t buttons);
+
+    void SaveState(std::vector<uint8_t>& buffer) const;
+    void LoadState(const std::vector<uint8_t>& buffer);
+
+    Scheduler& GetScheduler();
+    GamepadController& GetGamepad();
+    Memory& GetMemory();
+    Compositor& GetCompositor();
+    Cartridge& GetCartridge();
+    Ppu& GetPpu();
+    Apu& GetApu();
+    Cpu& GetCpu();
+
+    // RunFrame publishes the registers and watched bytes here once the frame is done, for readers on other threads
+    // nullptr to detach, not owned, LockstepBatch runs don't go through RunFrame and don't publish
+    void SetStatePublisher(StatePublisher* publisher);
+private:
+    // declaration order is construction order, everything after Memory connects itself to it
+    Scheduler scheduler;
+    GamepadController gamepad;
+    Memory memory;
+    Compositor compositor;
+    Cartridge cartridge;
+    Ppu ppu;
+    OamDma oam_dma;
+    Timer timer;
+    Apu apu;
+    Cpu cpu;
+
+    StatePublisher* publisher;
+};
+
+#ifdef GAMEMAN_COMPACT
+// everything an instance owns is inline (ROM is shared, cartridge RAM banks are the one allocation, and only
+// for games that have RAM), this is what decides how many of them fit in a cache
+#define MACHINE_COMPACT_SIZE_LIMIT (164 * 1024)
+static_assert(sizeof(Machine) <= MACHINE_COMPACT_SIZE_LIMIT, "a compact Machine grew past MACHINE_COMPACT_SIZE_LIMIT");
+#endif
@@ -1,77 +1,356 @@
 #include "memory.h"
 
+#include "apu.h"
+#include "cartridge.h"
+#include "oam-dma.h"
+#include "ppu.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
-Memory::Memory(GamepadController& gc) : m_memoryBuffer(GB_MEMORY_BUFFER_SIZE + 1), m_memoryMap(reinterpret_cast<MemoryMap*>(m_memoryBuffer.data())), m_gamepadController(gc)
+Memory::Memory(GamepadController& gc) : m_memoryBuffer{}, m_gamepadController(gc),
+    m_Ppu(nullptr), m_OamDma(nullptr), m_Timer(nullptr), m_Apu(nullptr), m_Cartridge(nullptr), bus_locked(false), dirty_pages{}, cart_ram_written(false), vram_dirty{0xFFFF, 0}, oam_dirty{0xFFFF, 0}
+{
+
+}
+
+void Memory::ConnectPpu(Ppu& ppu)
+{
+    m_Ppu = &ppu;
+}
+
+void Memory::ConnectOamDma(OamDma& dma)
 {
+    m_OamDma = &dma;
+}
 
+void Memory::ConnectTimer(Timer& timer)
+{
+    m_Timer = &timer;
+}
+
+void Memory::ConnectApu(Apu& apu)
+{
+    m_Apu = &apu;
+}
+
+void Memory::ConnectCartridge(Cartridge& cartridge)
+{
+    m_Cartridge = &cartridge;
+}
+
+Cartridge* Memory::ConnectedCartridge() const
+{
+    return m_Cartridge;
 }
 
 void Memory::SetMemory8(uint16_t offset, uint8_t val)
 {
+    if (IsBusLocked(offset))
+        return;
+
+    if (IsCartridgeAccess(offset))
+    {
+        m_Cartridge->Write(offset, val);
+        return;
+    }
+
     switch(offset)
     {
     case 0xFF00: // Gamepad Controller
-        m_gamepadController.SetOutputState(val);
+        if (m_gamepadController.SetOutputState(val))
+            RequestInterrupt(InterruptFlags::TransitionPin);
         this->m_memoryBuffer.at(offset) = m_gamepadController.GetOutput();
         break;
+    case 0xFF04: // DIV
+    case 0xFF05: // TIMA
+    case 0xFF06: // TMA
+    case 0xFF07: // TAC
+        this->m_memoryBuffer.at(offset) = val;
+        if (m_Timer != nullptr)
+            m_Timer->WriteRegister(offset, val);
+        break;
+    case 0xFF40: // LCDC
+        this->m_memoryBuffer.at(offset) = val;
+        if (m_Ppu != nullptr)
+            m_Ppu->WriteLcdc(val);
+        break;
+    case 0xFF41: // STAT, mode and coincidence bits belong to the PPU
+        this->m_memoryBuffer.at(offset) = val;
+        if (m_Ppu != nullptr)
+            m_Ppu->WriteStat(val);
+        break;
+    case 0xFF44: // LY, read only
+        break;
+    case 0xFF46: // OAM DMA
+        this->m_memoryBuffer.at(offset) = val;
+        if (m_OamDma != nullptr)
+            m_OamDma->Start(val);
+        break;
+    case 0xFF45: // LYC
+        this->m_memoryBuffer.at(offset) = val;
+        if (m_Ppu != nullptr)
+            m_Ppu->WriteLyc(val);
+        break;
     default:
         this->m_memoryBuffer.at(offset) = val;
+        MarkDirty(offset);
+        if (IsApuRegister(offset) && m_Apu != nullptr)
+            m_Apu->WriteRegister(offset, val);
         break;
     }
 }
 
 void Memory::SetMemory16(uint16_t offset, uint16_t val)
 {
-    if (offset + 2 > this->m_memoryBuffer.size())
+    if (static_cast<std::size_t>(offset) + 2 > this->m_memoryBuffer.size())
         throw std::runtime_error("Memory::SetMemory16 - offset + 2 bytes > memoryBuffer");
+    if (IsBusLocked(offset))
+        return;
+
+    if (IsCartridgeAccess(offset) || IsCartridgeAccess(offset + 1))
+    {
+        SetMemory8(offset, val & 0x00FF);
+        SetMemory8(offset + 1, val >> 8);
+        return;
+    }
 
     this->m_memoryBuffer.at(offset) = (val & 0x00FF); // considering we're on LE, low byte first
     this->m_memoryBuffer.at(offset + 1) = (val >> 8); // high second
+    MarkDirty(offset);
+    MarkDirty(offset + 1);
     // TODO: Big Endian?
 }
 
-void Memory::SetRomMemory(std::vector<uint8_t>& rom_contents) const
+void Memory::SetRomMemory(std::vector<uint8_t>& rom_contents)
 {
     if (rom_contents.size() != (sizeof(MemoryMap::rom) + sizeof(MemoryMap::switchable_rom_bank)))
         throw std::runtime_error("Only vectors of size 0x8000 are allowed");
 
-    for (int i = 0; i < rom_contents.size() / 2; ++i)
+    for (std::size_t i = 0; i < rom_contents.size() / 2; ++i)
     {
-        this->m_memoryMap->rom[i] = rom_contents.at(i);
+        Map()->rom[i] = rom_contents.at(i);
     }
 
-    for (int i = 0; i < rom_contents.size() / 2; ++i)
+    for (std::size_t i = 0; i < rom_contents.size() / 2; ++i)
     {
-        this->m_memoryMap->switchable_rom_bank[i] = rom_contents.at(rom_contents.size() / 2 + i);
+        Map()->switchable_rom_bank[i] = rom_contents.at(rom_contents.size() / 2 + i);
     }
     
 }
 
+void Memory::MapBank(uint16_t address, const uint8_t* data, std::size_t size)
+{
+    if (address + size > GB_MEMORY_BUFFER_SIZE)
+        throw std::runtime_error("Memory::MapBank - bank doesn't fit at that address");
+
+    // what's mapped at 0x4000 follows the cartridge's bank register, only RAM banks count as written
+    std::memcpy(&this->m_memoryBuffer[address], data, size);
+    for (std::size_t page = std::max<std::size_t>(address, 0x8000) / MEMORY_PAGE_SIZE; page < (address + size) / MEMORY_PAGE_SIZE; ++page)
+        dirty_pages.bits[page >> 6] |= 1ull << (page & 63);
+}
+
 uint8_t Memory::ReadMemory8(uint16_t offset)
 {
     uint8_t tmpVal;
 
+    if (IsBusLocked(offset))
+        return 0xFF;
+
+    if (offset >= 0xA000 && offset < 0xC000 && m_Cartridge != nullptr)
+        return m_Cartridge->ReadRam(offset);
+
     switch(offset)
     {
     case 0xFF00: // Gamepad Controller
         tmpVal = m_gamepadController.GetOutput();
         this->m_memoryBuffer.at(offset) = tmpVal;
         return tmpVal;
+    case 0xFF04: // DIV
+    case 0xFF05: // TIMA
+    case 0xFF06: // TMA
+    case 0xFF07: // TAC
+        return m_Timer != nullptr ? m_Timer->ReadRegister(offset) : this->m_memoryBuffer.at(offset);
+    case 0xFF41: // STAT
+        return m_Ppu != nullptr ? m_Ppu->ReadStat() : this->m_memoryBuffer.at(offset);
+    case 0xFF44: // LY
+        return m_Ppu != nullptr ? m_Ppu->ReadLy() : this->m_memoryBuffer.at(offset);
     default:
+        if (IsApuRegister(offset) && m_Apu != nullptr)
+            return m_Apu->ReadRegister(offset);
         return this->m_memoryBuffer.at(offset);
     }
 }
 
 uint16_t Memory::ReadMemory16(uint16_t offset)
 {
+    if (IsBusLocked(offset))
+        return 0xFFFF;
+
+    if (offset >= 0x9FFF && offset < 0xC000 && m_Cartridge != nullptr)
+        return ReadMemory8(offset) | (ReadMemory8(offset + 1) << 8);
+
     return *reinterpret_cast<uint16_t*>(&m_memoryBuffer[offset]); // if we consider we're on Little Endian, TODO: BE?
 }
 
-uint8_t* Memory::GetPtrAt(uint16_t offset)
+void Memory::PokeAt(uint16_t offset, uint8_t val)
+{
+    this->m_memoryBuffer.at(offset) = val;
+    MarkDirty(offset);
+}
+
+const uint8_t* Memory::PeekPtrAt(uint16_t offset) const
 {
     if (offset > this->m_memoryBuffer.size())
-        throw std::runtime_error("Memory::GetPtrAt - Invalid location, out of bounds " + offset);
+        throw std::runtime_error("Memory::PeekPtrAt - Invalid location, out of bounds " + offset);
 
     return &this->m_memoryBuffer.at(offset);
 }
+
+void Memory::RequestInterrupt(InterruptFlags flag)
+{
+    this->m_memoryBuffer[0xFF0F] |= static_cast<uint8_t>(flag);
+}
+
+void Memory::ClearInterrupt(InterruptFlags flag)
+{
+    this->m_memoryBuffer[0xFF0F] &= static_cast<uint8_t>(~static_cast<uint8_t>(flag));
+}
+
+void Memory::LatchJoypad(uint64_t frame)
+{
+    if (m_gamepadController.Latch(frame))
+        RequestInterrupt(InterruptFlags::TransitionPin);
+}
+
+void Memory::CopyToOam(uint16_t source)
+{
+    std::memcpy(Map()->sprite_attributes, &this->m_memoryBuffer[source], sizeof(MemoryMap::sprite_attributes));
+    oam_dirty = { 0, sizeof(MemoryMap::sprite_attributes) };
+    dirty_pages.bits[0xFE >> 6] |= 1ull << (0xFE & 63);
+}
+
+void Memory::SetBusLocked(bool locked)
+{
+    bus_locked = locked;
+}
+
+DirtyRange Memory::TakeVramDirty()
+{
+    const DirtyRange range = vram_dirty;
+    vram_dirty = { 0xFFFF, 0 };
+    return range;
+}
+
+DirtyRange Memory::TakeOamDirty()
+{
+    const DirtyRange range = oam_dirty;
+    oam_dirty = { 0xFFFF, 0 };
+    return range;
+}
+
+DirtyPages Memory::TakeDirtyPages()
+{
+    const DirtyPages pages = dirty_pages;
+    dirty_pages = {};
+    return pages;
+}
+
+bool Memory::TakeCartRamWritten()
+{
+    const bool written = cart_ram_written;
+    cart_ram_written = false;
+    return written;
+}
+
+void Memory::MarkCartRamWritten()
+{
+    cart_ram_written = true;
+}
+
+void Memory::MarkDirty(uint16_t offset)
+{
+    const uint16_t page = offset >> 8;
+    dirty_pages.bits[page >> 6] |= 1ull << (page & 63);
+
+    if (offset >= 0xA000 && offset < 0xC000)
+        cart_ram_written = true;
+
+    if (offset >= 0x8000 && offset < 0xA000)
+        Widen(vram_dirty, offset - 0x8000);
+    else if (offset >= 0xFE00 && offset < 0xFEA0)
+        Widen(oam_dirty, offset - 0xFE00);
+}
+
+void Memory::WritePage(uint8_t page, const uint8_t* data)
+{
+    const uint16_t address = page * MEMORY_PAGE_SIZE;
+    std::memcpy(&this->m_memoryBuffer[address], data, MEMORY_PAGE_SIZE);
+    dirty_pages.bits[page >> 6] |= 1ull << (page & 63);
+
+    if (address >= 0xA000 && address < 0xC000)
+        cart_ram_written = true;
+
+    if (address >= 0x8000 && address < 0xA000)
+    {
+        Widen(vram_dirty, address - 0x8000);
+        Widen(vram_dirty, address - 0x8000 + MEMORY_PAGE_SIZE - 1);
+    }
+    else if (address == 0xFE00)
+    {
+        Widen(oam_dirty, 0);
+        Widen(oam_dirty, OAM_SIZE - 1);
+    }
+}
+
+void Memory::Widen(DirtyRange& range, uint16_t offset)
+{
+    if (offset < range.begin)
+        range.begin = offset;
+    if (offset + 1 > range.end)
+        range.end = offset + 1;
+}
+
+void Memory::SaveState(StateWriter& writer, bool with_memory) const
+{
+    if (with_memory)
+        writer.WriteChunk("MEM ", m_memoryBuffer.data(), m_memoryBuffer.size());
+    writer.Write("BUSL", bus_locked);
+
+    m_gamepadController.SaveState(writer);
+    if (m_Ppu != nullptr)
+        m_Ppu->SaveState(writer);
+    if (m_Timer != nullptr)
+        m_Timer->SaveState(writer);
+    if (m_Apu != nullptr)
+        m_Apu->SaveState(writer);
+    if (m_Cartridge != nullptr)
+        m_Cartridge->SaveState(writer, with_memory);
+}
+
+void Memory::LoadState(StateReader& reader, bool with_memory)
+{
+    if (with_memory)
+        reader.ReadChunk("MEM ", m_memoryBuffer.data(), m_memoryBuffer.size());
+    reader.Read("BUSL", bus_locked);
+
+    // the compositor's copies are from another timeline now, without memory whoever brings the pages
+    // back does it through WritePage, which only resyncs what it wrote
+    if (with_memory)
+    {
+        vram_dirty = { 0, VRAM_SIZE };
+        oam_dirty = { 0, OAM_SIZE };
+    }
+
+    m_gamepadController.LoadState(reader);
+    if (m_Ppu != nullptr)
+        m_Ppu->LoadState(reader);
+    if (m_Timer != nullptr)
+        m_Timer->LoadState(reader);
+    if (m_Apu != nullptr)
+        m_Apu->LoadState(reader);
+    if (m_Cartridge != nullptr)
+        m_Cartridge->LoadState(reader, with_memory);
+}
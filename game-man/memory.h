@@ -1,11 +1,34 @@
 #pragma once
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <vector>
 
 #include "gamepad-controller.h"
+#include "scanline-renderer.h"
 #define GB_MEMORY_BUFFER_SIZE 0xFFFF
 #define SP_INIT_VAL 0xFFFE
+#define MEMORY_PAGE_SIZE 0x100
+#define MEMORY_PAGE_COUNT 0x100
+
+class Apu;
+class Cartridge;
+class OamDma;
+class Ppu;
+class Timer;
+
+enum class InterruptFlags{VBlank = 1, LCDC = 2, TimerOverflow = 4, SerialIOTransferComplete = 8, TransitionPin = 16};
+
+// one bit per 256 byte page of the address space
+struct DirtyPages
+{
+    uint64_t bits[MEMORY_PAGE_COUNT / 64];
+
+    bool IsDirty(uint16_t page) const
+    {
+        return (bits[page >> 6] & (1ull << (page & 63))) != 0;
+    }
+};
 
 struct MemoryMap
 {
@@ -27,14 +50,91 @@ class Memory
 {
 public:
     Memory(GamepadController& gc);
+    void ConnectPpu(Ppu& ppu);
+    void ConnectOamDma(OamDma& dma);
+    void ConnectTimer(Timer& timer);
+    void ConnectApu(Apu& apu);
+    void ConnectCartridge(Cartridge& cartridge);
+    // nullptr until one connects
+    Cartridge* ConnectedCartridge() const;
     void SetMemory8(uint16_t offset, uint8_t val);
     void SetMemory16(uint16_t offset, uint16_t val);
-    void SetRomMemory(std::vector<uint8_t>& rom_contents) const;
+    void SetRomMemory(std::vector<uint8_t>& rom_contents);
+    // cartridge bank switching, copies a whole bank in at address, doesn't count as a cpu write
+    // RAM pages get marked dirty, ROM pages don't, a state without memory brings its ROM bank back through the cartridge
+    void MapBank(uint16_t address, const uint8_t* data, std::size_t size);
     uint8_t ReadMemory8(uint16_t offset);
     uint16_t ReadMemory16(uint16_t offset);
-    uint8_t* GetPtrAt(uint16_t offset);
+    // one byte straight into the buffer, no handlers, counts as written, the cartridge stores its RAM through this
+    void PokeAt(uint16_t offset, uint8_t val);
+    // read only access for everything that isn't the cpu
+    const uint8_t* PeekPtrAt(uint16_t offset) const;
+    // a whole page back from a checkpoint or snapshot, counts as written like a cpu write would
+    void WritePage(uint8_t page, const uint8_t* data);
+    void RequestInterrupt(InterruptFlags flag);
+    void ClearInterrupt(InterruptFlags flag);
+    // takes the host's button presses in, once per frame
+    void LatchJoypad(uint64_t frame);
+
+    // bulk copy of 160 bytes into sprite_attributes
+    void CopyToOam(uint16_t source);
+    // while an OAM DMA runs the CPU can't get at ROM, VRAM, external RAM, WRAM or OAM, only IO, HRAM and IE
+    void SetBusLocked(bool locked);
+
+    // ranges of vram/oam written since the last call, the compositor only gets sent those
+    DirtyRange TakeVramDirty();
+    DirtyRange TakeOamDirty();
+    // pages written since the last call, for incremental checkpoints
+    DirtyPages TakeDirtyPages();
+    // external RAM written since the last call, for battery saves
+    bool TakeCartRamWritten();
+    void MarkCartRamWritten();
+
+    // the whole address space, then the gamepad and every connected peripheral, in that order
+    // without memory only the peripherals go in, cart RAM stays out with it, incremental checkpoints store pages
+    // and changed RAM banks on their own
+    void SaveState(StateWriter& writer, bool with_memory = true) const;
+    void LoadState(StateReader& reader, bool with_memory = true);
 private:
-    std::vector<uint8_t> m_memoryBuffer;
-    MemoryMap* m_memoryMap;
+    void MarkDirty(uint16_t offset);
+    static void Widen(DirtyRange& range, uint16_t offset);
+
+    static bool IsApuRegister(uint16_t offset)
+    {
+        return offset >= 0xFF10 && offset < 0xFF40;
+    }
+
+    // ROM space (MBC registers) and external RAM, neither is plain memory once a cartridge is in
+    bool IsCartridgeAccess(uint16_t offset) const
+    {
+        return m_Cartridge != nullptr && (offset < 0x8000 || (offset >= 0xA000 && offset < 0xC000));
+    }
+
+    // the DMA holds the external and video buses, only cpu accesses come through here,
+    // everything inside the emulator reads the buffer directly
+    bool IsBusLocked(uint16_t offset) const
+    {
+        return bus_locked && offset < 0xFF00;
+    }
+
+    // the same bytes as m_memoryBuffer, worked out on use so the object holds no pointer into itself
+    MemoryMap* Map()
+    {
+        return reinterpret_cast<MemoryMap*>(m_memoryBuffer.data());
+    }
+
+    // inline, not on the heap, a Memory (and so a Machine) is one block
+    alignas(64) std::array<uint8_t, GB_MEMORY_BUFFER_SIZE + 1> m_memoryBuffer;
     GamepadController& m_gamepadController;
+    Ppu* m_Ppu;
+    OamDma* m_OamDma;
+    Timer* m_Timer;
+    Apu* m_Apu;
+    Cartridge* m_Cartridge;
+    bool bus_locked;
+
+    DirtyPages dirty_pages;
+    bool cart_ram_written;
+    DirtyRange vram_dirty;
+    DirtyRange oam_dirty;
 };
@@ -0,0 +1,130 @@
+#include "movie.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+    void PutVarint(std::vector<uint8_t>& out, uint64_t val)
+    {
+        while (val >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(val | 0x80));
+            val >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(val));
+    }
+
+    uint64_t GetVarint(const std::vector<uint8_t>& in, std::size_t& pos)
+    {
+        uint64_t val = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (pos >= in.size())
+                throw std::runtime_error("InputMovie is truncated");
+
+            const uint8_t byte = in[pos++];
+            val |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return val;
+        }
+
+        throw std::runtime_error("InputMovie has a broken frame delta");
+    }
+}
+
+void InputMovie::Save(std::string const& path) const
+{
+    std::vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + 4);
+    PutVarint(out, MOVIE_VERSION);
+    PutVarint(out, end_frame);
+    PutVarint(out, entries.size());
+
+    uint64_t previous_frame = 0;
+    for (const auto& entry : entries)
+    {
+        PutVarint(out, entry.frame - previous_frame);
+        out.push_back(entry.buttons);
+        previous_frame = entry.frame;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(reinterpret_cast<const char*>(out.data()), out.size()))
+        throw std::runtime_error("InputMovie couldn't write " + path + ": " + std::strerror(errno));
+}
+
+InputMovie InputMovie::Load(std::string const& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("InputMovie couldn't open " + path + ": " + std::strerror(errno));
+
+    const std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (in.size() < 4 || std::memcmp(in.data(), MOVIE_MAGIC, 4) != 0)
+        throw std::runtime_error("InputMovie " + path + " is not a movie");
+
+    std::size_t pos = 4;
+    if (GetVarint(in, pos) != MOVIE_VERSION)
+        throw std::runtime_error("InputMovie " + path + " has an unsupported version");
+
+    InputMovie movie;
+    movie.end_frame = GetVarint(in, pos);
+    const uint64_t count = GetVarint(in, pos);
+    if (count > in.size())
+        throw std::runtime_error("InputMovie entry count is bogus");
+
+    movie.entries.reserve(count);
+    uint64_t frame = 0;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        frame += GetVarint(in, pos);
+        if (pos >= in.size())
+            throw std::runtime_error("InputMovie is truncated");
+
+        movie.entries.push_back({ frame, in[pos++] });
+    }
+
+    return movie;
+}
+
+MovieRecorder::MovieRecorder(): recorded_any(false)
+{
+}
+
+uint8_t MovieRecorder::OnLatch(uint64_t frame, uint8_t host_buttons)
+{
+    // the first latch always goes in, that's what the player starts from
+    if (!recorded_any || movie.entries.back().buttons != host_buttons)
+        movie.entries.push_back({ frame, host_buttons });
+
+    recorded_any = true;
+    movie.end_frame = frame;
+    return host_buttons;
+}
+
+const InputMovie& MovieRecorder::Movie() const
+{
+    return movie;
+}
+
+MoviePlayer::MoviePlayer(const InputMovie& movie): m_Movie(movie), next_entry(0), buttons(0), finished(false)
+{
+}
+
+uint8_t MoviePlayer::OnLatch(uint64_t frame, uint8_t)
+{
+    while (next_entry < m_Movie.entries.size() && m_Movie.entries[next_entry].frame <= frame)
+        buttons = m_Movie.entries[next_entry++].buttons;
+
+    if (frame >= m_Movie.end_frame)
+        finished = true;
+
+    return buttons;
+}
+
+bool MoviePlayer::Finished() const
+{
+    return finished;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gamepad-controller.h"
+
+#define MOVIE_MAGIC "GMMV"
+#define MOVIE_VERSION 1
+
+// input only, the rest of a replay is whatever the emulator deterministically does with it
+// stored as the frames where the latched buttons changed: varint frame delta + button mask
+struct InputMovie
+{
+    struct Entry
+    {
+        uint64_t frame;
+        uint8_t buttons;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t end_frame = 0; // last frame that was recorded
+
+    void Save(std::string const& path) const;
+    static InputMovie Load(std::string const& path);
+};
+
+// passes the host's buttons through untouched and writes down every change
+class MovieRecorder : public InputHook
+{
+public:
+    MovieRecorder();
+    uint8_t OnLatch(uint64_t frame, uint8_t host_buttons) override;
+    const InputMovie& Movie() const;
+private:
+    InputMovie movie;
+    bool recorded_any;
+};
+
+// ignores the host completely, the game sees exactly what the movie says on each frame
+class MoviePlayer : public InputHook
+{
+public:
+    explicit MoviePlayer(const InputMovie& movie);
+    uint8_t OnLatch(uint64_t frame, uint8_t host_buttons) override;
+    // true once the last recorded frame has been latched
+    bool Finished() const;
+private:
+    const InputMovie& m_Movie;
+    std::size_t next_entry;
+    uint8_t buttons;
+    bool finished;
+};
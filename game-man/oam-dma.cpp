@@ -0,0 +1,25 @@
+#include "oam-dma.h"
+
+OamDma::OamDma(Memory& memory, Scheduler& scheduler): m_Memory(memory), m_Scheduler(scheduler)
+{
+    m_Memory.ConnectOamDma(*this);
+    m_Scheduler.SetClient(EventType::OamDma, *this);
+}
+
+void OamDma::Start(uint8_t source_page)
+{
+    // E0-FF would read past work ram, those mirror it like the echo area does
+    if (source_page >= 0xE0)
+        source_page -= 0x20;
+
+    m_Memory.CopyToOam(static_cast<uint16_t>(source_page << 8));
+    m_Memory.SetBusLocked(true);
+
+    // a write while one is running restarts the window
+    m_Scheduler.Schedule(EventType::OamDma, m_Scheduler.Now() + OAM_DMA_CYCLES);
+}
+
+void OamDma::OnEvent(EventType, uint64_t)
+{
+    m_Memory.SetBusLocked(false);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+#include "memory.h"
+#include "scheduler.h"
+
+#define OAM_DMA_CYCLES 640 // 160 M-cycles
+
+// writing 0xFF46 copies 160 bytes from XX00 into OAM in one go, then keeps the bus
+// locked to HRAM for as long as the real transfer would take
+class OamDma : public SchedulerClient
+{
+public:
+    OamDma(Memory& memory, Scheduler& scheduler);
+    void OnEvent(EventType type, uint64_t cycle) override;
+
+    void Start(uint8_t source_page);
+private:
+    Memory& m_Memory;
+    Scheduler& m_Scheduler;
+};
@@ -0,0 +1,189 @@
+#include "ppu.h"
+
+#include <cstring>
+
+Ppu::Ppu(Memory& memory, Scheduler& scheduler, Compositor& compositor): m_Memory(memory), m_Scheduler(scheduler), m_Compositor(compositor)
+{
+    // padding included, save states of the same machine have to come out byte identical
+    std::memset(&this->state, 0, sizeof(this->state));
+    this->state.frame_start_cycle = scheduler.Now();
+    this->state.frame_count = 0;
+    this->state.stat_select = 0;
+    this->state.lyc = 0;
+    this->state.lcd_enabled = false;
+    this->state.stat_line = false;
+
+    m_Memory.ConnectPpu(*this);
+    m_Scheduler.SetClient(EventType::PpuMode, *this);
+    m_Scheduler.Schedule(EventType::PpuMode, state.frame_start_cycle + FRAME_CYCLES_TOTAL);
+}
+
+Ppu::Position Ppu::PositionAt(uint64_t cycle) const
+{
+    if (!state.lcd_enabled)
+        return { 0, 0, RenderingState::HBlank };
+
+    const uint32_t frame_cycle = static_cast<uint32_t>((cycle - state.frame_start_cycle) % FRAME_CYCLES_TOTAL);
+    Position position;
+    position.line = static_cast<uint8_t>(frame_cycle / LINE_CYCLES);
+    position.line_cycle = static_cast<uint16_t>(frame_cycle % LINE_CYCLES);
+
+    if (position.line >= VBLANK_START_LINE)
+        position.mode = RenderingState::VBlank;
+    else if (position.line_cycle < OAM_USED_CYCLES)
+        position.mode = RenderingState::OAM_Used;
+    else if (position.line_cycle < OAM_USED_CYCLES + OAM_RAM_USED_CYCLES)
+        position.mode = RenderingState::OAM_RAM_Used;
+    else
+        position.mode = RenderingState::HBlank;
+
+    return position;
+}
+
+void Ppu::OnEvent(EventType, uint64_t cycle)
+{
+    if (!state.lcd_enabled)
+    {
+        // nothing is drawn, but frame boundaries keep coming for whoever counts frames
+        ++state.frame_count;
+        state.frame_start_cycle = cycle;
+        m_Memory.LatchJoypad(state.frame_count);
+        m_Scheduler.Schedule(EventType::PpuMode, cycle + FRAME_CYCLES_TOTAL);
+        return;
+    }
+
+    if (cycle - state.frame_start_cycle >= FRAME_CYCLES_TOTAL)
+        state.frame_start_cycle += FRAME_CYCLES_TOTAL;
+
+    const Position position = PositionAt(cycle);
+    if (position.line_cycle == OAM_USED_CYCLES + OAM_RAM_USED_CYCLES && position.line < VBLANK_START_LINE)
+    {
+        // HBlank, the line is done, registers are as the game left them for it
+        SubmitScanline(position.line);
+    }
+    else if (position.line_cycle == 0 && position.line == VBLANK_START_LINE)
+    {
+        m_Memory.RequestInterrupt(InterruptFlags::VBlank);
+        m_Compositor.SubmitFrameEnd();
+        ++state.frame_count;
+        m_Memory.LatchJoypad(state.frame_count);
+    }
+
+    UpdateStatLine(position);
+    ScheduleNextEvent(position, cycle);
+}
+
+void Ppu::ScheduleNextEvent(const Position& position, uint64_t cycle)
+{
+    const uint64_t line_start = cycle - position.line_cycle;
+    uint64_t next = line_start + LINE_CYCLES;
+
+    if (position.line < VBLANK_START_LINE)
+    {
+        if (position.line_cycle < OAM_USED_CYCLES)
+            next = line_start + OAM_USED_CYCLES;
+        else if (position.line_cycle < OAM_USED_CYCLES + OAM_RAM_USED_CYCLES)
+            next = line_start + OAM_USED_CYCLES + OAM_RAM_USED_CYCLES;
+    }
+
+    m_Scheduler.Schedule(EventType::PpuMode, next);
+}
+
+void Ppu::UpdateStatLine(const Position& position)
+{
+    bool stat_line = false;
+    if (state.lcd_enabled)
+    {
+        const bool coincidence = position.line == state.lyc;
+        stat_line = (position.mode == RenderingState::HBlank && (state.stat_select & 0b00001000) != 0)
+            || (position.mode == RenderingState::VBlank && (state.stat_select & 0b00010000) != 0)
+            || (position.mode == RenderingState::OAM_Used && (state.stat_select & 0b00100000) != 0)
+            || (coincidence && (state.stat_select & 0b01000000) != 0);
+    }
+
+    if (stat_line && !state.stat_line)
+        m_Memory.RequestInterrupt(InterruptFlags::LCDC);
+
+    state.stat_line = stat_line;
+}
+
+uint8_t Ppu::ReadStat() const
+{
+    const Position position = PositionAt(m_Scheduler.Now());
+    const uint8_t coincidence = position.line == state.lyc ? 0b100 : 0;
+
+    return 0b10000000 | state.stat_select | coincidence | static_cast<uint8_t>(position.mode);
+}
+
+uint8_t Ppu::ReadLy() const
+{
+    return PositionAt(m_Scheduler.Now()).line;
+}
+
+void Ppu::WriteLcdc(uint8_t val)
+{
+    const bool enable = (val & 0b10000000) == 0b10000000;
+    if (enable == state.lcd_enabled)
+        return;
+
+    const uint64_t now = m_Scheduler.Now();
+    state.lcd_enabled = enable;
+    state.frame_start_cycle = now;
+
+    if (enable)
+    {
+        const Position position = PositionAt(now);
+        UpdateStatLine(position);
+        ScheduleNextEvent(position, now);
+    }
+    else
+    {
+        state.stat_line = false;
+        m_Scheduler.Schedule(EventType::PpuMode, now + FRAME_CYCLES_TOTAL);
+    }
+}
+
+void Ppu::WriteStat(uint8_t val)
+{
+    state.stat_select = val & 0b01111000;
+    UpdateStatLine(PositionAt(m_Scheduler.Now()));
+}
+
+void Ppu::WriteLyc(uint8_t val)
+{
+    state.lyc = val;
+    UpdateStatLine(PositionAt(m_Scheduler.Now()));
+}
+
+uint64_t Ppu::FrameCount() const
+{
+    return state.frame_count;
+}
+
+void Ppu::SubmitScanline(uint8_t ly)
+{
+    ScanlineRegisters regs;
+    regs.ly = ly;
+    // plain registers, read from the buffer so a DMA holding the cpu's bus doesn't hide them
+    regs.lcdc = *m_Memory.PeekPtrAt(0xFF40);
+    regs.scy = *m_Memory.PeekPtrAt(0xFF42);
+    regs.scx = *m_Memory.PeekPtrAt(0xFF43);
+    regs.wy = *m_Memory.PeekPtrAt(0xFF4A);
+    regs.wx = *m_Memory.PeekPtrAt(0xFF4B);
+    regs.bgp = *m_Memory.PeekPtrAt(0xFF47);
+    regs.obp0 = *m_Memory.PeekPtrAt(0xFF48);
+    regs.obp1 = *m_Memory.PeekPtrAt(0xFF49);
+
+    m_Compositor.SubmitScanline(regs, m_Memory.PeekPtrAt(0x8000), m_Memory.TakeVramDirty(),
+        m_Memory.PeekPtrAt(0xFE00), m_Memory.TakeOamDirty());
+}
+
+void Ppu::SaveState(StateWriter& writer) const
+{
+    writer.Write("PPU ", state);
+}
+
+void Ppu::LoadState(StateReader& reader)
+{
+    reader.Read("PPU ", state);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+
+#include "compositor.h"
+#include "memory.h"
+#include "scheduler.h"
+
+#define OAM_USED_CYCLES 80
+#define OAM_RAM_USED_CYCLES 172
+#define HBLANK_CYCLES 204
+#define LINE_CYCLES 456
+#define VBLANK_START_LINE 144
+#define LINES_TOTAL 154
+#define FRAME_CYCLES_TOTAL 70224
+
+// emulation thread half of the video, timing + capturing what each line looks like
+// the pixels themselves are composed by the Compositor
+// LY and STAT are worked out from the cycle counter whenever they're read, the only thing
+// running on its own is one scheduled event per mode change that raises the interrupts
+class Ppu : public SchedulerClient
+{
+public:
+    Ppu(Memory& memory, Scheduler& scheduler, Compositor& compositor);
+    void OnEvent(EventType type, uint64_t cycle) override;
+
+    uint8_t ReadStat() const;
+    uint8_t ReadLy() const;
+    void WriteLcdc(uint8_t val);
+    void WriteStat(uint8_t val);
+    void WriteLyc(uint8_t val);
+
+    // bumped on every VBlank, keeps going at the same pace while the display is off
+    uint64_t FrameCount() const;
+
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+private:
+    // same values as STAT bits 0-1
+    enum class RenderingState{ HBlank, VBlank, OAM_Used, OAM_RAM_Used};
+    struct Position
+    {
+        uint8_t line;
+        uint16_t line_cycle;
+        RenderingState mode;
+    };
+    Position PositionAt(uint64_t cycle) const;
+    void ScheduleNextEvent(const Position& position, uint64_t cycle);
+    void UpdateStatLine(const Position& position);
+    void SubmitScanline(uint8_t ly);
+
+    Memory& m_Memory;
+    Scheduler& m_Scheduler;
+    Compositor& m_Compositor;
+
+    struct PpuState
+    {
+        uint64_t frame_start_cycle; // when LY 0 of the current frame started
+        uint64_t frame_count;
+        uint8_t stat_select; // STAT bits 3-6, which sources raise the LCDC interrupt
+        uint8_t lyc;
+        bool lcd_enabled;
+        bool stat_line; // all enabled sources OR'd together, the interrupt fires on its rising edge
+    };
+    PpuState state;
+};
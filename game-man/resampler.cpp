@@ -0,0 +1,128 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RESAMPLER_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+    constexpr double pi = 3.14159265358979323846;
+
+    int16_t ClampSample(float val)
+    {
+        return static_cast<int16_t>(std::lround(std::clamp(val, -32768.0f, 32767.0f)));
+    }
+}
+
+AudioSample ResamplerConvolve(const float* coefficients, const float* left, const float* right)
+{
+#ifdef RESAMPLER_SSE
+    __m128 sum_left = _mm_setzero_ps();
+    __m128 sum_right = _mm_setzero_ps();
+    for (int tap = 0; tap < RESAMPLER_TAPS; tap += 4)
+    {
+        const __m128 coefficient = _mm_loadu_ps(coefficients + tap);
+        sum_left = _mm_add_ps(sum_left, _mm_mul_ps(coefficient, _mm_loadu_ps(left + tap)));
+        sum_right = _mm_add_ps(sum_right, _mm_mul_ps(coefficient, _mm_loadu_ps(right + tap)));
+    }
+
+    // horizontal sums, left ends up in lane 0 and right in lane 2
+    const __m128 low = _mm_unpacklo_ps(sum_left, sum_right); // l0 r0 l1 r1
+    const __m128 high = _mm_unpackhi_ps(sum_left, sum_right); // l2 r2 l3 r3
+    const __m128 pairs = _mm_add_ps(low, high); // l02 r02 l13 r13
+    const __m128 total = _mm_add_ps(pairs, _mm_movehl_ps(pairs, pairs)); // l r . .
+
+    float result[4];
+    _mm_storeu_ps(result, total);
+    return { ClampSample(result[0]), ClampSample(result[1]) };
+#else
+    return ResamplerConvolveScalar(coefficients, left, right);
+#endif
+}
+
+AudioSample ResamplerConvolveScalar(const float* coefficients, const float* left, const float* right)
+{
+    float sum_left = 0.0f;
+    float sum_right = 0.0f;
+    for (int tap = 0; tap < RESAMPLER_TAPS; ++tap)
+    {
+        sum_left += coefficients[tap] * left[tap];
+        sum_right += coefficients[tap] * right[tap];
+    }
+
+    return { ClampSample(sum_left), ClampSample(sum_right) };
+}
+
+Resampler::Resampler(uint32_t input_rate, uint32_t output_rate): input_rate(input_rate), output_rate(output_rate),
+    next_output(output_rate), filter(RESAMPLER_PHASES * RESAMPLER_TAPS), history_left{}, history_right{}, history_pos(0)
+{
+    if (output_rate == 0 || output_rate > input_rate)
+        throw std::runtime_error("Resampler only decimates, output rate has to be between 0 and the input rate");
+
+    BuildFilter();
+}
+
+void Resampler::BuildFilter()
+{
+    // blackman transition band is ~5.5 / taps wide (in input rate units), end it right at the output nyquist
+    const double half_taps = RESAMPLER_TAPS / 2.0;
+    const double cutoff = std::max(0.5 * output_rate / input_rate - 2.75 / RESAMPLER_TAPS, 0.01);
+
+    for (int phase = 0; phase < RESAMPLER_PHASES; ++phase)
+    {
+        // the output point sits frac input samples before the middle of the window
+        const double frac = static_cast<double>(phase) / RESAMPLER_PHASES;
+        float* row = &filter[phase * RESAMPLER_TAPS];
+        double sum = 0.0;
+
+        for (int tap = 0; tap < RESAMPLER_TAPS; ++tap)
+        {
+            const double distance = tap - half_taps + frac;
+            const double x = 2.0 * cutoff * distance;
+            const double sinc = x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+            const double window = 0.42 + 0.5 * std::cos(pi * distance / half_taps) + 0.08 * std::cos(2.0 * pi * distance / half_taps);
+
+            row[tap] = static_cast<float>(sinc * window);
+            sum += row[tap];
+        }
+
+        // unity gain at DC for every phase, otherwise the phases beat against each other
+        for (int tap = 0; tap < RESAMPLER_TAPS; ++tap)
+            row[tap] = static_cast<float>(row[tap] / sum);
+    }
+}
+
+AudioSample Resampler::Convolve(const float* coefficients) const
+{
+    return ResamplerConvolve(coefficients, &history_left[history_pos], &history_right[history_pos]);
+}
+
+void Resampler::Process(const AudioSample* in, std::size_t count, std::vector<AudioSample>& out)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        history_left[history_pos] = history_left[history_pos + RESAMPLER_TAPS] = in[i].left;
+        history_right[history_pos] = history_right[history_pos + RESAMPLER_TAPS] = in[i].right;
+        history_pos = (history_pos + 1) % RESAMPLER_TAPS;
+
+        next_output -= output_rate;
+        while (next_output <= 0)
+        {
+            // -next_output / output_rate is how far behind the newest input the output point is, always under one
+            // input sample, next_output starts at output_rate so the very first one lands on phase 0 and not one past the end
+            const std::size_t phase = static_cast<std::size_t>(-next_output) * RESAMPLER_PHASES / output_rate;
+            out.push_back(Convolve(&filter[phase * RESAMPLER_TAPS]));
+            next_output += input_rate;
+        }
+    }
+}
+
+uint32_t Resampler::OutputRate() const
+{
+    return output_rate;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "apu.h"
+
+#define RESAMPLER_TAPS 64 // per output sample and channel, multiple of 4 for the SSE path
+#define RESAMPLER_PHASES 256 // fractional positions between two input samples
+
+// the dot product of one filter row with RESAMPLER_TAPS samples of both channels, SSE where the host has it
+AudioSample ResamplerConvolve(const float* coefficients, const float* left, const float* right);
+// the plain loop whatever the host has, what ResamplerConvolve is checked against
+// the SSE version adds the taps up in a different order, so the two can come out one apart after rounding
+AudioSample ResamplerConvolveScalar(const float* coefficients, const float* left, const float* right);
+
+// windowed sinc decimator, takes the APU's native rate down to 44.1/48 kHz without folding
+// everything above the new nyquist back into the audible range
+// one instance per stream, not thread safe, the AudioWriter runs it on its own thread
+class Resampler
+{
+public:
+    Resampler(uint32_t input_rate, uint32_t output_rate);
+
+    // appends however many output samples the input produced to out, keeps the leftover history
+    void Process(const AudioSample* in, std::size_t count, std::vector<AudioSample>& out);
+
+    uint32_t OutputRate() const;
+private:
+    void BuildFilter();
+    AudioSample Convolve(const float* coefficients) const;
+
+    uint32_t input_rate;
+    uint32_t output_rate;
+    // distance to the next output sample from the newest input sample, in 1/output_rate input samples
+    // between two inputs it stays in (0, input_rate], the output point is never more than one input behind
+    int64_t next_output;
+
+    // RESAMPLER_PHASES rows of RESAMPLER_TAPS coefficients
+    std::vector<float> filter;
+
+    // every sample is written twice, so the last RESAMPLER_TAPS are always contiguous from history_pos
+    float history_left[RESAMPLER_TAPS * 2];
+    float history_right[RESAMPLER_TAPS * 2];
+    std::size_t history_pos;
+};
@@ -0,0 +1,264 @@
+#include "rewind-buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    void PutVarint(std::vector<uint8_t>& out, std::size_t val)
+    {
+        while (val >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(val | 0x80));
+            val >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(val));
+    }
+
+    std::size_t GetVarint(const uint8_t* in, std::size_t& pos)
+    {
+        std::size_t val = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            const uint8_t byte = in[pos++];
+            val |= static_cast<std::size_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return val;
+        }
+    }
+
+    uint64_t Word(const uint8_t* src)
+    {
+        uint64_t word;
+        std::memcpy(&word, src, sizeof(word));
+        return word;
+    }
+}
+
+RewindBuffer::RewindBuffer(std::size_t capacity_bytes, uint32_t frames_per_snapshot, uint32_t keyframe_interval):
+    frames_per_snapshot(frames_per_snapshot), keyframe_interval(keyframe_interval), newest_frame(0), newest_number(0), storage(capacity_bytes)
+{
+    if (frames_per_snapshot == 0)
+        throw std::runtime_error("RewindBuffer needs at least one frame per snapshot");
+    if (keyframe_interval == 0)
+        throw std::runtime_error("RewindBuffer keyframe interval can't be 0");
+}
+
+// the delta is (zero run, literal run, literals...) repeated, both runs as varints
+void RewindBuffer::EncodeXor(const std::vector<uint8_t>& older, const std::vector<uint8_t>& newer, std::vector<uint8_t>& out)
+{
+    out.clear();
+    const std::size_t size = newer.size();
+    std::size_t pos = 0;
+
+    while (pos < size)
+    {
+        // equal stretches, a word at a time while possible
+        const std::size_t zero_start = pos;
+        while (pos + 8 <= size && Word(&older[pos]) == Word(&newer[pos]))
+            pos += 8;
+        while (pos < size && older[pos] == newer[pos])
+            ++pos;
+
+        if (pos == size)
+            break; // trailing zeros don't need to be written down
+
+        // differences, stop at the first 8 equal bytes in a row so short matches don't split literals
+        const std::size_t literal_start = pos;
+        std::size_t equal_run = 0;
+        while (pos < size && equal_run < 8)
+        {
+            equal_run = older[pos] == newer[pos] ? equal_run + 1 : 0;
+            ++pos;
+        }
+        const std::size_t literal_end = pos - equal_run;
+        pos = literal_end;
+
+        PutVarint(out, literal_start - zero_start);
+        PutVarint(out, literal_end - literal_start);
+        for (std::size_t i = literal_start; i < literal_end; ++i)
+            out.push_back(older[i] ^ newer[i]);
+    }
+}
+
+void RewindBuffer::ApplyXor(const uint8_t* delta, std::size_t size, std::vector<uint8_t>& state)
+{
+    std::size_t in = 0;
+    std::size_t out = 0;
+    while (in < size)
+    {
+        out += GetVarint(delta, in);
+        const std::size_t literals = GetVarint(delta, in);
+        for (std::size_t i = 0; i < literals; ++i)
+            state[out++] ^= delta[in++];
+    }
+}
+
+void RewindBuffer::Store(const Snapshot& snapshot, const std::vector<uint8_t>& keyframe, const std::vector<uint8_t>& delta)
+{
+    const std::size_t size = snapshot.keyframe_size + snapshot.delta_size;
+    if (size > storage.size())
+    {
+        // can't hold even a single step, history ends here
+        snapshots.clear();
+        return;
+    }
+
+    // snapshots are contiguous, one that doesn't fit before the end of storage starts over at 0
+    std::size_t offset = 0;
+    if (!snapshots.empty())
+    {
+        offset = snapshots.back().offset + snapshots.back().keyframe_size + snapshots.back().delta_size;
+        if (offset + size > storage.size())
+            offset = 0;
+    }
+
+    // evict everything old the new one would overwrite
+    while (!snapshots.empty())
+    {
+        const Snapshot& oldest = snapshots.front();
+        const bool overlaps = oldest.offset < offset + size && offset < oldest.offset + oldest.keyframe_size + oldest.delta_size;
+        if (!overlaps)
+            break;
+        snapshots.pop_front();
+    }
+
+    std::memcpy(storage.data() + offset, keyframe.data(), snapshot.keyframe_size);
+    std::memcpy(storage.data() + offset + snapshot.keyframe_size, delta.data(), snapshot.delta_size);
+    snapshots.push_back(snapshot);
+    snapshots.back().offset = offset;
+}
+
+void RewindBuffer::OnFrame(const Cpu& cpu, uint64_t frame)
+{
+    if (frame % frames_per_snapshot == 0)
+        Capture(cpu, frame);
+}
+
+void RewindBuffer::Capture(const Cpu& cpu, uint64_t frame)
+{
+    StateWriter writer(scratch);
+    cpu.SaveState(writer);
+
+    // the frame check catches a machine that was loaded back to somewhere else behind our back
+    if (newest.size() == scratch.size() && frame > newest_frame)
+    {
+        // xor is its own inverse, the same delta takes newest back to the previous one
+        EncodeXor(newest, scratch, encoded);
+        const bool keyframe = newest_number % keyframe_interval == 0;
+        Store({ newest_frame, newest_number, 0, keyframe ? newest.size() : 0, encoded.size() }, newest, encoded);
+        ++newest_number;
+    }
+    else
+    {
+        snapshots.clear();
+        newest_number = 0;
+    }
+
+    newest.swap(scratch);
+    newest_frame = frame;
+}
+
+bool RewindBuffer::StepBack(Cpu& cpu)
+{
+    if (newest.empty())
+        return false;
+
+    const bool went_back = !snapshots.empty();
+    if (went_back)
+    {
+        const Snapshot snapshot = snapshots.back();
+        ApplyXor(storage.data() + snapshot.offset + snapshot.keyframe_size, snapshot.delta_size, newest);
+        newest_frame = snapshot.frame;
+        newest_number = snapshot.number;
+        snapshots.pop_back();
+    }
+
+    StateReader reader(newest);
+    cpu.LoadState(reader);
+    return went_back;
+}
+
+bool RewindBuffer::Restore(Cpu& cpu, uint64_t frame)
+{
+    if (newest.empty())
+        return false;
+
+    if (frame != newest_frame)
+    {
+        const auto found = std::lower_bound(snapshots.begin(), snapshots.end(), frame,
+            [](const Snapshot& snapshot, uint64_t frame) { return snapshot.frame < frame; });
+        if (found == snapshots.end() || found->frame != frame)
+            return false;
+        const std::size_t index = static_cast<std::size_t>(found - snapshots.begin());
+
+        // numbers are consecutive, so the keyframes on either side are a subtraction away, and the newest
+        // full state stands in for the one after if that isn't stored yet
+        const std::size_t back_steps = static_cast<std::size_t>(found->number % keyframe_interval);
+        const std::size_t forward_steps = std::min<std::size_t>(keyframe_interval - back_steps, snapshots.size() - index);
+
+        if (back_steps <= index && back_steps <= forward_steps)
+        {
+            const Snapshot& keyframe = snapshots[index - back_steps];
+            scratch.assign(storage.data() + keyframe.offset, storage.data() + keyframe.offset + keyframe.keyframe_size);
+            for (std::size_t i = index - back_steps; i < index; ++i)
+                ApplyXor(storage.data() + snapshots[i].offset + snapshots[i].keyframe_size, snapshots[i].delta_size, scratch);
+        }
+        else
+        {
+            const std::size_t from = index + forward_steps;
+            if (from == snapshots.size())
+                scratch = newest;
+            else
+                scratch.assign(storage.data() + snapshots[from].offset, storage.data() + snapshots[from].offset + snapshots[from].keyframe_size);
+            for (std::size_t i = from; i-- > index;)
+                ApplyXor(storage.data() + snapshots[i].offset + snapshots[i].keyframe_size, snapshots[i].delta_size, scratch);
+        }
+
+        newest.swap(scratch);
+        newest_frame = frame;
+        newest_number = found->number;
+        DropNewerThan(index);
+    }
+
+    StateReader reader(newest);
+    cpu.LoadState(reader);
+    return true;
+}
+
+// the snapshot at index is the newest now, it and everything after it go
+void RewindBuffer::DropNewerThan(std::size_t index)
+{
+    snapshots.erase(snapshots.begin() + static_cast<std::ptrdiff_t>(index), snapshots.end());
+}
+
+void RewindBuffer::Clear()
+{
+    newest.clear();
+    newest_number = 0;
+    snapshots.clear();
+}
+
+std::size_t RewindBuffer::Snapshots() const
+{
+    return newest.empty() ? 0 : snapshots.size() + 1;
+}
+
+std::size_t RewindBuffer::BytesUsed() const
+{
+    std::size_t used = newest.size();
+    for (const auto& snapshot : snapshots)
+        used += snapshot.keyframe_size + snapshot.delta_size;
+    return used;
+}
+
+uint64_t RewindBuffer::OldestFrame() const
+{
+    return snapshots.empty() ? newest_frame : snapshots.front().frame;
+}
+
+uint64_t RewindBuffer::NewestFrame() const
+{
+    return newest_frame;
+}
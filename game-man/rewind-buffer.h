@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "cpu.h"
+
+#define REWIND_DEFAULT_BYTES (4 * 1024 * 1024)
+#define REWIND_DEFAULT_FRAMES_PER_SNAPSHOT 4
+#define REWIND_DEFAULT_KEYFRAME_INTERVAL 32 // snapshots between two full copies
+
+// keeps the newest save state in full and every older one as XOR against the one after it, run length encoded
+// consecutive states differ in a few hundred bytes out of 64K, so a delta is usually well under 1K
+// every keyframe_interval-th snapshot also keeps a full copy, XOR works both ways so any stored snapshot is
+// at most keyframe_interval deltas away from a full state, Restore costs the same no matter how much history there is
+// the oldest snapshots fall out of the fixed size ring when a new one doesn't fit
+class RewindBuffer
+{
+public:
+    RewindBuffer(std::size_t capacity_bytes = REWIND_DEFAULT_BYTES, uint32_t frames_per_snapshot = REWIND_DEFAULT_FRAMES_PER_SNAPSHOT,
+        uint32_t keyframe_interval = REWIND_DEFAULT_KEYFRAME_INTERVAL);
+
+    // once per frame from the emulation thread, takes a snapshot every frames_per_snapshot frames
+    void OnFrame(const Cpu& cpu, uint64_t frame);
+    void Capture(const Cpu& cpu, uint64_t frame);
+
+    // loads the snapshot before the newest one and forgets the newest
+    // with only one left that one gets loaded again and false comes back
+    bool StepBack(Cpu& cpu);
+    // loads the snapshot taken at frame and forgets everything newer, false (and nothing loaded) if there isn't one
+    bool Restore(Cpu& cpu, uint64_t frame);
+    void Clear();
+
+    std::size_t Snapshots() const;
+    std::size_t BytesUsed() const;
+    // frames of the oldest and newest snapshot, only meaningful with at least one
+    uint64_t OldestFrame() const;
+    uint64_t NewestFrame() const;
+private:
+    // one older snapshot, its keyframe (if it has one) followed by its delta to the snapshot after it, in one piece of storage
+    struct Snapshot
+    {
+        uint64_t frame;
+        uint64_t number; // counted from the last Clear, every keyframe_interval-th one is a keyframe
+        std::size_t offset;
+        std::size_t keyframe_size; // 0 = no full copy
+        std::size_t delta_size;
+    };
+
+    static void EncodeXor(const std::vector<uint8_t>& older, const std::vector<uint8_t>& newer, std::vector<uint8_t>& out);
+    static void ApplyXor(const uint8_t* delta, std::size_t size, std::vector<uint8_t>& state);
+    void Store(const Snapshot& snapshot, const std::vector<uint8_t>& keyframe, const std::vector<uint8_t>& delta);
+    void DropNewerThan(std::size_t index);
+
+    uint32_t frames_per_snapshot;
+    uint32_t keyframe_interval;
+    std::vector<uint8_t> newest; // full state, empty until the first capture
+    uint64_t newest_frame;
+    uint64_t newest_number;
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> encoded;
+
+    std::vector<uint8_t> storage;
+    std::deque<Snapshot> snapshots; // oldest first, frames go up, the newest isn't in here
+};
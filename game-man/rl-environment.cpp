@@ -0,0 +1,207 @@
+#include "rl-environment.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+RlEnvironment::RlEnvironment(Machine& machine, const RlConfig& config): m_Machine(machine), config(config)
+{
+    if (config.downsample > RL_MAX_DOWNSAMPLE
+        || (config.downsample != 0 && (LCD_WIDTH % config.downsample != 0 || LCD_HEIGHT % config.downsample != 0)))
+        throw std::runtime_error("Downsample factor has to divide 160 and 144");
+    for (const RlRewardHook& hook : config.rewards)
+    {
+        if (hook.width != 1 && hook.width != 2)
+            throw std::runtime_error("Reward hooks are 1 or 2 bytes wide");
+    }
+
+    this->last_frame = nullptr;
+    std::memset(this->column_sums, 0, sizeof(this->column_sums));
+    this->previous_values.resize(config.rewards.size());
+    for (std::size_t i = 0; i < config.rewards.size(); ++i)
+        this->previous_values[i] = ReadHook(config.rewards[i]);
+}
+
+void RlEnvironment::SetResetState(const std::vector<uint8_t>& state)
+{
+    this->reset_state = state;
+}
+
+RlStepResult RlEnvironment::Reset(uint8_t* observation)
+{
+    if (!reset_state.empty())
+        m_Machine.LoadState(reset_state);
+    return Finish(observation, false);
+}
+
+RlStepResult RlEnvironment::Step(uint8_t action_mask, uint32_t frames, uint8_t* observation)
+{
+    // latched now, so the game sees the action from the first of these frames on, not one step late
+    m_Machine.SetInput(action_mask);
+    for (uint32_t i = 0; i < frames; ++i)
+        m_Machine.RunFrame();
+    return Finish(observation, true);
+}
+
+void RlEnvironment::StepBatch(const std::vector<RlEnvironment*>& envs, const uint8_t* actions, uint32_t frames,
+    uint8_t* observations, RlStepResult* results, WorkStealingPool* pool)
+{
+    if (envs.empty())
+        return;
+
+    const std::size_t stride = envs[0]->ObservationSize();
+    for (const RlEnvironment* env : envs)
+    {
+        if (env->ObservationSize() != stride)
+            throw std::runtime_error("Batched environments need the same observation size");
+    }
+
+    auto step = [&](std::size_t i)
+    {
+        results[i] = envs[i]->Step(actions[i], frames, observations != nullptr ? observations + i * stride : nullptr);
+    };
+
+    if (pool == nullptr || pool->WorkerCount() <= 1)
+    {
+        for (std::size_t i = 0; i < envs.size(); ++i)
+            step(i);
+        return;
+    }
+
+    // one task per worker over a contiguous run of environments, neighbours' observations stay on one core
+    const std::size_t chunks = std::min<std::size_t>(pool->WorkerCount(), envs.size());
+    for (std::size_t c = 0; c < chunks; ++c)
+    {
+        const std::size_t begin = envs.size() * c / chunks;
+        const std::size_t end = envs.size() * (c + 1) / chunks;
+        pool->Submit([&step, begin, end]()
+        {
+            for (std::size_t i = begin; i < end; ++i)
+                step(i);
+        });
+    }
+    pool->Wait();
+}
+
+std::size_t RlEnvironment::ObservationSize() const
+{
+    return ScreenWidth() * ScreenHeight() + config.ram_addresses.size();
+}
+
+std::size_t RlEnvironment::ScreenWidth() const
+{
+    return config.downsample == 0 ? 0 : LCD_WIDTH / config.downsample;
+}
+
+std::size_t RlEnvironment::ScreenHeight() const
+{
+    return config.downsample == 0 ? 0 : LCD_HEIGHT / config.downsample;
+}
+
+Machine& RlEnvironment::GetMachine()
+{
+    return m_Machine;
+}
+
+RlStepResult RlEnvironment::Finish(uint8_t* observation, bool score)
+{
+    RlStepResult result;
+    result.reward = 0.0f;
+    if (score)
+        result.reward = Score();
+    else
+    {
+        // a fresh episode, deltas start counting from here
+        for (std::size_t i = 0; i < config.rewards.size(); ++i)
+            previous_values[i] = ReadHook(config.rewards[i]);
+    }
+    result.done = Done();
+    result.frame = m_Machine.FrameCount();
+    result.observation = observation;
+
+    if (observation != nullptr)
+    {
+        uint8_t* out = observation;
+        if (config.downsample != 0)
+        {
+            WriteScreen(out);
+            out += ScreenWidth() * ScreenHeight();
+        }
+        const Memory& memory = m_Machine.GetMemory();
+        for (uint16_t address : config.ram_addresses)
+            *out++ = *memory.PeekPtrAt(address);
+    }
+    return result;
+}
+
+float RlEnvironment::Score()
+{
+    float reward = 0.0f;
+    for (std::size_t i = 0; i < config.rewards.size(); ++i)
+    {
+        const RlRewardHook& hook = config.rewards[i];
+        const uint32_t value = ReadHook(hook);
+        if (hook.delta)
+            reward += hook.weight * static_cast<float>(static_cast<int64_t>(value) - static_cast<int64_t>(previous_values[i]));
+        else
+            reward += hook.weight * static_cast<float>(value);
+        previous_values[i] = value;
+    }
+    return reward;
+}
+
+bool RlEnvironment::Done() const
+{
+    const Memory& memory = m_Machine.GetMemory();
+    for (const RlDoneHook& hook : config.done)
+    {
+        if ((*memory.PeekPtrAt(hook.address) & hook.mask) == hook.value)
+            return true;
+    }
+    return false;
+}
+
+uint32_t RlEnvironment::ReadHook(const RlRewardHook& hook) const
+{
+    // the buffer has a byte past 0xFFFF, a 2 byte read at IE doesn't run off the end
+    const uint8_t* bytes = m_Machine.GetMemory().PeekPtrAt(hook.address);
+    return hook.width == 2 ? static_cast<uint32_t>(bytes[0] | (bytes[1] << 8)) : bytes[0];
+}
+
+void RlEnvironment::WriteScreen(uint8_t* out)
+{
+    FrameView view;
+    if (m_Machine.GetCompositor().Frames().AcquireLatest(view))
+        last_frame = view.pixels;
+
+    const std::size_t width = ScreenWidth();
+    const std::size_t height = ScreenHeight();
+    if (last_frame == nullptr)
+    {
+        // nothing drawn yet, the lcd is off and that's white
+        std::memset(out, 0xFF, width * height);
+        return;
+    }
+
+    const uint32_t block = config.downsample;
+    const uint32_t area = block * block;
+    for (std::size_t y = 0; y < height; ++y)
+    {
+        std::memset(column_sums, 0, width * sizeof(column_sums[0]));
+        const uint8_t* row = last_frame + y * block * LCD_WIDTH;
+        for (uint32_t line = 0; line < block; ++line, row += LCD_WIDTH)
+        {
+            for (std::size_t x = 0; x < width; ++x)
+            {
+                const uint8_t* pixels = row + x * block;
+                uint16_t sum = 0;
+                for (uint32_t i = 0; i < block; ++i)
+                    sum += pixels[i];
+                column_sums[x] += sum;
+            }
+        }
+        // shades are 0 (white) to 3 (black)
+        for (std::size_t x = 0; x < width; ++x)
+            out[y * width + x] = static_cast<uint8_t>(255 - column_sums[x] * 85 / area);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "machine.h"
+#include "work-stealing-pool.h"
+
+#define RL_MAX_DOWNSAMPLE 16
+
+// a number the game keeps in memory, read little endian, `width` bytes (1 or 2) starting at address
+// delta rewards the change since the previous step (score went up), otherwise the value itself (x position)
+struct RlRewardHook
+{
+    uint16_t address = 0;
+    uint8_t width = 1;
+    bool delta = true;
+    float weight = 1.0f;
+};
+
+// the episode is over once (byte & mask) == value, any of them is enough
+struct RlDoneHook
+{
+    uint16_t address = 0;
+    uint8_t mask = 0xFF;
+    uint8_t value = 0;
+};
+
+// the observation is the screen (if downsample isn't 0) followed by one byte per ram address
+// the screen is 8 bit grayscale, 255 = white, every pixel the average of a downsample x downsample block
+// downsample has to divide both 160 and 144 (1, 2, 4, 8, 16)
+struct RlConfig
+{
+    uint8_t downsample = 2;
+    std::vector<uint16_t> ram_addresses; // WRAM/HRAM bytes, read raw, registers worked out on read (LY, STAT) aren't there
+    std::vector<RlRewardHook> rewards;
+    std::vector<RlDoneHook> done;
+};
+
+struct RlStepResult
+{
+    float reward;
+    bool done;
+    uint64_t frame; // emulated frames since power on
+    uint8_t* observation; // the caller's buffer, nullptr if none was passed
+};
+
+// thin agent loop around a machine that's owned somewhere else (standalone, an arena, a fork server)
+// observations are written straight into memory the caller hands in (a numpy array, a replay buffer slot),
+// from the published frame and the memory map, no copy of the frame is kept and nothing allocates per step
+// screen observations need the inline compositor, with a threaded one the frame can lag behind
+class RlEnvironment
+{
+public:
+    RlEnvironment(Machine& machine, const RlConfig& config);
+
+    RlEnvironment(const RlEnvironment&) = delete;
+    RlEnvironment& operator=(const RlEnvironment&) = delete;
+
+    // Reset loads this, without one it keeps running from wherever the machine is
+    void SetResetState(const std::vector<uint8_t>& state);
+    RlStepResult Reset(uint8_t* observation);
+
+    // holds the buttons (GamepadController::Button bits) for `frames` frames, the first one included, then scores and observes
+    RlStepResult Step(uint8_t action_mask, uint32_t frames, uint8_t* observation);
+
+    // one call for the whole batch, actions[i] goes to envs[i], observation i lands at observations + i * ObservationSize()
+    // (all of them have to use the same config), with a pool the environments run in parallel
+    // the pool has to be otherwise idle, this waits for everything on it
+    static void StepBatch(const std::vector<RlEnvironment*>& envs, const uint8_t* actions, uint32_t frames,
+        uint8_t* observations, RlStepResult* results, WorkStealingPool* pool = nullptr);
+
+    std::size_t ObservationSize() const;
+    std::size_t ScreenWidth() const;
+    std::size_t ScreenHeight() const;
+    Machine& GetMachine();
+private:
+    RlStepResult Finish(uint8_t* observation, bool score);
+    float Score();
+    bool Done() const;
+    uint32_t ReadHook(const RlRewardHook& hook) const;
+    void WriteScreen(uint8_t* out);
+
+    Machine& m_Machine;
+    RlConfig config;
+    std::vector<uint8_t> reset_state;
+    std::vector<uint32_t> previous_values; // one per reward hook, what the last step saw
+
+    const uint8_t* last_frame; // the frame view stays valid until the next AcquireLatest
+    uint16_t column_sums[LCD_WIDTH]; // one per output pixel of the row being built
+};
@@ -0,0 +1,101 @@
+#include "rollout-runner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+RolloutRunner::RolloutRunner(WorkStealingPool& pool, std::shared_ptr<const std::vector<uint8_t>> rom, const MachineConfig& config):
+    m_Pool(pool), forks(std::move(rom), pool.WorkerCount(), config), workers(pool.WorkerCount()), next_rollout(0)
+{
+    // the children are never released, they're only rewound from call to call
+    for (Worker& worker : workers)
+    {
+        worker = Worker{};
+        worker.machine = &forks.Fork();
+    }
+}
+
+RolloutStats RolloutRunner::Run(const std::vector<uint8_t>& start_state, const std::vector<std::vector<uint8_t>>& inputs,
+    const std::vector<uint16_t>& addresses, uint8_t* results)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    // a new start state only bumps the generation, each worker's machine does its full load on its own thread
+    forks.SetParent(start_state);
+    next_rollout.store(0, std::memory_order_relaxed);
+
+    const std::size_t active = std::min(workers.size(), inputs.size());
+    for (std::size_t i = 0; i < active; ++i)
+    {
+        Worker& worker = workers[i];
+        worker.used = true; // whatever the last call left behind
+        worker.rollouts = 0;
+        worker.frames = 0;
+        worker.full_loads = 0;
+        worker.pages_restored = 0;
+        m_Pool.Submit([this, &worker, &inputs, &addresses, results]() { RunWorker(worker, inputs, addresses, results); });
+    }
+    m_Pool.Wait();
+
+    RolloutStats stats{};
+    for (std::size_t i = 0; i < active; ++i)
+    {
+        stats.rollouts += workers[i].rollouts;
+        stats.frames += workers[i].frames;
+        stats.full_loads += workers[i].full_loads;
+        stats.pages_restored += workers[i].pages_restored;
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void RolloutRunner::RunWorker(Worker& worker, const std::vector<std::vector<uint8_t>>& inputs,
+    const std::vector<uint16_t>& addresses, uint8_t* results)
+{
+    Machine& machine = *worker.machine;
+    const std::size_t result_size = ResultSize(addresses);
+
+    for (;;)
+    {
+        const std::size_t k = next_rollout.fetch_add(1, std::memory_order_relaxed);
+        if (k >= inputs.size())
+            break;
+
+        if (worker.used)
+        {
+            const ForkStats counts = forks.Rewind(machine);
+            worker.full_loads += counts.full_loads;
+            worker.pages_restored += counts.pages_restored;
+        }
+        worker.used = true;
+
+        // latched before each frame runs, mask i is what the game sees for all of frame i
+        for (uint8_t buttons : inputs[k])
+        {
+            machine.SetInput(buttons);
+            machine.RunFrame();
+        }
+        machine.GetGamepad().SetButtons(0);
+
+        WriteResult(machine.GetMemory(), addresses, results + k * result_size);
+        ++worker.rollouts;
+        worker.frames += inputs[k].size();
+    }
+}
+
+std::size_t RolloutRunner::ResultSize(const std::vector<uint16_t>& addresses)
+{
+    return addresses.empty() ? ROLLOUT_WRAM_SIZE + ROLLOUT_HRAM_SIZE : addresses.size();
+}
+
+void RolloutRunner::WriteResult(const Memory& memory, const std::vector<uint16_t>& addresses, uint8_t* out)
+{
+    if (addresses.empty())
+    {
+        std::memcpy(out, memory.PeekPtrAt(ROLLOUT_WRAM_START), ROLLOUT_WRAM_SIZE);
+        std::memcpy(out + ROLLOUT_WRAM_SIZE, memory.PeekPtrAt(ROLLOUT_HRAM_START), ROLLOUT_HRAM_SIZE);
+        return;
+    }
+    for (uint16_t address : addresses)
+        *out++ = *memory.PeekPtrAt(address);
+}
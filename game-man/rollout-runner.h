@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "fork-server.h"
+#include "work-stealing-pool.h"
+
+// what a rollout hands back when no addresses are asked for, WRAM then HRAM
+#define ROLLOUT_WRAM_START 0xC000
+#define ROLLOUT_WRAM_SIZE 0x2000
+#define ROLLOUT_HRAM_START 0xFF80
+#define ROLLOUT_HRAM_SIZE 0x7F
+
+struct RolloutStats
+{
+    uint64_t rollouts;
+    uint64_t frames;
+    uint64_t full_loads; // a worker's machine was on an older start state
+    uint64_t pages_restored;
+    double seconds;
+};
+
+// plays K input sequences from one start state, in parallel, and hands back the memory every one of them ended with
+// for search and planning, where the same point gets branched over and over
+// every worker gets one machine, forked from the start state and rewound between its rollouts (dirty pages only),
+// the machines stay around between calls, so a call only pays for what the rollouts wrote
+class RolloutRunner
+{
+public:
+    RolloutRunner(WorkStealingPool& pool, std::shared_ptr<const std::vector<uint8_t>> rom, const MachineConfig& config = MachineConfig());
+
+    RolloutRunner(const RolloutRunner&) = delete;
+    RolloutRunner& operator=(const RolloutRunner&) = delete;
+
+    // inputs[k] is one button mask per frame, latched as that frame starts (Machine::SetInput), result k lands at results + k * ResultSize(addresses)
+    // as the bytes at `addresses` in that order, or WRAM and HRAM when there are none
+    // blocks until all of them ran, the pool has to be otherwise idle, this waits for everything on it
+    RolloutStats Run(const std::vector<uint8_t>& start_state, const std::vector<std::vector<uint8_t>>& inputs,
+        const std::vector<uint16_t>& addresses, uint8_t* results);
+
+    static std::size_t ResultSize(const std::vector<uint16_t>& addresses);
+private:
+    struct alignas(64) Worker
+    {
+        Machine* machine;
+        bool used; // ran a rollout this call, the next one has to rewind first
+        uint64_t rollouts;
+        uint64_t frames;
+        uint64_t full_loads;
+        uint64_t pages_restored;
+    };
+
+    void RunWorker(Worker& worker, const std::vector<std::vector<uint8_t>>& inputs,
+        const std::vector<uint16_t>& addresses, uint8_t* results);
+    static void WriteResult(const Memory& memory, const std::vector<uint16_t>& addresses, uint8_t* out);
+
+    WorkStealingPool& m_Pool;
+    ForkServer forks;
+    std::vector<Worker> workers;
+    std::atomic<std::size_t> next_rollout; // workers take the next sequence from here, long ones don't hold anyone up
+};
@@ -0,0 +1,110 @@
+#include "save-state.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    void Put32(uint8_t* dest, uint32_t val)
+    {
+        std::memcpy(dest, &val, sizeof(val));
+    }
+
+    uint32_t Get32(const uint8_t* src)
+    {
+        uint32_t val;
+        std::memcpy(&val, src, sizeof(val));
+        return val;
+    }
+}
+
+StateWriter::StateWriter(std::vector<uint8_t>& buffer): m_Buffer(buffer)
+{
+    m_Buffer.resize(SAVE_STATE_HEADER_SIZE);
+    std::memcpy(m_Buffer.data(), SAVE_STATE_MAGIC, 4);
+    Put32(m_Buffer.data() + 4, SAVE_STATE_VERSION);
+}
+
+void StateWriter::WriteChunk(const char* tag, const void* data, std::size_t size)
+{
+    const std::size_t offset = m_Buffer.size();
+    m_Buffer.resize(offset + SAVE_STATE_CHUNK_HEADER_SIZE + size);
+
+    uint8_t* chunk = m_Buffer.data() + offset;
+    std::memcpy(chunk, tag, 4);
+    Put32(chunk + 4, static_cast<uint32_t>(size));
+    std::memcpy(chunk + SAVE_STATE_CHUNK_HEADER_SIZE, data, size);
+}
+
+StateReader::StateReader(const uint8_t* data, std::size_t size): data(data), size(size), pos(SAVE_STATE_HEADER_SIZE)
+{
+    if (size < SAVE_STATE_HEADER_SIZE || std::memcmp(data, SAVE_STATE_MAGIC, 4) != 0)
+        throw std::runtime_error("StateReader: not a save state");
+
+    const uint32_t version = Get32(data + 4);
+    if (version != SAVE_STATE_VERSION)
+        throw std::runtime_error("StateReader: save state version " + std::to_string(version) +
+            " doesn't match " + std::to_string(SAVE_STATE_VERSION));
+
+    for (std::size_t offset = SAVE_STATE_HEADER_SIZE; offset < size;)
+    {
+        if (size - offset < SAVE_STATE_CHUNK_HEADER_SIZE || size - offset - SAVE_STATE_CHUNK_HEADER_SIZE < Get32(data + offset + 4))
+            throw std::runtime_error("StateReader: save state is truncated");
+
+        offset += SAVE_STATE_CHUNK_HEADER_SIZE + Get32(data + offset + 4);
+    }
+}
+
+StateReader::StateReader(const std::vector<uint8_t>& buffer): StateReader(buffer.data(), buffer.size())
+{
+}
+
+StateLayout StateReader::Layout() const
+{
+    StateLayout layout;
+    for (std::size_t offset = pos; offset < size; offset += SAVE_STATE_CHUNK_HEADER_SIZE + Get32(data + offset + 4))
+    {
+        StateChunkHeader header;
+        std::memcpy(header.tag, data + offset, 4);
+        header.size = Get32(data + offset + 4);
+        layout.push_back(header);
+    }
+    return layout;
+}
+
+void StateReader::Expect(const StateLayout& layout) const
+{
+    std::size_t offset = pos;
+    for (const StateChunkHeader& header : layout)
+    {
+        CheckChunk(offset, header.tag, header.size);
+        offset += SAVE_STATE_CHUNK_HEADER_SIZE + header.size;
+    }
+}
+
+void StateReader::CheckChunk(std::size_t offset, const char* tag, std::size_t size) const
+{
+    if (offset >= this->size)
+        throw std::runtime_error(std::string("StateReader: missing chunk ") + std::string(tag, 4));
+
+    const uint8_t* chunk = data + offset;
+    if (std::memcmp(chunk, tag, 4) != 0)
+        throw std::runtime_error(std::string("StateReader: expected chunk ") + std::string(tag, 4) +
+            ", found " + std::string(reinterpret_cast<const char*>(chunk), 4));
+
+    if (Get32(chunk + 4) != size)
+        throw std::runtime_error(std::string("StateReader: chunk ") + std::string(tag, 4) + " has the wrong size");
+}
+
+void StateReader::ReadChunk(const char* tag, void* dest, std::size_t size)
+{
+    CheckChunk(pos, tag, size);
+    std::memcpy(dest, data + pos + SAVE_STATE_CHUNK_HEADER_SIZE, size);
+    pos += SAVE_STATE_CHUNK_HEADER_SIZE + size;
+}
+
+bool StateReader::AtEnd() const
+{
+    return pos >= size;
+}
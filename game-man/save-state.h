@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#define SAVE_STATE_MAGIC "GMSS"
+// bump whenever any of the serialized state structs changes shape
+#define SAVE_STATE_VERSION 3
+#define SAVE_STATE_HEADER_SIZE 8 // magic + version
+#define SAVE_STATE_CHUNK_HEADER_SIZE 8 // tag + size
+
+// layout: magic, u32 version, then chunks of (4 char tag, u32 size, bytes)
+// every component dumps its plain data state struct as one chunk, no per-field encoding,
+// which also means save states are only good on hosts with the same endianness and struct layout
+class StateWriter
+{
+public:
+    // clears the buffer but keeps its capacity, so saving into the same one again doesn't allocate
+    explicit StateWriter(std::vector<uint8_t>& buffer);
+
+    void WriteChunk(const char* tag, const void* data, std::size_t size);
+
+    template <typename T>
+    void Write(const char* tag, const T& data)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "only plain data goes into save states");
+        WriteChunk(tag, &data, sizeof(T));
+    }
+private:
+    std::vector<uint8_t>& m_Buffer;
+};
+
+// a chunk without its bytes
+struct StateChunkHeader
+{
+    char tag[4];
+    uint32_t size;
+};
+
+// the chunks a LoadState is going to ask for, in order
+using StateLayout = std::vector<StateChunkHeader>;
+
+// chunks are read back in the order they were written, each one has to match in tag and size
+// the whole buffer is checked up front, a bad version or a truncated file throws before anything is loaded
+class StateReader
+{
+public:
+    StateReader(const uint8_t* data, std::size_t size);
+    explicit StateReader(const std::vector<uint8_t>& buffer);
+
+    // the chunks from here to the end
+    StateLayout Layout() const;
+    // throws like ReadChunk would if the next chunks don't start with these, without reading anything
+    // more chunks after them are fine, that's up to whoever reads them
+    void Expect(const StateLayout& layout) const;
+
+    void ReadChunk(const char* tag, void* dest, std::size_t size);
+
+    template <typename T>
+    void Read(const char* tag, T& data)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "only plain data comes out of save states");
+        ReadChunk(tag, &data, sizeof(T));
+    }
+
+    bool AtEnd() const;
+private:
+    void CheckChunk(std::size_t offset, const char* tag, std::size_t size) const;
+
+    const uint8_t* data;
+    std::size_t size;
+    std::size_t pos;
+};
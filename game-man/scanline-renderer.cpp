@@ -0,0 +1,129 @@
+#include "scanline-renderer.h"
+
+#include <algorithm>
+#include <iterator>
+
+ScanlineRenderer::ScanlineRenderer(): window_line(0), bg_color_index{}
+{
+}
+
+uint8_t ScanlineRenderer::TilePixel(const uint8_t* vram, uint16_t tile_address, uint8_t row, uint8_t column)
+{
+    // 2 bytes per row, low bit plane first, leftmost pixel is bit 7
+    const uint8_t low = vram[tile_address + row * 2];
+    const uint8_t high = vram[tile_address + row * 2 + 1];
+    const uint8_t bit = 7 - column;
+
+    return static_cast<uint8_t>((((high >> bit) & 1) << 1) | ((low >> bit) & 1));
+}
+
+uint16_t ScanlineRenderer::BgTileAddress(uint8_t lcdc, uint8_t tile_index)
+{
+    // LCDC bit 4 picks between 0x8000 unsigned and 0x8800 (0x9000 based) signed addressing
+    if ((lcdc & 0b00010000) == 0b00010000)
+        return tile_index * 16;
+
+    return static_cast<uint16_t>(0x1000 + static_cast<int8_t>(tile_index) * 16);
+}
+
+void ScanlineRenderer::RenderLine(const ScanlineRegisters& regs, const uint8_t* vram, const uint8_t* oam, uint8_t* line_out)
+{
+    if (regs.ly == 0)
+        window_line = 0;
+
+    const bool bg_enabled = (regs.lcdc & 0b00000001) == 0b00000001;
+
+    if (bg_enabled)
+    {
+        const uint16_t bg_map = (regs.lcdc & 0b00001000) == 0b00001000 ? 0x1C00 : 0x1800;
+        const uint8_t y = regs.scy + regs.ly;
+
+        for (int x = 0; x < LCD_WIDTH; ++x)
+        {
+            const uint8_t map_x = static_cast<uint8_t>(regs.scx + x);
+            const uint8_t tile_index = vram[bg_map + (y / 8) * 32 + map_x / 8];
+            bg_color_index[x] = TilePixel(vram, BgTileAddress(regs.lcdc, tile_index), y & 7, map_x & 7);
+        }
+
+        // window is drawn over bg, on DMG only when bg is enabled too
+        const bool window_enabled = (regs.lcdc & 0b00100000) == 0b00100000;
+        if (window_enabled && regs.ly >= regs.wy && regs.wx <= 166)
+        {
+            const uint16_t window_map = (regs.lcdc & 0b01000000) == 0b01000000 ? 0x1C00 : 0x1800;
+            const int window_start = regs.wx - 7;
+
+            for (int x = std::max(window_start, 0); x < LCD_WIDTH; ++x)
+            {
+                const int window_x = x - window_start;
+                const uint8_t tile_index = vram[window_map + (window_line / 8) * 32 + window_x / 8];
+                bg_color_index[x] = TilePixel(vram, BgTileAddress(regs.lcdc, tile_index), window_line & 7, window_x & 7);
+            }
+
+            ++window_line;
+        }
+    }
+    else
+    {
+        std::fill(std::begin(bg_color_index), std::end(bg_color_index), 0);
+    }
+
+    for (int x = 0; x < LCD_WIDTH; ++x)
+    {
+        line_out[x] = (regs.bgp >> (bg_color_index[x] * 2)) & 0b11;
+    }
+
+    if ((regs.lcdc & 0b00000010) == 0b00000010)
+        RenderSprites(regs, vram, oam, line_out);
+}
+
+void ScanlineRenderer::InvalidateSprites()
+{
+    sprite_index.Invalidate();
+}
+
+void ScanlineRenderer::RenderSprites(const ScanlineRegisters& regs, const uint8_t* vram, const uint8_t* oam, uint8_t* line_out)
+{
+    const uint8_t height = (regs.lcdc & 0b00000100) == 0b00000100 ? 16 : 8;
+
+    const uint8_t* selected;
+    const uint8_t selected_count = sprite_index.SpritesOnLine(oam, height, regs.ly, selected);
+
+    bool claimed[LCD_WIDTH] = {};
+    for (uint8_t s = 0; s < selected_count; ++s)
+    {
+        const uint8_t* sprite = oam + selected[s] * 4;
+        const int sprite_x = sprite[1] - 8;
+        const uint8_t attributes = sprite[3];
+
+        uint8_t row = static_cast<uint8_t>(regs.ly - (sprite[0] - 16));
+        if ((attributes & 0b01000000) == 0b01000000) // Y flip
+            row = height - 1 - row;
+
+        uint8_t tile_index = sprite[2];
+        if (height == 16)
+            tile_index &= 0xFE;
+        const uint16_t tile_address = tile_index * 16 + (row / 8) * 16;
+
+        const uint8_t palette = (attributes & 0b00010000) == 0b00010000 ? regs.obp1 : regs.obp0;
+        const bool behind_bg = (attributes & 0b10000000) == 0b10000000;
+
+        for (uint8_t column = 0; column < 8; ++column)
+        {
+            const int x = sprite_x + column;
+            if (x < 0 || x >= LCD_WIDTH || claimed[x])
+                continue;
+
+            const uint8_t pixel_column = (attributes & 0b00100000) == 0b00100000 ? 7 - column : column; // X flip
+            const uint8_t color = TilePixel(vram, tile_address, row & 7, pixel_column);
+            if (color == 0)
+                continue;
+
+            // an opaque pixel of a higher priority sprite hides lower ones even if it loses to bg
+            claimed[x] = true;
+            if (behind_bg && bg_color_index[x] != 0)
+                continue;
+
+            line_out[x] = (palette >> (color * 2)) & 0b11;
+        }
+    }
+}
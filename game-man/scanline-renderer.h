@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+
+#include "lcd.h"
+#include "sprite-index.h"
+
+// offsets are relative to the start of the region, end is exclusive
+struct DirtyRange
+{
+    uint16_t begin;
+    uint16_t end;
+
+    bool Empty() const
+    {
+        return begin >= end;
+    }
+};
+
+// everything a single line needs from the io registers, captured when the line is drawn
+struct ScanlineRegisters
+{
+    uint8_t ly;
+    uint8_t lcdc;
+    uint8_t scy;
+    uint8_t scx;
+    uint8_t wy;
+    uint8_t wx;
+    uint8_t bgp;
+    uint8_t obp0;
+    uint8_t obp1;
+};
+
+// turns register snapshot + vram + oam into 160 shades (0-3) of one line
+// lines have to come in order within a frame, the window line counter depends on it
+class ScanlineRenderer
+{
+public:
+    ScanlineRenderer();
+    void RenderLine(const ScanlineRegisters& regs, const uint8_t* vram, const uint8_t* oam, uint8_t* line_out);
+    // has to be called whenever the oam passed to RenderLine changes
+    void InvalidateSprites();
+private:
+    static uint8_t TilePixel(const uint8_t* vram, uint16_t tile_address, uint8_t row, uint8_t column);
+    static uint16_t BgTileAddress(uint8_t lcdc, uint8_t tile_index);
+
+    void RenderSprites(const ScanlineRegisters& regs, const uint8_t* vram, const uint8_t* oam, uint8_t* line_out);
+
+    SpriteIndex sprite_index;
+    uint8_t window_line;
+    uint8_t bg_color_index[LCD_WIDTH]; // pre-palette bg colors, sprite priority needs them
+};
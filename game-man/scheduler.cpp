@@ -0,0 +1,99 @@
+#include "scheduler.h"
+
+#include <cstring>
+#include <stdexcept>
+
+Scheduler::Scheduler(): now(0), next_event(SCHEDULER_NEVER), clients{}
+{
+    for (auto& event_cycle : event_cycles)
+    {
+        event_cycle = SCHEDULER_NEVER;
+    }
+}
+
+void Scheduler::SetClient(EventType type, SchedulerClient& client)
+{
+    clients[static_cast<uint8_t>(type)] = &client;
+}
+
+void Scheduler::Schedule(EventType type, uint64_t cycle)
+{
+    if (clients[static_cast<uint8_t>(type)] == nullptr)
+        throw std::runtime_error("Scheduler::Schedule - no client for event type");
+
+    event_cycles[static_cast<uint8_t>(type)] = cycle;
+    UpdateNextEvent();
+}
+
+void Scheduler::Cancel(EventType type)
+{
+    event_cycles[static_cast<uint8_t>(type)] = SCHEDULER_NEVER;
+    UpdateNextEvent();
+}
+
+bool Scheduler::IsScheduled(EventType type) const
+{
+    return event_cycles[static_cast<uint8_t>(type)] != SCHEDULER_NEVER;
+}
+
+uint64_t Scheduler::ScheduledAt(EventType type) const
+{
+    return event_cycles[static_cast<uint8_t>(type)];
+}
+
+void Scheduler::RunDueEvents()
+{
+    // handlers may schedule more events, also ones that are already due, so look again after each
+    while (next_event <= now)
+    {
+        uint8_t due = 0;
+        for (uint8_t i = 1; i < static_cast<uint8_t>(EventType::Count); ++i)
+        {
+            if (event_cycles[i] < event_cycles[due])
+                due = i;
+        }
+
+        const uint64_t cycle = event_cycles[due];
+        event_cycles[due] = SCHEDULER_NEVER;
+        UpdateNextEvent();
+
+        clients[due]->OnEvent(static_cast<EventType>(due), cycle);
+    }
+}
+
+void Scheduler::UpdateNextEvent()
+{
+    next_event = SCHEDULER_NEVER;
+    for (const auto event_cycle : event_cycles)
+    {
+        if (event_cycle < next_event)
+            next_event = event_cycle;
+    }
+}
+
+namespace
+{
+    struct SchedulerState
+    {
+        uint64_t now;
+        uint64_t event_cycles[static_cast<uint8_t>(EventType::Count)];
+    };
+}
+
+void Scheduler::SaveState(StateWriter& writer) const
+{
+    SchedulerState saved;
+    std::memset(&saved, 0, sizeof(saved));
+    saved.now = now;
+    std::memcpy(saved.event_cycles, event_cycles, sizeof(event_cycles));
+    writer.Write("SCHD", saved);
+}
+
+void Scheduler::LoadState(StateReader& reader)
+{
+    SchedulerState saved;
+    reader.Read("SCHD", saved);
+    now = saved.now;
+    std::memcpy(event_cycles, saved.event_cycles, sizeof(event_cycles));
+    UpdateNextEvent();
+}
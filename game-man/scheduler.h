@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+
+#include "save-state.h"
+
+#define GB_CLOCK 4194304
+#define SCHEDULER_NEVER std::numeric_limits<uint64_t>::max()
+
+// every timed thing in the machine, each one can be pending at most once
+enum class EventType : uint8_t
+{
+    PpuMode,
+    OamDma,
+    TimerOverflow,
+    ApuFrameSequencer,
+    Count
+};
+
+class SchedulerClient
+{
+public:
+    virtual ~SchedulerClient() = default;
+    // cycle is when the event was due, Now() may already be a few cycles past it
+    virtual void OnEvent(EventType type, uint64_t cycle) = 0;
+};
+
+// global cycle counter + the few events that are due next, instead of every component
+// looking at the clock after every instruction only the earliest event gets compared against
+class Scheduler
+{
+public:
+    Scheduler();
+
+    void SetClient(EventType type, SchedulerClient& client);
+    void Schedule(EventType type, uint64_t cycle);
+    void Cancel(EventType type);
+    bool IsScheduled(EventType type) const;
+    uint64_t ScheduledAt(EventType type) const;
+
+    // clients aren't part of it, they connect themselves when the machine is built
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+
+    uint64_t Now() const
+    {
+        return now;
+    }
+
+    // the only thing the cpu does per instruction
+    void Advance(uint8_t cycles)
+    {
+        now += cycles;
+        if (now >= next_event)
+            RunDueEvents();
+    }
+private:
+    void RunDueEvents();
+    void UpdateNextEvent();
+
+    uint64_t now;
+    uint64_t next_event;
+    uint64_t event_cycles[static_cast<uint8_t>(EventType::Count)];
+    SchedulerClient* clients[static_cast<uint8_t>(EventType::Count)];
+};
@@ -0,0 +1,54 @@
+#include "sprite-index.h"
+
+#include <algorithm>
+#include <iterator>
+
+SpriteIndex::SpriteIndex(): line_sprites{}, line_counts{}, built_height(8), dirty(true)
+{
+}
+
+void SpriteIndex::Invalidate()
+{
+    dirty = true;
+}
+
+uint8_t SpriteIndex::SpritesOnLine(const uint8_t* oam, uint8_t height, uint8_t ly, const uint8_t*& sprites)
+{
+    // LCDC bit 2 changes which lines a sprite covers, so it's part of the key too
+    if (dirty || height != built_height)
+        Rebuild(oam, height);
+
+    sprites = line_sprites[ly];
+    return line_counts[ly];
+}
+
+void SpriteIndex::Rebuild(const uint8_t* oam, uint8_t height)
+{
+    std::fill(std::begin(line_counts), std::end(line_counts), 0);
+
+    // hardware picks the first 10 in OAM order that cover a line
+    for (uint8_t i = 0; i < OAM_SPRITE_COUNT; ++i)
+    {
+        const int sprite_y = oam[i * 4] - 16;
+        const int first_line = std::max(sprite_y, 0);
+        const int last_line = std::min(sprite_y + height, LCD_HEIGHT);
+
+        for (int line = first_line; line < last_line; ++line)
+        {
+            if (line_counts[line] < MAX_SPRITES_PER_LINE)
+                line_sprites[line][line_counts[line]++] = i;
+        }
+    }
+
+    // draw priority, lower X first, OAM order on ties
+    for (int line = 0; line < LCD_HEIGHT; ++line)
+    {
+        std::stable_sort(line_sprites[line], line_sprites[line] + line_counts[line], [oam](uint8_t first, uint8_t second)
+        {
+            return oam[first * 4 + 1] < oam[second * 4 + 1];
+        });
+    }
+
+    built_height = height;
+    dirty = false;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+
+#include "lcd.h"
+
+// which sprites end up on which line, worked out once per OAM change instead of scanning
+// all 40 entries on every line, each line is then a single table lookup
+class SpriteIndex
+{
+public:
+    SpriteIndex();
+
+    // OAM was written (directly or by DMA), next lookup rebuilds
+    void Invalidate();
+
+    // up to 10 OAM indexes covering ly, already in draw priority order (lower X first, OAM order on ties)
+    uint8_t SpritesOnLine(const uint8_t* oam, uint8_t height, uint8_t ly, const uint8_t*& sprites);
+private:
+    void Rebuild(const uint8_t* oam, uint8_t height);
+
+    uint8_t line_sprites[LCD_HEIGHT][MAX_SPRITES_PER_LINE];
+    uint8_t line_counts[LCD_HEIGHT];
+    uint8_t built_height;
+    bool dirty;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// single producer, single consumer lock-free ring
+// one thread may only push, one other thread may only pop, neither ever blocks
+template <typename T, std::size_t Capacity>
+class SpscRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscRing capacity has to be a power of two");
+public:
+    SpscRing() : head(0), tail(0)
+    {
+    }
+
+    // producer side, returns false when full, the item is then not queued
+    bool TryPush(const T& item)
+    {
+        const std::size_t current_head = head.load(std::memory_order_relaxed);
+        if (current_head - tail.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        items[current_head & (Capacity - 1)] = item;
+        head.store(current_head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, returns false when empty
+    bool TryPop(T& item)
+    {
+        const std::size_t current_tail = tail.load(std::memory_order_relaxed);
+        if (current_tail == head.load(std::memory_order_acquire))
+            return false;
+
+        item = items[current_tail & (Capacity - 1)];
+        tail.store(current_tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // only exact from the producer or the consumer thread, anything else gets a hint
+    std::size_t Size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    std::size_t FreeSpace() const
+    {
+        return Capacity - Size();
+    }
+
+private:
+    // head and tail live on their own cache lines so the two threads don't fight over them
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+    alignas(64) T items[Capacity];
+};
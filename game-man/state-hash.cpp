@@ -0,0 +1,239 @@
+#include "state-hash.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) && !defined(STATE_HASH_NO_SIMD)
+#define STATE_HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // xxh3 style: 64 byte stripes over 8 accumulators, each one takes (data ^ key) lo32 * hi32 plus its neighbour's data,
+    // every 16 stripes they get scrambled so long inputs don't just add up
+    constexpr std::size_t STRIPE_SIZE = 64;
+    constexpr std::size_t STRIPES_PER_BLOCK = 16;
+    constexpr uint64_t PRIME32 = 0x9E3779B1ULL;
+    constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+
+    alignas(16) constexpr uint64_t STRIPE_KEYS[8] = {
+        0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+        0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL
+    };
+    alignas(16) constexpr uint64_t SCRAMBLE_KEYS[8] = {
+        0xCB00C391BB52283CULL, 0xA32E531B8B65D088ULL, 0x4EF90DA297486471ULL, 0xD8ACDEA946EF1938ULL,
+        0x3F349CE33F76FAA8ULL, 0x1D4F0BC7C7BBDCF9ULL, 0x3159B4CD4BE0518AULL, 0x647378D9C97E9FC8ULL
+    };
+
+    uint64_t Load64(const uint8_t* bytes)
+    {
+        uint64_t val = 0;
+        for (int i = 7; i >= 0; --i)
+            val = (val << 8) | bytes[i];
+        return val;
+    }
+
+    uint64_t Mix(uint64_t val)
+    {
+        val ^= val >> 33;
+        val *= PRIME64_2;
+        val ^= val >> 29;
+        val *= PRIME64_1;
+        val ^= val >> 32;
+        return val;
+    }
+
+#ifdef STATE_HASH_SSE2
+    struct Sse2Accumulators
+    {
+        __m128i lanes[4];
+
+        void Init()
+        {
+            for (int i = 0; i < 4; ++i)
+                lanes[i] = _mm_set_epi64x(static_cast<long long>(PRIME64_1 * (2 * i + 2)), static_cast<long long>(PRIME64_1 * (2 * i + 1)));
+        }
+
+        void Stripe(const uint8_t* data)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                const __m128i val = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data) + i);
+                const __m128i keyed = _mm_xor_si128(val, _mm_load_si128(reinterpret_cast<const __m128i*>(STRIPE_KEYS) + i));
+                // hi32 of every 64 bit lane down into lo32, then lo * hi per lane
+                const __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+                const __m128i swapped = _mm_shuffle_epi32(val, _MM_SHUFFLE(1, 0, 3, 2));
+                lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+            }
+        }
+
+        void Scramble()
+        {
+            const __m128i prime = _mm_set1_epi32(static_cast<int>(PRIME32));
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128i acc = _mm_xor_si128(lanes[i], _mm_srli_epi64(lanes[i], 47));
+                acc = _mm_xor_si128(acc, _mm_load_si128(reinterpret_cast<const __m128i*>(SCRAMBLE_KEYS) + i));
+                // 64 x 32 bit multiply out of two 32 x 32 ones
+                const __m128i low = _mm_mul_epu32(acc, prime);
+                const __m128i high = _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(acc, 32), prime), 32);
+                lanes[i] = _mm_add_epi64(low, high);
+            }
+        }
+
+        void Store(uint64_t* out) const
+        {
+            for (int i = 0; i < 4; ++i)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + i, lanes[i]);
+        }
+    };
+#endif
+
+    // the reference, the SSE2 version has to come out the same
+    struct ScalarAccumulators
+    {
+        uint64_t lanes[8];
+
+        void Init()
+        {
+            for (int i = 0; i < 8; ++i)
+                lanes[i] = PRIME64_1 * (i + 1);
+        }
+
+        void Stripe(const uint8_t* data)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                const uint64_t val = Load64(data + i * 8);
+                const uint64_t keyed = val ^ STRIPE_KEYS[i];
+                lanes[i ^ 1] += val;
+                lanes[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+            }
+        }
+
+        void Scramble()
+        {
+            for (int i = 0; i < 8; ++i)
+                lanes[i] = (lanes[i] ^ (lanes[i] >> 47) ^ SCRAMBLE_KEYS[i]) * PRIME32;
+        }
+
+        void Store(uint64_t* out) const
+        {
+            std::memcpy(out, lanes, sizeof(lanes));
+        }
+    };
+
+    template <typename Accumulators>
+    uint64_t HashWith(const void* data, std::size_t size, uint64_t seed)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        Accumulators acc;
+        acc.Init();
+
+        std::size_t stripes = 0;
+        auto next_stripe = [&](const uint8_t* stripe)
+        {
+            acc.Stripe(stripe);
+            if (++stripes % STRIPES_PER_BLOCK == 0)
+                acc.Scramble();
+        };
+
+        std::size_t pos = 0;
+        for (; pos + STRIPE_SIZE <= size; pos += STRIPE_SIZE)
+            next_stripe(bytes + pos);
+        if (pos < size)
+        {
+            // the tail goes in zero padded, the length at the end keeps "ab" and "ab\0" apart
+            uint8_t last[STRIPE_SIZE] = {};
+            std::memcpy(last, bytes + pos, size - pos);
+            next_stripe(last);
+        }
+
+        uint64_t lanes[8];
+        acc.Store(lanes);
+        uint64_t hash = seed ^ (static_cast<uint64_t>(size) * PRIME64_1);
+        for (int i = 0; i < 8; ++i)
+            hash = (hash ^ Mix(lanes[i] ^ STRIPE_KEYS[i])) * PRIME64_2;
+        return Mix(hash);
+    }
+}
+
+uint64_t StateHash64(const void* data, std::size_t size, uint64_t seed)
+{
+#ifdef STATE_HASH_SSE2
+    return HashWith<Sse2Accumulators>(data, size, seed);
+#else
+    return HashWith<ScalarAccumulators>(data, size, seed);
+#endif
+}
+
+uint64_t StateHash64Scalar(const void* data, std::size_t size, uint64_t seed)
+{
+    return HashWith<ScalarAccumulators>(data, size, seed);
+}
+
+uint64_t FrameHasher::Hash(Machine& machine)
+{
+    StateWriter writer(devices);
+    machine.GetCpu().SaveState(writer, false);
+    uint64_t hash = StateHash64(devices.data(), devices.size());
+    hash = StateHash64(machine.GetMemory().PeekPtrAt(0x8000), 0x8000, hash);
+
+    // versions are unique process wide, a cached hash is right whatever machine it came from
+    const Cartridge& cartridge = machine.GetCartridge();
+    ram_banks.resize(cartridge.RamBankCount(), RamBankHash{ 0, 0 });
+    for (std::size_t bank = 0; bank < ram_banks.size(); ++bank)
+    {
+        const uint64_t version = cartridge.RamBankVersion(bank);
+        if (ram_banks[bank].version != version)
+            ram_banks[bank] = { version, StateHash64(cartridge.RamBank(bank), cartridge.RamBankSize()) };
+        hash = Mix(hash ^ ram_banks[bank].hash);
+    }
+    return hash;
+}
+
+void FrameHashLog::Save(std::string const& path) const
+{
+    std::vector<uint8_t> out(HASH_LOG_HEADER_SIZE + hashes.size() * 8);
+    std::memcpy(out.data(), HASH_LOG_MAGIC, 4);
+    auto put = [&out](std::size_t pos, uint64_t val, int size)
+    {
+        for (int i = 0; i < size; ++i)
+            out[pos + i] = static_cast<uint8_t>(val >> (i * 8));
+    };
+    put(4, HASH_LOG_VERSION, 4);
+    put(8, first_frame, 8);
+    for (std::size_t i = 0; i < hashes.size(); ++i)
+        put(HASH_LOG_HEADER_SIZE + i * 8, hashes[i], 8);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.write(reinterpret_cast<const char*>(out.data()), out.size()))
+        throw std::runtime_error("FrameHashLog couldn't write " + path + ": " + std::strerror(errno));
+}
+
+FrameHashLog FrameHashLog::Load(std::string const& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("FrameHashLog couldn't open " + path + ": " + std::strerror(errno));
+
+    const std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (in.size() < HASH_LOG_HEADER_SIZE || std::memcmp(in.data(), HASH_LOG_MAGIC, 4) != 0)
+        throw std::runtime_error("FrameHashLog " + path + " is not a hash log");
+    if (static_cast<uint32_t>(Load64(in.data() + 4)) != HASH_LOG_VERSION)
+        throw std::runtime_error("FrameHashLog " + path + " has an unsupported version");
+    if ((in.size() - HASH_LOG_HEADER_SIZE) % 8 != 0)
+        throw std::runtime_error("FrameHashLog " + path + " is truncated");
+
+    FrameHashLog log;
+    log.first_frame = Load64(in.data() + 8);
+    log.hashes.resize((in.size() - HASH_LOG_HEADER_SIZE) / 8);
+    for (std::size_t i = 0; i < log.hashes.size(); ++i)
+        log.hashes[i] = Load64(in.data() + HASH_LOG_HEADER_SIZE + i * 8);
+    return log;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+
+#define HASH_LOG_MAGIC "GMHL"
+#define HASH_LOG_VERSION 2
+#define HASH_LOG_HEADER_SIZE 16 // magic, u32 version, u64 first frame
+
+// 64 bit, not cryptographic, only there to tell two states apart, SSE2 where the host has it
+// the SIMD and the plain version give the exact same value, so logs from any two hosts compare
+uint64_t StateHash64(const void* data, std::size_t size, uint64_t seed = 0);
+// the plain version whatever the host has, what StateHash64 is checked against
+uint64_t StateHash64Scalar(const void* data, std::size_t size, uint64_t seed = 0);
+
+// one hash over everything that decides what the next frame does: all device state as it goes into a save
+// state without memory (cpu registers, scheduler, ppu, timer, apu, cartridge banking and clock), the writable half
+// of the memory map (vram, cart RAM bank, wram, oam, io, hram) and every cart RAM bank, the ROM half only changes
+// with the bank registers which are in the device state
+// the RAM banks are hashed one by one and only again once their version moves, most frames that's none of them
+// like save states, values only match between builds with the same struct layout
+// doesn't allocate once the scratch buffers have grown, 32 KiB of memory plus the device state per frame, a couple of us
+class FrameHasher
+{
+public:
+    uint64_t Hash(Machine& machine);
+private:
+    struct RamBankHash
+    {
+        uint64_t version;
+        uint64_t hash;
+    };
+
+    std::vector<uint8_t> devices;
+    std::vector<RamBankHash> ram_banks;
+};
+
+// one hash per frame, consecutive frames starting at first_frame
+// on disk: magic, u32 version, u64 first frame, then u64 hashes, all little endian
+struct FrameHashLog
+{
+    uint64_t first_frame = 0;
+    std::vector<uint64_t> hashes;
+
+    void Save(std::string const& path) const;
+    static FrameHashLog Load(std::string const& path);
+};
@@ -0,0 +1,75 @@
+#include "state-publisher.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+StatePublisher::StatePublisher(const std::vector<uint16_t>& addresses): addresses(addresses), sequence(0)
+{
+    if (addresses.size() > STATE_PUBLISHER_MAX_BYTES)
+        throw std::runtime_error("StatePublisher watches at most 256 addresses");
+
+    // padding included, the words are a straight copy of the struct
+    std::memset(&this->next, 0, sizeof(this->next));
+    this->next.byte_count = static_cast<uint16_t>(addresses.size());
+    for (std::atomic<uint64_t>& word : this->words)
+        word.store(0, std::memory_order_relaxed);
+}
+
+void StatePublisher::Publish(const Cpu& cpu, const Memory& memory, uint64_t frame, uint64_t cycles)
+{
+    const uint64_t seq = sequence.load(std::memory_order_relaxed);
+    next.sequence = seq + 2;
+    next.frame = frame;
+    next.cycles = cycles;
+    next.instructions = cpu.InstructionCount();
+    next.registers = cpu.GetRegisters();
+    for (std::size_t i = 0; i < addresses.size(); ++i)
+        next.bytes[i] = *memory.PeekPtrAt(addresses[i]);
+
+    uint64_t payload[WORD_COUNT] = {};
+    std::memcpy(payload, &next, sizeof(next));
+
+    // odd = write in progress, the fence keeps the payload stores from going out before it
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < WORD_COUNT; ++i)
+        words[i].store(payload[i], std::memory_order_relaxed);
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+bool StatePublisher::TryRead(StateSnapshot& out) const
+{
+    const uint64_t before = sequence.load(std::memory_order_acquire);
+    if (before == 0 || (before & 1) != 0)
+        return false;
+
+    uint64_t payload[WORD_COUNT];
+    for (std::size_t i = 0; i < WORD_COUNT; ++i)
+        payload[i] = words[i].load(std::memory_order_relaxed);
+
+    // the loads above can't sink below the second sequence read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) != before)
+        return false;
+
+    std::memcpy(&out, payload, sizeof(out));
+    return true;
+}
+
+StateSnapshot StatePublisher::Read() const
+{
+    StateSnapshot snapshot;
+    while (!TryRead(snapshot))
+    {
+        // nothing published yet is not going to change by spinning harder
+        if (sequence.load(std::memory_order_relaxed) == 0)
+            std::this_thread::yield();
+    }
+    return snapshot;
+}
+
+uint64_t StatePublisher::Sequence() const
+{
+    return sequence.load(std::memory_order_relaxed);
+}
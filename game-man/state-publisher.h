@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+
+#define STATE_PUBLISHER_MAX_BYTES 256
+
+// what a reader gets, all of it from the same frame boundary
+struct StateSnapshot
+{
+    uint64_t sequence; // even, goes up by 2 with every publish, 0 = nothing published yet
+    uint64_t frame;
+    uint64_t cycles;
+    uint64_t instructions;
+    CpuRegisters registers;
+    uint16_t byte_count;
+    uint8_t bytes[STATE_PUBLISHER_MAX_BYTES]; // the watched addresses, in the order they were given
+};
+
+// a seqlock over a snapshot of the cpu registers and a few memory bytes, written by the emulation thread at
+// frame boundaries and readable from any number of other threads without locks
+// the writer never waits for anyone, it bumps the sequence to odd, stores the words and bumps it to even again,
+// a reader copies the words and only keeps the copy if the sequence was the same even value on both sides
+// the payload is atomic words too, so a reader racing a publish is a retry and never a data race
+class StatePublisher
+{
+public:
+    // throws past STATE_PUBLISHER_MAX_BYTES addresses
+    // the bytes come straight out of the memory buffer, registers that are only worked out when the cpu reads
+    // them (LY, STAT, DIV, TIMA, the joypad) aren't kept in there and come out stale
+    explicit StatePublisher(const std::vector<uint16_t>& addresses = {});
+
+    StatePublisher(const StatePublisher&) = delete;
+    StatePublisher& operator=(const StatePublisher&) = delete;
+
+    // emulation thread, on an instruction boundary
+    void Publish(const Cpu& cpu, const Memory& memory, uint64_t frame, uint64_t cycles);
+
+    // any thread, false if a publish was going on at the time (or nothing was published yet), out is then garbage
+    bool TryRead(StateSnapshot& out) const;
+    // any thread, retries until it gets a coherent copy, before the first publish it waits for that one
+    StateSnapshot Read() const;
+    uint64_t Sequence() const;
+private:
+    static constexpr std::size_t WORD_COUNT = (sizeof(StateSnapshot) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::vector<uint16_t> addresses;
+
+    // only the emulation thread builds the next snapshot in here
+    StateSnapshot next;
+
+    // readers poll the sequence, it gets a line of its own so the payload stores don't keep knocking it out
+    alignas(64) std::atomic<uint64_t> sequence;
+    alignas(64) std::atomic<uint64_t> words[WORD_COUNT];
+};
@@ -0,0 +1,167 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#include "audio-writer.h"
+#include "machine.h"
+
+namespace
+{
+    // a ramp, waits for the writer whenever the ring is full, gives up once it stops draining
+    void FillRing(AudioSampleRing& ring, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const int16_t val = static_cast<int16_t>(i);
+            for (int waited = 0; !ring.TryPush({ val, static_cast<int16_t>(-val) }); ++waited)
+            {
+                if (waited == 500)
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    // square 1 at full volume on both sides, a 1 kHz-ish tone that never stops
+    std::shared_ptr<const std::vector<uint8_t>> ToneRom()
+    {
+        return TestRom().Entry({
+            OP_LD_A_N, 0x80, OP_LDH_N_A, 0x26, // NR52 power on
+            OP_LD_A_N, 0x77, OP_LDH_N_A, 0x24, // NR50 full master volume
+            OP_LD_A_N, 0x11, OP_LDH_N_A, 0x25, // NR51 square 1 left and right
+            OP_LD_A_N, 0x80, OP_LDH_N_A, 0x11, // NR11 50% duty
+            OP_LD_A_N, 0xF0, OP_LDH_N_A, 0x12, // NR12 volume 15, no envelope
+            OP_LD_A_N, 0x83, OP_LDH_N_A, 0x13, // NR13/NR14 frequency 0x783, trigger
+            OP_LD_A_N, 0x87, OP_LDH_N_A, 0x14,
+            SPIN,
+        }).Build();
+    }
+}
+
+TEST(audio, wav_header_matches_the_samples)
+{
+    const std::string path = TempPath("audio.wav");
+    auto ring = std::make_unique<AudioSampleRing>();
+    uint64_t written = 0;
+    {
+        AudioWriter writer(*ring, path, AudioFileFormat::Wav, APU_SAMPLE_RATE);
+        FillRing(*ring, 3 * AUDIO_WRITER_BUFFER_SAMPLES);
+        writer.Stop();
+        written = writer.SamplesWritten();
+    }
+    CHECK(written > 2 * AUDIO_WRITER_BUFFER_SAMPLES);
+
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CHECK_EQ(bytes.size(), 44 + written * 4);
+    const uint32_t data_size = bytes[40] | bytes[41] << 8 | bytes[42] << 16 | static_cast<uint32_t>(bytes[43]) << 24;
+    CHECK_EQ(data_size, written * 4);
+    std::filesystem::remove(path);
+}
+
+TEST(audio, write_errors_come_back_from_stop)
+{
+    // every write to /dev/full fails, the writer thread has to survive that
+    if (!std::filesystem::exists("/dev/full"))
+        return;
+
+    auto ring = std::make_unique<AudioSampleRing>();
+    AudioWriter writer(*ring, "/dev/full", AudioFileFormat::RawPcm, APU_SAMPLE_RATE);
+    FillRing(*ring, 3 * AUDIO_WRITER_BUFFER_SAMPLES);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_THROWS(writer.Stop());
+    CHECK_EQ(writer.SamplesWritten(), 0u);
+    writer.Stop();
+}
+
+TEST(audio, a_slow_consumer_holds_the_emulation_back)
+{
+    // drains at about twice real time in bursts, far slower than the emulation runs unthrottled
+    struct SlowConsumer : AudioSampleConsumer
+    {
+        std::atomic<uint64_t> full_count{ 0 };
+        void OnRingFull() override
+        {
+            full_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    Machine machine(ToneRom());
+    AudioSampleRing& ring = machine.GetApu().Samples();
+    SlowConsumer consumer;
+    std::atomic<bool> running(true);
+    uint64_t popped = 0;
+    std::thread drain([&]()
+    {
+        AudioSample sample;
+        while (running.load())
+        {
+            for (int i = 0; i < 256 && ring.TryPop(sample); ++i)
+                ++popped;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        while (ring.TryPop(sample))
+            ++popped;
+    });
+
+    machine.GetApu().AttachConsumer(&consumer);
+    for (int frame = 0; frame < 120; ++frame)
+        machine.RunFrame();
+    machine.GetApu().AttachConsumer(nullptr);
+    running.store(false);
+    drain.join();
+
+    CHECK_EQ(machine.GetApu().DroppedSamples(), 0u);
+    CHECK(consumer.full_count.load() > 0);
+    CHECK(popped + APU_FRAME_SEQUENCER_CYCLES / APU_CYCLES_PER_SAMPLE >= machine.Cycles() / APU_CYCLES_PER_SAMPLE);
+}
+
+TEST(audio, unthrottled_recording_drops_nothing)
+{
+    // the emulation runs far faster than real time here, attached to the Apu the writer has to hold it back
+    const std::string path = TempPath("audio-unthrottled.raw");
+    Machine machine(ToneRom());
+    uint64_t written = 0;
+    {
+        AudioWriter writer(machine.GetApu(), path, AudioFileFormat::RawPcm, 48000);
+        for (int frame = 0; frame < 600; ++frame)
+            machine.RunFrame();
+        writer.Stop();
+        written = writer.SamplesWritten();
+    }
+    CHECK_EQ(machine.GetApu().DroppedSamples(), 0u);
+
+    // every native sample went through, one output per 131072 / 48000 of them
+    // the APU only synthesizes up to its last frame sequencer step, so up to one step's worth is still missing
+    const uint64_t expected = machine.Cycles() / APU_CYCLES_PER_SAMPLE * 48000 / APU_SAMPLE_RATE;
+    const uint64_t last_step = APU_FRAME_SEQUENCER_CYCLES / APU_CYCLES_PER_SAMPLE * 48000 / APU_SAMPLE_RATE + 1;
+    CHECK(written + last_step >= expected && written <= expected + 1);
+
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CHECK_EQ(bytes.size(), written * 4);
+    int peak = 0;
+    for (std::size_t i = 0; i + 1 < bytes.size(); i += 2)
+        peak = std::max(peak, std::abs(static_cast<int16_t>(bytes[i] | bytes[i + 1] << 8)));
+    CHECK(peak > 1000);
+    std::filesystem::remove(path);
+}
+
+TEST(audio, a_failed_writer_lets_the_emulation_go_on)
+{
+    if (!std::filesystem::exists("/dev/full"))
+        return;
+
+    // once the writer thread is gone nothing drains the ring, the APU has to go back to dropping
+    Machine machine(ToneRom());
+    AudioWriter writer(machine.GetApu(), "/dev/full", AudioFileFormat::RawPcm, 48000);
+    for (int frame = 0; frame < 600; ++frame)
+        machine.RunFrame();
+    CHECK(machine.GetApu().DroppedSamples() > 0);
+    CHECK_THROWS(writer.Stop());
+}
@@ -0,0 +1,78 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "battery-saver.h"
+#include "machine.h"
+
+namespace
+{
+    constexpr std::chrono::hours NEVER(1);
+}
+
+TEST(battery, submits_coalesce_into_one_write)
+{
+    const std::string path = TempPath("battery-coalesce.sav");
+    std::filesystem::remove(path);
+    BatterySaver saver(path, NEVER);
+    saver.Submit(std::vector<uint8_t>(16, 1));
+    saver.Submit(std::vector<uint8_t>(16, 2));
+    saver.Flush();
+    CHECK_EQ(saver.Flushes(), 1u);
+
+    std::vector<uint8_t> ram(16, 0);
+    CHECK(saver.Load(ram));
+    CHECK(ram == std::vector<uint8_t>(16, 2));
+    saver.Stop();
+    std::filesystem::remove(path);
+}
+
+TEST(battery, write_errors_come_back_from_flush)
+{
+    // nowhere to put the temp file, the flush thread has to survive that
+    const std::string path = TempPath("battery-missing-dir/game.sav");
+    BatterySaver saver(path, NEVER);
+    saver.Submit(std::vector<uint8_t>(16, 1));
+    CHECK_THROWS(saver.Flush());
+    CHECK_EQ(saver.Flushes(), 0u);
+
+    // reported once, and the saver still works after it
+    saver.Flush();
+    saver.Submit(std::vector<uint8_t>(16, 2));
+    CHECK_THROWS(saver.Stop());
+    saver.Stop();
+}
+
+TEST(battery, ram_left_enabled_is_saved_while_running)
+{
+    // MBC3+RAM+BATTERY with 8K of RAM, enables it, counts in 0xA000 and never disables it again
+    TestRom rom;
+    rom.bytes[CART_TYPE_ADDRESS] = 0x13;
+    rom.bytes[CART_RAM_SIZE_ADDRESS] = 0x02;
+    rom.Entry({
+        OP_LD_A_N, 0x0A,
+        OP_LD_NN_A, 0x00, 0x00,
+        OP_LD_A_N, 0x00,
+        OP_INC_A,
+        OP_LD_NN_A, 0x00, 0xA0,
+        OP_JR, 0xFA, // back to the INC
+    });
+
+    const std::string path = TempPath("battery-enabled.sav");
+    std::filesystem::remove(path);
+    BatterySaver saver(path, NEVER);
+    Machine machine(rom.Build());
+    machine.GetCartridge().AttachBattery(saver);
+
+    for (int i = 1; i < BATTERY_POLL_FRAMES; ++i)
+        machine.RunFrame();
+    saver.Flush();
+    CHECK_EQ(saver.Flushes(), 0u);
+
+    machine.RunFrame();
+    saver.Flush();
+    CHECK_EQ(saver.Flushes(), 1u);
+    std::vector<uint8_t> ram(CART_RAM_BANK_SIZE, 0);
+    CHECK(saver.Load(ram));
+    CHECK(ram[0] != 0);
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,254 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <utility>
+
+#include "battery-saver.h"
+#include "machine.h"
+
+namespace
+{
+    constexpr std::chrono::milliseconds NEVER(1000000);
+
+    enum RtcRegister : uint8_t
+    {
+        S = 0x08,
+        M = 0x09,
+        H = 0x0A,
+        DL = 0x0B,
+        DH = 0x0C
+    };
+
+    // MBC3+TIMER+RAM+BATTERY with 8K of RAM, the cpu just spins while the tests poke the cartridge through the bus
+    std::shared_ptr<const std::vector<uint8_t>> RtcRom()
+    {
+        return TestRom().Header(0x10, 0x02).Entry({ SPIN }).Build();
+    }
+
+    void EnableRam(Machine& machine)
+    {
+        machine.GetMemory().SetMemory8(0x0000, 0x0A);
+    }
+
+    void Latch(Machine& machine)
+    {
+        machine.GetMemory().SetMemory8(0x6000, 0x00);
+        machine.GetMemory().SetMemory8(0x6000, 0x01);
+    }
+
+    uint8_t ReadRtc(Machine& machine, RtcRegister reg)
+    {
+        machine.GetMemory().SetMemory8(0x4000, reg);
+        return machine.GetMemory().ReadMemory8(0xA000);
+    }
+
+    void WriteRtc(Machine& machine, RtcRegister reg, uint8_t val)
+    {
+        machine.GetMemory().SetMemory8(0x4000, reg);
+        machine.GetMemory().SetMemory8(0xA000, val);
+    }
+
+    // the seconds go last, writing them restarts the second from here
+    void SetTime(Machine& machine, uint16_t days, uint8_t hours, uint8_t minutes, uint8_t seconds)
+    {
+        WriteRtc(machine, DL, static_cast<uint8_t>(days));
+        WriteRtc(machine, DH, static_cast<uint8_t>(days >> 8));
+        WriteRtc(machine, H, hours);
+        WriteRtc(machine, M, minutes);
+        WriteRtc(machine, S, seconds);
+    }
+
+    void RunSeconds(Machine& machine, double seconds)
+    {
+        machine.RunCycles(static_cast<uint64_t>(seconds * GB_CLOCK));
+    }
+}
+
+TEST(cartridge, rom_bank_register_maps_banks)
+{
+    Machine machine(TestRom().Header(0x11, 0x00).Banks(8).Entry({ SPIN }).Build());
+    Memory& memory = machine.GetMemory();
+    CHECK_EQ(memory.ReadMemory8(0x4000), 1);
+
+    // 0 picks 1, only the low 7 bits count and banks past the end wrap around
+    for (auto [written, mapped] : { std::pair<uint8_t, uint8_t>{ 3, 3 }, { 0, 1 }, { 7, 7 }, { 0x85, 5 }, { 10, 2 } })
+    {
+        memory.SetMemory8(0x2000, written);
+        CHECK_EQ(memory.ReadMemory8(0x4000), mapped);
+        CHECK_EQ(memory.ReadMemory8(0x0000), 0x00);
+    }
+}
+
+TEST(cartridge, ram_banks_keep_their_contents)
+{
+    Machine machine(TestRom().Header(0x13, 0x03).Entry({ SPIN }).Build());
+    Memory& memory = machine.GetMemory();
+    CHECK_EQ(memory.ReadMemory8(0xA000), 0xFF); // disabled
+
+    EnableRam(machine);
+    for (uint8_t bank = 0; bank < 4; ++bank)
+    {
+        memory.SetMemory8(0x4000, bank);
+        memory.SetMemory8(0xA000, 0x10 + bank);
+        memory.SetMemory8(0xBFFF, 0x20 + bank);
+    }
+    for (uint8_t bank : { 2, 0, 3, 1 })
+    {
+        memory.SetMemory8(0x4000, bank);
+        CHECK_EQ(memory.ReadMemory8(0xA000), 0x10 + bank);
+        CHECK_EQ(memory.ReadMemory8(0xBFFF), 0x20 + bank);
+    }
+
+    memory.SetMemory8(0x0000, 0x00);
+    CHECK_EQ(memory.ReadMemory8(0xA000), 0xFF);
+}
+
+TEST(cartridge, latch_takes_a_zero_then_a_one)
+{
+    Machine machine(RtcRom());
+    EnableRam(machine);
+    SetTime(machine, 0, 23, 59, 58);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 58);
+
+    // the clock runs on emulated time, seconds carry into minutes, hours and days
+    RunSeconds(machine, 3.0);
+    CHECK_EQ(ReadRtc(machine, S), 58); // still the old latch
+    machine.GetMemory().SetMemory8(0x6000, 0x01); // a one without a zero before it doesn't latch
+    CHECK_EQ(ReadRtc(machine, S), 58);
+
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 1);
+    CHECK_EQ(ReadRtc(machine, M), 0);
+    CHECK_EQ(ReadRtc(machine, H), 0);
+    CHECK_EQ(ReadRtc(machine, DL), 1);
+    CHECK_EQ(ReadRtc(machine, DH), 0);
+}
+
+TEST(cartridge, halt_freezes_the_clock)
+{
+    Machine machine(RtcRom());
+    EnableRam(machine);
+    SetTime(machine, 0, 1, 2, 3);
+    WriteRtc(machine, DH, 0x40);
+
+    RunSeconds(machine, 2.5);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 3);
+    CHECK_EQ(ReadRtc(machine, DH), 0x40);
+
+    // running again counts from the restart, not from when it was halted
+    WriteRtc(machine, DH, 0x00);
+    RunSeconds(machine, 2.0);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 5);
+    CHECK_EQ(ReadRtc(machine, M), 2);
+    CHECK_EQ(ReadRtc(machine, DH), 0x00);
+}
+
+TEST(cartridge, day_overflow_sets_the_carry)
+{
+    Machine machine(RtcRom());
+    EnableRam(machine);
+    SetTime(machine, 511, 23, 59, 59);
+
+    RunSeconds(machine, 1.5);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 0);
+    CHECK_EQ(ReadRtc(machine, DL), 0);
+    CHECK_EQ(ReadRtc(machine, DH), 0x80);
+
+    // the carry stays until the game clears it
+    RunSeconds(machine, 1.0);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 1);
+    CHECK_EQ(ReadRtc(machine, DH), 0x80);
+
+    WriteRtc(machine, DH, 0x00);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, DH), 0x00);
+}
+
+TEST(cartridge, writing_seconds_restarts_the_second)
+{
+    Machine machine(RtcRom());
+    EnableRam(machine);
+    RunSeconds(machine, 0.9);
+    WriteRtc(machine, S, 10);
+
+    // 0.9 + 0.5 would have ticked over if the second had kept going
+    RunSeconds(machine, 0.5);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 10);
+
+    RunSeconds(machine, 0.6);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 11);
+}
+
+TEST(cartridge, switching_the_clock_keeps_the_time)
+{
+    Machine machine(RtcRom());
+    Cartridge& cartridge = machine.GetCartridge();
+    EnableRam(machine);
+    SetTime(machine, 3, 4, 5, 6);
+    RunSeconds(machine, 2.0);
+
+    // the host clock only moves by however long the next few lines take
+    cartridge.SetRtcClock(RtcClock::Host);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, DL), 3);
+    CHECK_EQ(ReadRtc(machine, H), 4);
+    CHECK_EQ(ReadRtc(machine, M), 5);
+    const uint8_t seconds = ReadRtc(machine, S);
+    CHECK(seconds == 8 || seconds == 9);
+
+    cartridge.SetRtcClock(RtcClock::Emulated);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), seconds);
+    RunSeconds(machine, 1.0);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), seconds + 1);
+}
+
+TEST(cartridge, battery_keeps_ram_and_clock)
+{
+    const std::string path = TempPath("cartridge-rtc.sav");
+    std::filesystem::remove(path);
+    {
+        BatterySaver saver(path, NEVER);
+        Machine machine(RtcRom());
+        machine.GetCartridge().AttachBattery(saver);
+        EnableRam(machine);
+        machine.GetMemory().SetMemory8(0x4000, 0x00);
+        machine.GetMemory().SetMemory8(0xA000, 0x5A);
+        SetTime(machine, 259, 7, 8, 9);
+        WriteRtc(machine, DH, 0x41); // day 259 needs the top bit, halted so nothing moves before the save
+        Latch(machine);
+
+        // disabling RAM is what hands it to the saver
+        machine.GetMemory().SetMemory8(0x0000, 0x00);
+        saver.Stop();
+    }
+    CHECK_EQ(std::filesystem::file_size(path), static_cast<uintmax_t>(CART_RAM_BANK_SIZE + RTC_SAVE_SIZE));
+
+    BatterySaver saver(path, NEVER);
+    Machine machine(RtcRom());
+    machine.GetCartridge().AttachBattery(saver);
+    EnableRam(machine);
+
+    // the latched registers come back as they were, before the game latches again
+    CHECK_EQ(ReadRtc(machine, S), 9);
+    CHECK_EQ(ReadRtc(machine, DH), 0x41);
+    Latch(machine);
+    CHECK_EQ(ReadRtc(machine, S), 9);
+    CHECK_EQ(ReadRtc(machine, M), 8);
+    CHECK_EQ(ReadRtc(machine, H), 7);
+    CHECK_EQ(ReadRtc(machine, DL), 259 & 0xFF);
+    CHECK_EQ(ReadRtc(machine, DH), 0x41);
+
+    machine.GetMemory().SetMemory8(0x4000, 0x00);
+    CHECK_EQ(machine.GetMemory().ReadMemory8(0xA000), 0x5A);
+    saver.Stop();
+    std::filesystem::remove(path);
+}
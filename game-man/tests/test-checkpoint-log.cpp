@@ -0,0 +1,181 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "checkpoint-log.h"
+#include "machine.h"
+
+namespace
+{
+    std::vector<uint8_t> StateOf(const Machine& machine)
+    {
+        std::vector<uint8_t> state;
+        machine.SaveState(state);
+        return state;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> CountingRom()
+    {
+        return TestRom().Entry({ OP_INC_A, OP_LD_NN_A, 0x00, 0xC0, OP_LDH_N_A, 0x80, OP_JR, 0xF8 }).Build();
+    }
+
+    // five checkpoints a frame apart, keyframes at 0, 2 and 4, and the file size after each one
+    void WriteLog(const std::string& path, std::vector<std::vector<uint8_t>>& states, std::vector<uintmax_t>& sizes)
+    {
+        Machine machine(CountingRom());
+        CheckpointLog log(path, machine.GetCpu(), machine.GetMemory(), 2);
+        for (int i = 0; i < 5; ++i)
+        {
+            machine.RunFrame();
+            log.Append();
+            log.Flush();
+            states.push_back(StateOf(machine));
+            sizes.push_back(std::filesystem::file_size(path));
+        }
+    }
+}
+
+TEST(checkpoint, restores_every_checkpoint)
+{
+    const std::string path = TempPath("checkpoint-every.log");
+    std::vector<std::vector<uint8_t>> states;
+    std::vector<uintmax_t> sizes;
+    WriteLog(path, states, sizes);
+
+    for (uint64_t i = 0; i < states.size(); ++i)
+    {
+        Machine machine(CountingRom());
+        CheckpointLog::Restore(path, machine.GetCpu(), machine.GetMemory(), i);
+        CHECK(StateOf(machine) == states[i]);
+    }
+
+    Machine last(CountingRom());
+    CheckpointLog::Restore(path, last.GetCpu(), last.GetMemory());
+    CHECK(StateOf(last) == states.back());
+    CHECK_THROWS(CheckpointLog::Restore(path, last.GetCpu(), last.GetMemory(), states.size()));
+    std::filesystem::remove(path);
+}
+
+TEST(checkpoint, torn_record_is_dropped)
+{
+    const std::string path = TempPath("checkpoint-torn.log");
+    std::vector<std::vector<uint8_t>> states;
+    std::vector<uintmax_t> sizes;
+    WriteLog(path, states, sizes);
+
+    // cut the last record in half, then just after its header, then inside the header
+    const uintmax_t last_start = sizes[sizes.size() - 2];
+    for (uintmax_t cut : { (last_start + sizes.back()) / 2, last_start + 5, last_start + 2 })
+    {
+        std::filesystem::resize_file(path, cut);
+        Machine machine(CountingRom());
+        CheckpointLog::Restore(path, machine.GetCpu(), machine.GetMemory());
+        CHECK(StateOf(machine) == states[states.size() - 2]);
+        CHECK_THROWS(CheckpointLog::Restore(path, machine.GetCpu(), machine.GetMemory(), states.size() - 1));
+    }
+
+    // and into a delta record, which goes back to the keyframe before it
+    std::filesystem::resize_file(path, (sizes[2] + sizes[3]) / 2);
+    Machine machine(CountingRom());
+    CheckpointLog::Restore(path, machine.GetCpu(), machine.GetMemory());
+    CHECK(StateOf(machine) == states[2]);
+    std::filesystem::remove(path);
+}
+
+TEST(checkpoint, reads_leave_pages_clean)
+{
+    // AND #, OR #, BIT/SUB/SBC (HL) only read, neither the code's page nor the one HL points at may count as written
+    Machine machine(TestRom().Entry({
+        0x21, 0x00, 0xC1, // LD HL, 0xC100
+        0xE6, 0x0F, 0xF6, 0x01, // AND 0x0F, OR 0x01
+        0xCB, 0x46, 0x96, 0x9E, // BIT 0, (HL), SUB (HL), SBC A, (HL)
+        OP_JR, 0xF6,
+    }).Build());
+    machine.RunFrame();
+    machine.GetMemory().TakeDirtyPages();
+    machine.RunFrame();
+
+    const DirtyPages pages = machine.GetMemory().TakeDirtyPages();
+    for (uint16_t page = 0; page < 0x80; ++page)
+        CHECK(!pages.IsDirty(page));
+    CHECK(!pages.IsDirty(0xC1));
+}
+
+TEST(checkpoint, restores_unmapped_ram_banks)
+{
+    // the rom switches the RAM bank after every write, most of what it writes is only in banks that aren't mapped
+    const std::string path = TempPath("checkpoint-ram-banks.log");
+    std::vector<std::vector<uint8_t>> states;
+    {
+        Machine machine(RamBankingRom());
+        CheckpointLog log(path, machine.GetCpu(), machine.GetMemory(), 3);
+        for (int i = 0; i < 6; ++i)
+        {
+            machine.RunFrame();
+            log.Append();
+            states.push_back(StateOf(machine));
+        }
+    }
+
+    for (uint64_t i = 0; i < states.size(); ++i)
+    {
+        Machine machine(RamBankingRom());
+        CheckpointLog::Restore(path, machine.GetCpu(), machine.GetMemory(), i);
+        CHECK(StateOf(machine) == states[i]);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(checkpoint, untouched_cart_ram_stays_out_of_deltas)
+{
+    // 32K of cart RAM that nothing writes, a delta record is the cpu's few pages and the devices, no RAM bank
+    const std::string path = TempPath("checkpoint-quiet-ram.log");
+    Machine machine(TestRom().Header(0x13, 0x03).Entry({ OP_INC_A, OP_LDH_N_A, 0x80, OP_JR, 0xFB }).Build());
+    CheckpointLog log(path, machine.GetCpu(), machine.GetMemory(), 4);
+    machine.RunFrame();
+    log.Append();
+    log.Flush();
+    uintmax_t size = std::filesystem::file_size(path);
+    for (int i = 0; i < 3; ++i)
+    {
+        machine.RunFrame();
+        log.Append();
+        log.Flush();
+        const uintmax_t next = std::filesystem::file_size(path);
+        CHECK(next - size < 0x2000);
+        size = next;
+    }
+    std::filesystem::remove(path);
+}
+
+TEST(checkpoint, rom_banks_stay_out_of_deltas)
+{
+    // switching ROM banks copies a bank in at 0x4000, that's not a write, the bank register in the state brings it back
+    Machine quiet(RomBankingRom());
+    quiet.RunFrame();
+    quiet.GetMemory().TakeDirtyPages();
+    quiet.RunFrame();
+    const DirtyPages pages = quiet.GetMemory().TakeDirtyPages();
+    for (uint16_t page = 0; page < 0x80; ++page)
+        CHECK(!pages.IsDirty(page));
+
+    const std::string path = TempPath("checkpoint-rom-banks.log");
+    std::vector<std::vector<uint8_t>> states;
+    {
+        Machine machine(RomBankingRom());
+        CheckpointLog log(path, machine.GetCpu(), machine.GetMemory(), 4);
+        for (int i = 0; i < 4; ++i)
+        {
+            machine.RunFrame();
+            log.Append();
+            states.push_back(StateOf(machine));
+        }
+    }
+
+    for (uint64_t i = 0; i < states.size(); ++i)
+    {
+        Machine machine(RomBankingRom());
+        CheckpointLog::Restore(path, machine.GetCpu(), machine.GetMemory(), i);
+        CHECK(StateOf(machine) == states[i]);
+    }
+    std::filesystem::remove(path);
+}
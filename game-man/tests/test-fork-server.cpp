@@ -0,0 +1,134 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "fork-server.h"
+
+namespace
+{
+    // writes WRAM and the timer registers (TAC 0x55 starts it, overflows raise IF) in a loop
+    // nothing here goes through the plain memory path for page 0xFF, so it's never marked dirty by a write
+    std::shared_ptr<const std::vector<uint8_t>> BusyRom()
+    {
+        return TestRom().Entry({
+            OP_LD_A_N, 0x55,
+            OP_LD_NN_A, 0x23, 0xC1,
+            OP_LDH_N_A, 0x06,
+            OP_LDH_N_A, 0x07,
+            OP_INC_A,
+            OP_JR, 0xF6, // back to the LD (nn), A
+        }).Build();
+    }
+
+    std::vector<uint8_t> StateOf(const Machine& machine)
+    {
+        std::vector<uint8_t> state;
+        machine.SaveState(state);
+        return state;
+    }
+}
+
+TEST(fork_server, fork_equals_parent)
+{
+    const auto rom = BusyRom();
+    Machine parent(rom);
+    parent.RunFrame();
+    const std::vector<uint8_t> parent_state = StateOf(parent);
+
+    ForkServer forks(rom, 2);
+    forks.SetParent(parent_state);
+    Machine& child = forks.Fork();
+    CHECK(StateOf(child) == parent_state);
+}
+
+TEST(fork_server, rewind_equals_parent)
+{
+    const auto rom = BusyRom();
+    Machine parent(rom);
+    parent.RunFrame();
+    const std::vector<uint8_t> parent_state = StateOf(parent);
+
+    ForkServer forks(rom, 1);
+    forks.SetParent(parent_state);
+    Machine& child = forks.Fork();
+    for (int round = 0; round < 3; ++round)
+    {
+        // long enough for VBlank and timer interrupts to land in IF, which no cpu write marks dirty
+        child.RunFrame();
+        child.RunFrame();
+        CHECK(StateOf(child) != parent_state);
+
+        const ForkStats counts = forks.Rewind(child);
+        CHECK_EQ(counts.full_loads, 0u);
+        CHECK(StateOf(child) == parent_state);
+    }
+
+    // the release/fork path goes through the same reset
+    child.RunFrame();
+    forks.Release(child);
+    Machine& again = forks.Fork();
+    CHECK(StateOf(again) == parent_state);
+}
+
+TEST(fork_server, rewound_child_runs_like_parent)
+{
+    const auto rom = BusyRom();
+    Machine parent(rom);
+    parent.RunFrame();
+
+    ForkServer forks(rom, 1);
+    forks.SetParent(parent);
+    Machine& child = forks.Fork();
+    for (int i = 0; i < 5; ++i)
+        child.RunFrame();
+    forks.Rewind(child);
+
+    for (int i = 0; i < 5; ++i)
+    {
+        parent.RunFrame();
+        child.RunFrame();
+    }
+    CHECK(StateOf(child) == StateOf(parent));
+}
+
+TEST(fork_server, rewind_restores_unmapped_ram_banks)
+{
+    const auto rom = RamBankingRom();
+    Machine parent(rom);
+    parent.RunFrame();
+    const std::vector<uint8_t> parent_state = StateOf(parent);
+
+    ForkServer forks(rom, 1);
+    forks.SetParent(parent_state);
+    Machine& child = forks.Fork();
+    child.RunFrame();
+    CHECK(StateOf(child) != parent_state);
+
+    // the banks the child wrote and mapped out again aren't in any page, they have to come back too
+    const ForkStats counts = forks.Rewind(child);
+    CHECK_EQ(counts.full_loads, 0u);
+    CHECK(counts.ram_banks_restored > 0u);
+    CHECK(StateOf(child) == parent_state);
+
+    // and a child that leaves the banks alone gets none of them back
+    const ForkStats again = forks.Rewind(child);
+    CHECK_EQ(again.ram_banks_restored, 0u);
+}
+
+TEST(fork_server, rewind_maps_the_parents_rom_bank)
+{
+    const auto rom = RomBankingRom();
+    Machine parent(rom);
+    parent.RunFrame();
+    const std::vector<uint8_t> parent_state = StateOf(parent);
+
+    ForkServer forks(rom, 1);
+    forks.SetParent(parent_state);
+    Machine& child = forks.Fork();
+    child.RunFrame();
+    CHECK(child.GetMemory().ReadMemory8(0x4000) != parent.GetMemory().ReadMemory8(0x4000));
+
+    // no ROM page is dirty, the bank comes back from the cartridge's state
+    forks.Rewind(child);
+    CHECK(StateOf(child) == parent_state);
+    CHECK_EQ(child.GetMemory().ReadMemory8(0x4000), parent.GetMemory().ReadMemory8(0x4000));
+}
@@ -0,0 +1,265 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "lockstep-batch.h"
+
+namespace
+{
+    constexpr uint16_t CODE_START = 0x150; // past the header
+    constexpr uint16_t RECORD_START = 0xC200;
+
+    // runs every instruction the lockstep kernel vectorizes, over and over, with the timer and VBlank interrupts on
+    // after each one all of the registers and F are XORed into their own 8 bytes from RECORD_START, so a wrong
+    // result or flag anywhere, in any round, shows up in the save state
+    // each lane starts from its own seed at 0xC000, the conditional jumps send lanes different ways and join again
+    // after the same number of instructions, the timer interrupt lands on different instructions in different lanes
+    // the handlers count in 0xC100 and 0xC101, the timer one also bumps A, so an interrupt taken an instruction
+    // early or late changes what gets recorded after it
+    std::shared_ptr<const std::vector<uint8_t>> LockstepRom()
+    {
+        std::vector<uint8_t> code;
+        uint16_t record = RECORD_START;
+        auto emit = [&code](std::initializer_list<uint8_t> bytes)
+        {
+            for (uint8_t byte : bytes)
+                code.push_back(byte);
+        };
+        auto here = [&code]() { return static_cast<uint16_t>(CODE_START + code.size()); };
+        auto fold_a_into = [&emit](uint16_t address, uint8_t xor_reg)
+        {
+            const uint8_t lo = static_cast<uint8_t>(address);
+            const uint8_t hi = static_cast<uint8_t>(address >> 8);
+            emit({ 0xFA, lo, hi, xor_reg, OP_LD_NN_A, lo, hi }); // LD A, (nn)  XOR r  LD (nn), A
+        };
+        // XORs every register and F into their own 8 bytes, leaves them all as they were
+        auto record_registers = [&]()
+        {
+            emit({ 0xF5, 0xC5, 0x47 }); // PUSH AF  PUSH BC  LD B,A
+            fold_a_into(record, 0xA8);
+            emit({ 0xC1, 0xC5 }); // POP BC  PUSH BC
+            for (uint8_t reg = 0; reg < 6; ++reg)
+                fold_a_into(static_cast<uint16_t>(record + reg + 1), static_cast<uint8_t>(0xA8 | reg));
+            emit({ 0xC1, 0xF1, 0xF5, 0xC5, 0xF5, 0xC1 }); // POP BC  POP AF  PUSH AF  PUSH BC  PUSH AF  POP BC, F in C now
+            fold_a_into(static_cast<uint16_t>(record + 7), 0xA9);
+            emit({ 0xC1, 0xF1 }); // POP BC  POP AF
+            record += 8;
+        };
+        auto tested = [&](std::initializer_list<uint8_t> instruction)
+        {
+            emit(instruction);
+            record_registers();
+        };
+        // spreads the lane's seed over every register
+        auto spread_seed = [&]()
+        {
+            emit({ 0xFA, 0x00, 0xC0 }); // LD A, (0xC000)
+            emit({ 0x47 }); // LD B,A
+            tested({ 0x07 }); // RLCA
+            emit({ 0x4F }); // LD C,A
+            tested({ 0x0F }); // RRCA
+            emit({ 0x0F, 0x57 }); // RRCA  LD D,A
+            tested({ 0x2F }); // CPL
+            emit({ 0x5F, 0xA8, 0x67, 0x81, 0x6F }); // LD E,A  XOR B  LD H,A  ADD A,C  LD L,A
+        };
+        // branch on a flag set from a register that differs between lanes, INC B one way, DEC B and NOP the other,
+        // three instructions to the join either way
+        auto diamond = [&](uint8_t branch, std::initializer_list<uint8_t> set_flags)
+        {
+            emit(set_flags);
+            const bool jp = (branch & 0xC0) == 0xC0;
+            const uint16_t taken = here() + (jp ? 3 : 2) + 3;
+            if (jp)
+                emit({ branch, static_cast<uint8_t>(taken), static_cast<uint8_t>(taken >> 8) });
+            else
+                emit({ branch, 0x03 });
+            emit({ 0x04, OP_JR, 0x02 }); // INC B  JR join
+            emit({ 0x05, OP_NOP }); // DEC B  NOP
+            record_registers();
+        };
+
+        emit({ OP_LD_A_N, 0x05, OP_LDH_N_A, 0x07 }); // TAC, 262144 Hz, overflows every 4096 cycles
+        emit({ OP_LD_A_N, 0x05, OP_LDH_N_A, 0xFF }); // IE, VBlank and timer
+        emit({ OP_EI });
+
+        const uint16_t loop = here();
+        for (uint8_t reg = 0; reg < 8; ++reg)
+        {
+            if (reg != 6)
+                tested({ static_cast<uint8_t>(0x06 | (reg << 3)), static_cast<uint8_t>(0x11 * (reg + 1)) }); // LD r, n
+        }
+        tested({ OP_NOP });
+
+        // next seed, a big step so even one lane sees every bit change within a few frames
+        emit({ 0xFA, 0x00, 0xC0 });
+        tested({ 0xC6, 0x3B }); // ADD A, 0x3B
+        emit({ OP_LD_NN_A, 0x00, 0xC0 });
+        spread_seed();
+
+        for (uint8_t reg = 0; reg < 8; ++reg)
+        {
+            if (reg != 6)
+                tested({ static_cast<uint8_t>(0x04 | (reg << 3)) }); // INC r
+        }
+        for (uint8_t reg = 0; reg < 8; ++reg)
+        {
+            if (reg != 6)
+                tested({ static_cast<uint8_t>(0x05 | (reg << 3)) }); // DEC r
+        }
+        // INC DE carries into D and DEC HL borrows from H at least once
+        tested({ 0x1E, 0xFF }); // LD E, 0xFF
+        tested({ 0x2E, 0x00 }); // LD L, 0x00
+        for (uint8_t pair : { 0x13, 0x2B, 0x03, 0x23, 0x0B, 0x1B }) // INC DE, DEC HL, INC BC, INC HL, DEC BC, DEC DE
+            tested({ pair });
+
+        // ADD SUB SBC AND XOR OR CP with every register, a fresh spread of the seed before each one
+        for (uint8_t op : { 0x80, 0x90, 0x98, 0xA0, 0xA8, 0xB0, 0xB8 })
+        {
+            spread_seed();
+            for (uint8_t src = 0; src < 8; ++src)
+            {
+                if (src != 6)
+                    tested({ static_cast<uint8_t>(op | src) });
+            }
+        }
+        spread_seed();
+        tested({ 0xC6, 0x37 }); // ADD A, n
+        tested({ 0xE6, 0xF3 }); // AND n
+        tested({ 0xF6, 0x11 }); // OR n
+        tested({ 0xFE, 0x80 }); // CP n
+
+        spread_seed();
+        diamond(0x20, { 0x78, 0xE6, 0x01 }); // LD A,B  AND 0x01  JR NZ
+        diamond(0x28, { 0x79, 0xE6, 0x02 }); // LD A,C  AND 0x02  JR Z
+        diamond(0x30, { 0x7A, 0xFE, 0x80 }); // LD A,D  CP 0x80  JR NC
+        diamond(0x38, { 0x7B, 0xFE, 0x40 }); // LD A,E  CP 0x40  JR C
+        diamond(0xC2, { 0x7C, 0xE6, 0x04 }); // LD A,H  AND 0x04  JP NZ
+        diamond(0xCA, { 0x7D, 0xE6, 0x08 }); // LD A,L  AND 0x08  JP Z
+        diamond(0xD2, { 0x78, 0xFE, 0x60 }); // LD A,B  CP 0x60  JP NC
+        diamond(0xDA, { 0x79, 0xFE, 0xA0 }); // LD A,C  CP 0xA0  JP C
+
+        // and one backwards, XOR A and out one way, two NOPs the other
+        emit({ 0x7A, 0xE6, 0x10 }); // LD A,D  AND 0x10
+        emit({ OP_JR, 0x03, OP_XOR_A, OP_JR, 0x04, 0x20, 0xFB, OP_NOP, OP_NOP }); // JR +3  XOR A  JR +4  JR NZ, -5  NOP  NOP
+        record_registers();
+
+        // LD r, r' for every pair of registers last, they leave them all alike
+        for (uint8_t dst = 0; dst < 8; ++dst)
+        {
+            for (uint8_t src = 0; src < 8; ++src)
+            {
+                if (dst != 6 && src != 6)
+                    tested({ static_cast<uint8_t>(0x40 | (dst << 3) | src) });
+            }
+        }
+        emit({ OP_JR, 0x00 });
+        emit({ OP_JP, static_cast<uint8_t>(loop), static_cast<uint8_t>(loop >> 8) });
+
+        TestRom rom;
+        rom.Entry({ OP_JP, static_cast<uint8_t>(CODE_START), static_cast<uint8_t>(CODE_START >> 8) });
+        std::memcpy(rom.bytes.data() + CODE_START, code.data(), code.size());
+        // PUSH AF  LD A, (nn)  INC A  LD (nn), A  POP AF  (INC A)  RETI
+        rom.At(0x40, { 0xF5, 0xFA, 0x00, 0xC1, OP_INC_A, OP_LD_NN_A, 0x00, 0xC1, 0xF1, OP_RETI });
+        rom.At(0x50, { 0xF5, 0xFA, 0x01, 0xC1, OP_INC_A, OP_LD_NN_A, 0x01, 0xC1, 0xF1, OP_INC_A, OP_RETI });
+        return rom.Build();
+    }
+
+    // lanes machines, each with its own seed
+    std::vector<std::unique_ptr<Machine>> Lanes(const std::shared_ptr<const std::vector<uint8_t>>& rom, std::size_t lanes)
+    {
+        std::vector<std::unique_ptr<Machine>> machines;
+        for (std::size_t lane = 0; lane < lanes; ++lane)
+        {
+            machines.push_back(std::make_unique<Machine>(rom));
+            machines.back()->GetMemory().SetMemory8(0xC000, static_cast<uint8_t>(lane * 37 + 1));
+        }
+        return machines;
+    }
+
+    std::vector<Machine*> Pointers(const std::vector<std::unique_ptr<Machine>>& machines)
+    {
+        std::vector<Machine*> pointers;
+        for (const auto& machine : machines)
+            pointers.push_back(machine.get());
+        return pointers;
+    }
+
+    std::vector<uint8_t> StateOf(const Machine& machine)
+    {
+        std::vector<uint8_t> state;
+        machine.SaveState(state);
+        return state;
+    }
+
+    // the same machines, each one on its own, one Cpu::Step at a time
+    void RunAlone(std::vector<std::unique_ptr<Machine>>& machines, uint64_t frames)
+    {
+        for (auto& machine : machines)
+        {
+            const uint64_t target = machine->FrameCount() + frames;
+            while (machine->FrameCount() < target)
+                machine->GetCpu().Step();
+        }
+    }
+}
+
+TEST(lockstep, matches_machines_stepped_alone)
+{
+    const auto rom = LockstepRom();
+    constexpr uint64_t frames = 3;
+
+    // one lane, a whole AVX2 vector and one more, and all of them
+    for (std::size_t lanes : { std::size_t(1), std::size_t(33), std::size_t(LOCKSTEP_MAX_LANES) })
+    {
+        std::vector<std::unique_ptr<Machine>> alone = Lanes(rom, lanes);
+        RunAlone(alone, frames);
+
+        for (bool allow_avx2 : { true, false })
+        {
+            std::vector<std::unique_ptr<Machine>> machines = Lanes(rom, lanes);
+            LockstepBatch batch(Pointers(machines), allow_avx2);
+            CHECK_EQ(batch.UsesAvx2(), allow_avx2 && LockstepBatch::CpuHasAvx2());
+            batch.RunFrames(frames);
+
+            const LockstepStats& stats = batch.Stats();
+            CHECK(stats.vector_steps > 0);
+            CHECK(lanes == 1 || stats.divergent_steps > 0);
+
+            for (std::size_t lane = 0; lane < lanes; ++lane)
+            {
+                CHECK(StateOf(*machines[lane]) == StateOf(*alone[lane]));
+                // both interrupts were taken
+                CHECK(machines[lane]->GetMemory().ReadMemory8(0xC100) > 0);
+                CHECK(machines[lane]->GetMemory().ReadMemory8(0xC101) > 10);
+            }
+        }
+    }
+}
+
+TEST(lockstep, finished_lanes_sit_still)
+{
+    // nothing but vectorized instructions after the seed is loaded, odd seeds take the slower way round the
+    // diamond, so lanes finish their frame thousands of cycles apart while the rest still run together
+    TestRom rom;
+    rom.Entry({
+        0xFA, 0x00, 0xC0, // LD A, (0xC000)
+        0x47, // LD B,A
+        0x78, 0xE6, 0x01, // LD A,B  AND 0x01
+        0x28, 0x03, 0x0C, OP_JR, 0x02, 0x0D, OP_NOP, // JR Z, +3  INC C  JR +2  DEC C  NOP
+        0x81, 0x57, // ADD A,C  LD D,A
+        OP_JR, 0xF2, // back to the LD A,B
+    });
+
+    for (bool allow_avx2 : { true, false })
+    {
+        std::vector<std::unique_ptr<Machine>> alone = Lanes(rom.Build(), 40);
+        RunAlone(alone, 2);
+
+        std::vector<std::unique_ptr<Machine>> machines = Lanes(rom.Build(), 40);
+        LockstepBatch batch(Pointers(machines), allow_avx2);
+        batch.RunFrames(2);
+        // the first frame runs vectorized all the way, the second starts with every lane somewhere else
+        CHECK(batch.Stats().Utilization() > 0.3);
+        for (std::size_t lane = 0; lane < machines.size(); ++lane)
+            CHECK(StateOf(*machines[lane]) == StateOf(*alone[lane]));
+    }
+}
@@ -0,0 +1,138 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <cstdlib>
+#include <new>
+
+#include "machine-arena.h"
+
+namespace
+{
+    // plain new/delete on this thread while counting is on, the arena's own block is aligned new and stays out of it
+    // fail_at makes that allocation (counted from 0) throw, like running out of memory halfway through a batch
+    thread_local bool counting = false;
+    thread_local long allocations = 0;
+    thread_local long live = 0;
+    thread_local long fail_at = -1;
+
+    void StartCounting(long fail)
+    {
+        allocations = 0;
+        live = 0;
+        fail_at = fail;
+        counting = true;
+    }
+
+    void StopCounting()
+    {
+        counting = false;
+        fail_at = -1;
+    }
+
+    // MBC3 with 32K of RAM, so even the compact build's machines allocate something of their own
+    std::shared_ptr<const std::vector<uint8_t>> ArenaRom()
+    {
+        return TestRom().Header(0x13, 0x03).Entry({ SPIN }).Build();
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    if (counting)
+    {
+        if (allocations++ == fail_at)
+            throw std::bad_alloc();
+        ++live;
+    }
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+// gcc sees the free once this is inlined and pairs it with the builtin operator new, but new above is malloc too
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept
+{
+    if (memory != nullptr && counting)
+        --live;
+    std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    operator delete(memory);
+}
+
+TEST(arena, index_of_finds_every_machine)
+{
+    const auto rom = ArenaRom();
+    MachineArena arena(rom, 5);
+    for (std::size_t i = 0; i < arena.Size(); ++i)
+        CHECK_EQ(arena.IndexOf(arena[i]), i);
+
+    // machines from anywhere else aren't in it, not even ones right behind it in another arena
+    Machine alone(rom);
+    MachineArena other(rom, 2);
+    CHECK_THROWS(arena.IndexOf(alone));
+    CHECK_THROWS(arena.IndexOf(other[0]));
+    CHECK_THROWS(other.IndexOf(arena[4]));
+}
+
+TEST(arena, every_machine_starts_a_cache_line)
+{
+    MachineArena arena(ArenaRom(), 7);
+    CHECK_EQ(MachineArena::SLOT_SIZE % MACHINE_ARENA_ALIGNMENT, 0u);
+    CHECK(MachineArena::SLOT_SIZE >= sizeof(Machine));
+
+    const std::vector<Machine*> machines = arena.Machines();
+    CHECK_EQ(machines.size(), 7u);
+    for (std::size_t i = 0; i < machines.size(); ++i)
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(machines[i]);
+        CHECK_EQ(address % MACHINE_ARENA_ALIGNMENT, 0u);
+        if (i > 0)
+            CHECK_EQ(address - reinterpret_cast<std::uintptr_t>(machines[i - 1]), MachineArena::SLOT_SIZE);
+        CHECK(machines[i] == &arena[i]);
+    }
+}
+
+TEST(arena, a_machine_that_fails_takes_the_built_ones_down)
+{
+    const auto rom = ArenaRom();
+    {
+        Machine warm_up(rom); // anything built once per process is there from now on
+    }
+    StartCounting(-1);
+    {
+        Machine counted(rom);
+    }
+    StopCounting();
+    const long per_machine = allocations;
+    CHECK(per_machine > 1);
+
+    // the first, the second and the last machine fail halfway through their constructor
+    for (long failing : { 0, 1, 4 })
+    {
+        StartCounting(failing * per_machine + per_machine / 2);
+        CHECK_THROWS(MachineArena(rom, 5));
+        const long left = live;
+        StopCounting();
+        CHECK_EQ(left, 0);
+    }
+
+    // and a batch that doesn't fail frees everything it took
+    StartCounting(-1);
+    {
+        MachineArena arena(rom, 5);
+        CHECK_EQ(allocations, 5 * per_machine);
+    }
+    const long left = live;
+    StopCounting();
+    CHECK_EQ(left, 0);
+}
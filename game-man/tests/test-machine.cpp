@@ -0,0 +1,114 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "machine.h"
+
+TEST(machine, frame_is_a_frame_of_cycles)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    machine.RunFrame();
+    for (int i = 0; i < 10; ++i)
+    {
+        // JR is 12 cycles, a frame can only run over by what's left of the last one
+        const uint64_t cycles = machine.RunFrame();
+        CHECK(cycles + 12 >= FRAME_CYCLES_TOTAL && cycles <= FRAME_CYCLES_TOTAL + 12);
+    }
+    CHECK_EQ(machine.FrameCount(), 11u);
+}
+
+TEST(machine, same_rom_same_run)
+{
+    const auto rom = TestRom().Entry({ OP_INC_A, OP_LD_NN_A, 0x00, 0xC0, OP_JR, 0xFA }).Build();
+    Machine a(rom);
+    Machine b(rom);
+    for (int i = 0; i < 30; ++i)
+    {
+        a.RunFrame();
+        b.RunFrame();
+    }
+
+    std::vector<uint8_t> state_a;
+    std::vector<uint8_t> state_b;
+    a.SaveState(state_a);
+    b.SaveState(state_b);
+    CHECK(state_a == state_b);
+    CHECK_EQ(a.GetCpu().InstructionCount(), b.GetCpu().InstructionCount());
+}
+
+TEST(machine, scf_sets_carry_and_moves_on)
+{
+    Machine machine(TestRom().Entry({ 0x37, SPIN }).Build()); // SCF
+    const CpuRegisters before = machine.GetCpu().GetRegisters();
+    const uint64_t cycles = machine.Cycles();
+    machine.GetCpu().Step();
+
+    const CpuRegisters after = machine.GetCpu().GetRegisters();
+    CHECK_EQ(after.pc, before.pc + 1);
+    CHECK_EQ(after.sp, before.sp);
+    CHECK(after.flag_c);
+    CHECK(!after.flag_n && !after.flag_h);
+    CHECK_EQ(machine.Cycles(), cycles + 4);
+}
+
+TEST(machine, read_modify_write_leaves_rom_alone)
+{
+    // INC/DEC/SWAP/RES (HL) on ROM read it and write it back through the bus, the write goes nowhere
+    TestRom rom;
+    rom.Entry({ 0x21, 0x00, 0x02, 0x34, 0x35, 0x35, 0xCB, 0x36, 0xCB, 0xBE, SPIN }); // LD HL, 0x0200, INC/DEC/DEC/SWAP/RES 7 (HL)
+    rom.At(0x0200, { 0xA5 });
+    Machine machine(rom.Build());
+    for (int i = 0; i < 6; ++i)
+        machine.GetCpu().Step();
+    CHECK_EQ(machine.GetMemory().ReadMemory8(0x0200), 0xA5);
+}
+
+TEST(machine, read_modify_write_skips_disabled_cart_ram)
+{
+    TestRom rom;
+    rom.Header(0x13, 0x02); // MBC3+RAM+BATTERY, 8K
+    rom.Entry({
+        0x21, 0x00, 0xA0, // LD HL, 0xA000
+        0x34, // INC (HL) with RAM still disabled
+        OP_LD_A_N, 0x0A, OP_LD_NN_A, 0x00, 0x00, // enable RAM
+        0x34, 0x34, // INC (HL) twice
+        SPIN,
+    });
+    Machine machine(rom.Build());
+    machine.GetCpu().Step();
+    machine.GetCpu().Step();
+    CHECK_EQ(machine.GetMemory().ReadMemory8(0xA000), 0xFF);
+    for (int i = 0; i < 4; ++i)
+        machine.GetCpu().Step();
+    CHECK_EQ(machine.GetMemory().ReadMemory8(0xA000), 2);
+}
+
+TEST(machine, res_on_lcdc_reaches_the_ppu)
+{
+    // waits for LY to move, then RES 7, (HL) on LCDC, the display goes off and LY back to 0 for good
+    Machine machine(TestRom().Entry({
+        0x21, 0x40, 0xFF, // LD HL, 0xFF40
+        OP_LDH_A_N, 0x44, 0xA7, 0x28, 0xFB, // until LY != 0
+        0xCB, 0xBE, // RES 7, (HL)
+        SPIN,
+    }).Build());
+    machine.RunUntil([](Machine& m) { return m.GetCpu().GetRegisters().pc == GB_ROM_ENTRY_POINT + 10; });
+    for (int i = 0; i < 4; ++i)
+    {
+        CHECK_EQ(machine.GetMemory().ReadMemory8(0xFF44), 0);
+        CHECK_EQ(machine.GetMemory().ReadMemory8(0xFF41) & 0b11, 0);
+        machine.RunCycles(1000);
+    }
+}
+
+TEST(machine, bit_on_stat_sees_the_mode)
+{
+    // BIT 1, (HL) on STAT until the PPU is in mode 2 or 3, then 0x77 to 0xC000
+    Machine machine(TestRom().Entry({
+        0x21, 0x41, 0xFF, // LD HL, 0xFF41
+        0xCB, 0x4E, 0x28, 0xFC, // BIT 1, (HL), JR Z back
+        OP_LD_A_N, 0x77, OP_LD_NN_A, 0x00, 0xC0,
+        SPIN,
+    }).Build());
+    machine.RunFrame();
+    CHECK_EQ(machine.GetMemory().ReadMemory8(0xC000), 0x77);
+}
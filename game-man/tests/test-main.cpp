@@ -0,0 +1,50 @@
+#include "test.h"
+
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+std::vector<TestCase>& TestRegistry()
+{
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+bool RegisterTest(const char* name, void (*run)())
+{
+    TestRegistry().push_back({ name, run });
+    return true;
+}
+
+// no argument runs everything, otherwise only tests whose name starts with it
+int main(int argc, char** argv)
+{
+    const char* filter = argc > 1 ? argv[1] : "";
+    int run = 0;
+    int failed = 0;
+    for (const TestCase& test : TestRegistry())
+    {
+        if (std::strncmp(test.name, filter, std::strlen(filter)) != 0)
+            continue;
+
+        ++run;
+        try
+        {
+            test.run();
+            std::cout << "ok    " << test.name << "\n";
+        }
+        catch (const std::exception& e)
+        {
+            ++failed;
+            std::cout << "FAIL  " << test.name << ": " << e.what() << "\n";
+        }
+    }
+
+    std::cout << run - failed << "/" << run << " passed\n";
+    if (run == 0)
+    {
+        std::cout << "no test matches " << filter << "\n";
+        return 1;
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <fstream>
+#include <iterator>
+
+#include "machine.h"
+#include "movie.h"
+
+namespace
+{
+    // adds up every read of the direction keys in 0xC001, so any difference in what was latched when shows
+    std::shared_ptr<const std::vector<uint8_t>> InputSumRom()
+    {
+        return TestRom().Entry({
+            OP_LD_A_N, 0x20,
+            OP_LDH_N_A, 0x00,
+            OP_LDH_A_N, 0x00, // loop
+            0x47, // LD B, A
+            0xFA, 0x01, 0xC0, // LD A, (0xC001)
+            0x80, // ADD A, B
+            OP_LD_NN_A, 0x01, 0xC0,
+            OP_JR, 0xF5, // back to the loop
+        }).Build();
+    }
+
+    std::vector<uint8_t> StateOf(const Machine& machine)
+    {
+        std::vector<uint8_t> state;
+        machine.SaveState(state);
+        return state;
+    }
+
+    uint8_t ButtonsFor(int frame)
+    {
+        // held for a while, changed, sometimes released
+        return static_cast<uint8_t>((frame / 7) % 5 == 4 ? 0 : 1 << ((frame / 3) % 4));
+    }
+}
+
+TEST(movie, replay_matches_the_recording_frame_by_frame)
+{
+    const auto rom = InputSumRom();
+    const int frames = 120;
+
+    std::vector<std::vector<uint8_t>> recorded_states;
+    MovieRecorder recorder;
+    {
+        Machine machine(rom);
+        machine.GetGamepad().SetInputHook(&recorder);
+        for (int i = 0; i < frames; ++i)
+        {
+            machine.GetGamepad().SetButtons(ButtonsFor(i));
+            machine.RunFrame();
+            recorded_states.push_back(StateOf(machine));
+        }
+    }
+    CHECK(recorder.Movie().entries.size() > 10);
+    CHECK(recorder.Movie().entries.size() < static_cast<std::size_t>(frames));
+
+    const std::string path = TempPath("replay.movie");
+    recorder.Movie().Save(path);
+    const InputMovie movie = InputMovie::Load(path);
+    std::filesystem::remove(path);
+    CHECK_EQ(movie.end_frame, recorder.Movie().end_frame);
+    CHECK_EQ(movie.entries.size(), recorder.Movie().entries.size());
+
+    // the host's buttons don't get a say during playback
+    MoviePlayer player(movie);
+    Machine machine(rom);
+    machine.GetGamepad().SetInputHook(&player);
+    machine.GetGamepad().SetButtons(0xFF);
+    for (int i = 0; i < frames; ++i)
+    {
+        machine.RunFrame();
+        CHECK(StateOf(machine) == recorded_states[i]);
+    }
+    CHECK(player.Finished());
+
+    // and the input did make a difference
+    Machine idle(rom);
+    for (int i = 0; i < frames; ++i)
+        idle.RunFrame();
+    CHECK(StateOf(idle) != recorded_states.back());
+}
+
+TEST(movie, bad_files_throw)
+{
+    const std::string path = TempPath("bad.movie");
+    InputMovie movie;
+    movie.entries = { { 1, 0x01 }, { 300, 0x02 } };
+    movie.end_frame = 400;
+    movie.Save(path);
+
+    std::vector<uint8_t> bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    for (std::size_t cut : { std::size_t(2), bytes.size() - 1 })
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(bytes.data()), cut);
+        file.close();
+        CHECK_THROWS(InputMovie::Load(path));
+    }
+    std::filesystem::remove(path);
+}
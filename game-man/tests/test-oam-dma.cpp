@@ -0,0 +1,74 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <algorithm>
+
+#include "machine.h"
+
+namespace
+{
+    // puts a routine in HRAM byte by byte and jumps there, the way games run their DMA
+    TestRom HramRoutineRom(std::initializer_list<uint8_t> routine, std::initializer_list<uint8_t> setup)
+    {
+        std::vector<uint8_t> code(setup);
+        uint8_t address = 0x80;
+        for (uint8_t byte : routine)
+        {
+            code.insert(code.end(), { OP_LD_A_N, byte, OP_LDH_N_A, address++ });
+        }
+        code.insert(code.end(), { OP_LD_A_N, 0xC0, OP_JP, 0x80, 0xFF }); // DMA source page in A
+
+        TestRom rom;
+        std::copy(code.begin(), code.end(), rom.bytes.begin() + GB_ROM_ENTRY_POINT);
+        return rom;
+    }
+}
+
+TEST(oam_dma, no_interrupt_from_a_locked_bus)
+{
+    // only the (never started) timer interrupt is enabled, IF is clear, a VBlank vector that's ever taken spins at 0x40
+    TestRom rom = HramRoutineRom({ OP_LDH_N_A, 0x46, SPIN }, {
+        OP_LD_A_N, 0x04, OP_LDH_N_A, 0xFF,
+        OP_LD_A_N, 0x00, OP_LDH_N_A, 0x0F,
+        OP_EI,
+    });
+    rom.At(0x40, { SPIN });
+
+    Machine machine(rom.Build());
+    uint64_t instructions = 0;
+    machine.RunUntil([&instructions](Machine& m)
+    {
+        return ++instructions > 5000 || m.GetCpu().GetRegisters().pc < 0x100;
+    });
+    CHECK(machine.GetCpu().GetRegisters().pc >= 0xFF80);
+}
+
+TEST(oam_dma, scanlines_during_dma_see_the_registers)
+{
+    // BGP 0 keeps the blank background white, DMA restarted over and over keeps the bus locked nearly all the time
+    const TestRom rom = HramRoutineRom({ OP_LDH_N_A, 0x46, OP_JR, 0xFC }, {
+        OP_LD_A_N, 0x00, OP_LDH_N_A, 0x47,
+    });
+
+    Machine machine(rom.Build());
+    for (int i = 0; i < 3; ++i)
+        machine.RunFrame();
+
+    FrameView view;
+    CHECK(machine.GetCompositor().Frames().AcquireLatest(view));
+    for (std::size_t i = 0; i < FRAMEBUFFER_SIZE; ++i)
+        CHECK_EQ(view.pixels[i], 0);
+}
+
+TEST(oam_dma, copies_into_oam_and_only_hram_is_reachable)
+{
+    // 0xC000 gets 0x5A, the DMA copies it to 0xFE00, WRAM reads as 0xFF while it runs
+    const TestRom rom = HramRoutineRom({ OP_LDH_N_A, 0x46, OP_LD_A_N, 0x00, 0xFA, 0x00, 0xC0, OP_LDH_N_A, 0x90, SPIN }, {
+        OP_LD_A_N, 0x5A, OP_LD_NN_A, 0x00, 0xC0,
+    });
+
+    Machine machine(rom.Build());
+    machine.RunFrame();
+    CHECK_EQ(*machine.GetMemory().PeekPtrAt(0xFE00), 0x5A);
+    CHECK_EQ(*machine.GetMemory().PeekPtrAt(0xFF90), 0xFF);
+}
@@ -0,0 +1,112 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "machine.h"
+
+namespace
+{
+    constexpr uint8_t VBLANK_IF = static_cast<uint8_t>(InterruptFlags::VBlank);
+    constexpr uint8_t LCDC_IF = static_cast<uint8_t>(InterruptFlags::LCDC);
+
+    // switching the LCD back on starts LY 0 right there, everything below counts from that cycle
+    uint64_t RestartLcd(Machine& machine)
+    {
+        machine.GetMemory().SetMemory8(0xFF40, 0x00);
+        machine.GetMemory().SetMemory8(0xFF40, 0x91);
+        machine.GetMemory().SetMemory8(0xFF0F, 0x00);
+        return machine.Cycles();
+    }
+
+    uint8_t IfBits(Machine& machine)
+    {
+        return *machine.GetMemory().PeekPtrAt(0xFF0F);
+    }
+}
+
+TEST(ppu, ly_and_mode_follow_the_cycle_counter)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    machine.RunCycles(1234);
+    const uint64_t start = RestartLcd(machine);
+    Memory& memory = machine.GetMemory();
+
+    bool seen_mode[4] = {};
+    while (machine.Cycles() < start + 2 * FRAME_CYCLES_TOTAL)
+    {
+        const uint64_t frame_cycle = (machine.Cycles() - start) % FRAME_CYCLES_TOTAL;
+        const uint64_t line = frame_cycle / LINE_CYCLES;
+        const uint64_t line_cycle = frame_cycle % LINE_CYCLES;
+        uint8_t mode = 1;
+        if (line < VBLANK_START_LINE)
+            mode = line_cycle < OAM_USED_CYCLES ? 2 : line_cycle < OAM_USED_CYCLES + OAM_RAM_USED_CYCLES ? 3 : 0;
+
+        CHECK_EQ(memory.ReadMemory8(0xFF44), line);
+        CHECK_EQ(memory.ReadMemory8(0xFF41) & 0b11, mode);
+        seen_mode[mode] = true;
+        machine.GetCpu().Step();
+    }
+    CHECK(seen_mode[0] && seen_mode[1] && seen_mode[2] && seen_mode[3]);
+}
+
+TEST(ppu, vblank_starts_at_line_144)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    const uint64_t start = RestartLcd(machine);
+    const uint64_t frames = machine.FrameCount();
+    const uint64_t vblank = start + VBLANK_START_LINE * LINE_CYCLES;
+
+    machine.RunUntil([vblank](Machine& machine) { return machine.Cycles() + 12 >= vblank; });
+    CHECK_EQ(IfBits(machine) & VBLANK_IF, 0);
+    CHECK_EQ(machine.FrameCount(), frames);
+
+    machine.GetCpu().Step();
+    CHECK_EQ(IfBits(machine) & VBLANK_IF, VBLANK_IF);
+    CHECK_EQ(machine.GetMemory().ReadMemory8(0xFF44), VBLANK_START_LINE);
+    CHECK_EQ(machine.FrameCount(), frames + 1);
+}
+
+TEST(ppu, lyc_coincidence_raises_stat)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    const uint64_t start = RestartLcd(machine);
+    Memory& memory = machine.GetMemory();
+    memory.SetMemory8(0xFF45, 10);
+    memory.SetMemory8(0xFF41, 0b01000000);
+    CHECK_EQ(IfBits(machine) & LCDC_IF, 0);
+
+    const uint64_t line_10 = start + 10 * LINE_CYCLES;
+    machine.RunUntil([line_10](Machine& machine) { return machine.Cycles() + 12 >= line_10; });
+    CHECK_EQ(memory.ReadMemory8(0xFF41) & 0b100, 0);
+    CHECK_EQ(IfBits(machine) & LCDC_IF, 0);
+
+    machine.GetCpu().Step();
+    CHECK_EQ(memory.ReadMemory8(0xFF44), 10);
+    CHECK_EQ(memory.ReadMemory8(0xFF41) & 0b100, 0b100);
+    CHECK_EQ(IfBits(machine) & LCDC_IF, LCDC_IF);
+
+    // one rising edge for the whole line, nothing more until the next frame
+    memory.SetMemory8(0xFF0F, 0x00);
+    machine.RunUntil([line_10](Machine& machine) { return machine.Cycles() >= line_10 + LINE_CYCLES; });
+    CHECK_EQ(memory.ReadMemory8(0xFF41) & 0b100, 0);
+    CHECK_EQ(IfBits(machine) & LCDC_IF, 0);
+}
+
+TEST(ppu, hblank_stat_once_per_visible_line)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    const uint64_t start = RestartLcd(machine);
+    Memory& memory = machine.GetMemory();
+    memory.SetMemory8(0xFF41, 0b00001000);
+
+    int interrupts = 0;
+    while (machine.Cycles() < start + FRAME_CYCLES_TOTAL)
+    {
+        machine.GetCpu().Step();
+        if ((IfBits(machine) & LCDC_IF) != 0)
+        {
+            ++interrupts;
+            memory.SetMemory8(0xFF0F, 0x00);
+        }
+    }
+    CHECK_EQ(interrupts, VBLANK_START_LINE);
+}
@@ -0,0 +1,130 @@
+#include "test.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "resampler.h"
+
+namespace
+{
+    constexpr double pi = 3.14159265358979323846;
+
+    // a second of a sine at the APU's rate, right a quarter turn behind left
+    std::vector<AudioSample> Tone(double frequency, double amplitude)
+    {
+        std::vector<AudioSample> samples(APU_SAMPLE_RATE);
+        for (std::size_t i = 0; i < samples.size(); ++i)
+        {
+            const double angle = 2.0 * pi * frequency * static_cast<double>(i) / APU_SAMPLE_RATE;
+            samples[i] = { static_cast<int16_t>(std::lround(amplitude * std::sin(angle))),
+                static_cast<int16_t>(std::lround(amplitude * std::cos(angle))) };
+        }
+        return samples;
+    }
+
+    // the loudest output sample of either channel, leaving out the filter's warm up at the start
+    int Peak(const std::vector<AudioSample>& samples)
+    {
+        int peak = 0;
+        for (std::size_t i = RESAMPLER_TAPS; i < samples.size(); ++i)
+            peak = std::max({ peak, std::abs(samples[i].left), std::abs(samples[i].right) });
+        return peak;
+    }
+
+    std::vector<AudioSample> Resample(uint32_t output_rate, const std::vector<AudioSample>& in)
+    {
+        Resampler resampler(APU_SAMPLE_RATE, output_rate);
+        std::vector<AudioSample> out;
+        // uneven pieces, the leftover history has to carry over between calls
+        for (std::size_t done = 0; done < in.size();)
+        {
+            const std::size_t count = std::min<std::size_t>(in.size() - done, 1000 + done % 777);
+            resampler.Process(in.data() + done, count, out);
+            done += count;
+        }
+        return out;
+    }
+}
+
+TEST(resampler, output_count_follows_the_rate)
+{
+    for (uint32_t rate : { 44100u, 48000u })
+    {
+        const std::vector<AudioSample> out = Resample(rate, std::vector<AudioSample>(APU_SAMPLE_RATE));
+        CHECK_EQ(out.size(), static_cast<std::size_t>(rate));
+    }
+}
+
+TEST(resampler, dc_passes_at_unity_gain)
+{
+    for (uint32_t rate : { 44100u, 48000u })
+    {
+        const std::vector<AudioSample> out = Resample(rate, std::vector<AudioSample>(APU_SAMPLE_RATE / 10, { 12000, -7000 }));
+
+        // the first sample comes from a history of silence plus the first input, it mustn't be anything else
+        CHECK(std::abs(out.front().left) < 1000);
+        for (std::size_t i = RESAMPLER_TAPS; i < out.size(); ++i)
+        {
+            CHECK(std::abs(out[i].left - 12000) <= 1);
+            CHECK(std::abs(out[i].right + 7000) <= 1);
+        }
+    }
+}
+
+TEST(resampler, passes_tones_below_the_output_nyquist)
+{
+    for (uint32_t rate : { 44100u, 48000u })
+    {
+        for (double frequency : { 440.0, 3000.0, 8000.0 })
+        {
+            const int peak = Peak(Resample(rate, Tone(frequency, 10000.0)));
+            CHECK(peak > 9800);
+            CHECK(peak < 10200);
+        }
+    }
+}
+
+TEST(resampler, attenuates_tones_above_the_output_nyquist)
+{
+    // anything that would fold back into the audible range has to be at least 40 dB down
+    for (uint32_t rate : { 44100u, 48000u })
+    {
+        for (double frequency : { rate * 0.5 + 2000.0, rate * 0.75, 60000.0 })
+            CHECK(Peak(Resample(rate, Tone(frequency, 10000.0))) < 100);
+    }
+}
+
+TEST(resampler, simd_matches_scalar)
+{
+    std::vector<float> coefficients(RESAMPLER_TAPS + 1);
+    std::vector<float> left(RESAMPLER_TAPS + 1);
+    std::vector<float> right(RESAMPLER_TAPS + 1);
+    uint64_t seed = 1;
+    auto next = [&seed](float scale)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (static_cast<float>(seed >> 40) / static_cast<float>(1 << 24) - 0.5f) * scale;
+    };
+
+    for (int round = 0; round < 10000; ++round)
+    {
+        for (int i = 0; i <= RESAMPLER_TAPS; ++i)
+        {
+            coefficients[i] = next(0.2f);
+            left[i] = next(65536.0f);
+            right[i] = next(65536.0f);
+        }
+
+        // unaligned every other round, and some that clip
+        const std::size_t start = round % 2;
+        const float scale = round % 7 == 0 ? 40.0f : 1.0f;
+        for (float& coefficient : coefficients)
+            coefficient *= scale;
+
+        const AudioSample simd = ResamplerConvolve(coefficients.data() + start, left.data() + start, right.data() + start);
+        const AudioSample scalar = ResamplerConvolveScalar(coefficients.data() + start, left.data() + start, right.data() + start);
+        CHECK(std::abs(simd.left - scalar.left) <= 1);
+        CHECK(std::abs(simd.right - scalar.right) <= 1);
+    }
+}
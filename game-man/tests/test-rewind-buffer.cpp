@@ -0,0 +1,90 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <map>
+
+#include "machine.h"
+#include "rewind-buffer.h"
+
+namespace
+{
+    std::vector<uint8_t> StateOf(const Machine& machine)
+    {
+        std::vector<uint8_t> state;
+        machine.SaveState(state);
+        return state;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> CountingRom()
+    {
+        return TestRom().Entry({ OP_INC_A, OP_LD_NN_A, 0x00, 0xC0, OP_LDH_N_A, 0x80, OP_JR, 0xF8 }).Build();
+    }
+
+    // a snapshot every frame, the states as they were at each one
+    std::map<uint64_t, std::vector<uint8_t>> Record(Machine& machine, RewindBuffer& rewind, int frames)
+    {
+        std::map<uint64_t, std::vector<uint8_t>> states;
+        for (int i = 0; i < frames; ++i)
+        {
+            machine.RunFrame();
+            rewind.OnFrame(machine.GetCpu(), machine.FrameCount());
+            states[machine.FrameCount()] = StateOf(machine);
+        }
+        return states;
+    }
+}
+
+TEST(rewind, restore_gives_back_any_stored_frame)
+{
+    Machine machine(CountingRom());
+    RewindBuffer rewind(REWIND_DEFAULT_BYTES, 1, 4);
+    const auto states = Record(machine, rewind, 40);
+    CHECK_EQ(rewind.Snapshots(), 40u);
+    CHECK_EQ(rewind.OldestFrame(), 1u);
+
+    // newest first, every Restore forgets what comes after it, keyframes, between them and next to the newest
+    for (uint64_t frame : { 40, 39, 37, 30, 21, 20, 18, 13, 3, 1 })
+    {
+        CHECK(rewind.Restore(machine.GetCpu(), frame));
+        CHECK_EQ(rewind.NewestFrame(), frame);
+        CHECK(StateOf(machine) == states.at(frame));
+    }
+    CHECK_EQ(rewind.Snapshots(), 1u);
+    CHECK(!rewind.Restore(machine.GetCpu(), 2));
+}
+
+TEST(rewind, history_goes_on_from_a_restored_frame)
+{
+    Machine machine(CountingRom());
+    RewindBuffer rewind(REWIND_DEFAULT_BYTES, 1, 4);
+    const auto states = Record(machine, rewind, 30);
+
+    CHECK(rewind.Restore(machine.GetCpu(), 10));
+    // the machine is deterministic, the same frames come out again
+    Record(machine, rewind, 20);
+    CHECK_EQ(rewind.Snapshots(), 30u);
+    CHECK(rewind.Restore(machine.GetCpu(), 25));
+    CHECK(StateOf(machine) == states.at(25));
+    CHECK(rewind.Restore(machine.GetCpu(), 6));
+    CHECK(StateOf(machine) == states.at(6));
+
+    while (rewind.StepBack(machine.GetCpu()))
+        CHECK(StateOf(machine) == states.at(rewind.NewestFrame()));
+    CHECK_EQ(rewind.NewestFrame(), 1u);
+}
+
+TEST(rewind, oldest_snapshots_fall_out)
+{
+    Machine machine(CountingRom());
+    const std::size_t state_size = StateOf(machine).size();
+    RewindBuffer rewind(4 * state_size, 1, 4);
+    const auto states = Record(machine, rewind, 60);
+
+    CHECK(rewind.Snapshots() < 60u);
+    CHECK(rewind.BytesUsed() <= 5 * state_size);
+    const uint64_t oldest = rewind.OldestFrame();
+    CHECK(oldest > 1);
+    CHECK(!rewind.Restore(machine.GetCpu(), oldest - 1));
+    CHECK(rewind.Restore(machine.GetCpu(), oldest));
+    CHECK(StateOf(machine) == states.at(oldest));
+}
@@ -0,0 +1,91 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "rl-environment.h"
+
+namespace
+{
+    constexpr uint8_t RIGHT = static_cast<uint8_t>(GamepadController::Button::Right);
+    constexpr uint8_t UP = static_cast<uint8_t>(GamepadController::Button::Up);
+}
+
+TEST(rl, action_is_seen_in_its_own_step)
+{
+    Machine machine(JoypadEchoRom());
+    RlConfig config;
+    config.downsample = 0;
+    config.ram_addresses = { 0xC000 };
+    RlEnvironment env(machine, config);
+    env.Reset(nullptr);
+
+    uint8_t observation = 0;
+    env.Step(0, 2, &observation);
+    CHECK_EQ(observation, 0xEF);
+    env.Step(RIGHT, 1, &observation);
+    CHECK_EQ(observation, 0xEE);
+    env.Step(UP, 1, &observation);
+    CHECK_EQ(observation, 0xEB);
+    env.Step(0, 1, &observation);
+    CHECK_EQ(observation, 0xEF);
+}
+
+TEST(rl, rewards_and_done_from_ram)
+{
+    Machine machine(JoypadEchoRom());
+    RlConfig config;
+    config.downsample = 0;
+    config.rewards.push_back({ 0xC000, 1, true, 1.0f });
+    config.done.push_back({ 0xC000, 0x0F, 0x0B }); // Up held
+    RlEnvironment env(machine, config);
+    env.Reset(nullptr);
+
+    RlStepResult result = env.Step(0, 1, nullptr);
+    CHECK(!result.done);
+    result = env.Step(RIGHT, 1, nullptr);
+    CHECK(result.reward == -1.0f); // 0xEF -> 0xEE
+    CHECK(!result.done);
+    result = env.Step(UP, 1, nullptr);
+    CHECK(result.reward == -3.0f);
+    CHECK(result.done);
+}
+
+TEST(rl, blank_screen_is_white_at_every_downsample)
+{
+    for (uint8_t downsample : { 1, 2, 4, 8, 16 })
+    {
+        Machine machine(TestRom().Entry({ SPIN }).Build());
+        RlConfig config;
+        config.downsample = downsample;
+        RlEnvironment env(machine, config);
+
+        std::vector<uint8_t> observation(env.ObservationSize(), 0);
+        CHECK_EQ(observation.size(), static_cast<std::size_t>((LCD_WIDTH / downsample) * (LCD_HEIGHT / downsample)));
+        env.Step(0, 2, observation.data());
+        for (uint8_t pixel : observation)
+            CHECK_EQ(pixel, 0xFF);
+    }
+}
+
+TEST(rl, black_palette_screen_is_black)
+{
+    // BGP 0xFF maps every colour to shade 3, the blank background comes out black
+    Machine machine(TestRom().Entry({ OP_LD_A_N, 0xFF, OP_LDH_N_A, 0x47, SPIN }).Build());
+    RlConfig config;
+    config.downsample = 4;
+    config.ram_addresses = { 0xFF47 };
+    RlEnvironment env(machine, config);
+
+    std::vector<uint8_t> observation(env.ObservationSize(), 0x55);
+    env.Step(0, 3, observation.data());
+    for (std::size_t i = 0; i < observation.size() - 1; ++i)
+        CHECK_EQ(observation[i], 0x00);
+    CHECK_EQ(observation.back(), 0xFF);
+}
+
+TEST(rl, bad_config_throws)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    RlConfig config;
+    config.downsample = 3;
+    CHECK_THROWS(RlEnvironment(machine, config));
+}
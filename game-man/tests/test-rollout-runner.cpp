@@ -0,0 +1,83 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <algorithm>
+#include <random>
+
+#include "rollout-runner.h"
+
+namespace
+{
+    constexpr uint8_t RIGHT = static_cast<uint8_t>(GamepadController::Button::Right);
+    constexpr uint8_t LEFT = static_cast<uint8_t>(GamepadController::Button::Left);
+
+    std::vector<uint8_t> StartState(const std::shared_ptr<const std::vector<uint8_t>>& rom)
+    {
+        Machine machine(rom);
+        machine.RunFrame();
+        machine.RunFrame();
+        std::vector<uint8_t> state;
+        machine.SaveState(state);
+        return state;
+    }
+}
+
+TEST(rollout, mask_applies_to_its_own_frame)
+{
+    const auto rom = JoypadEchoRom();
+    WorkStealingPool pool(2);
+    RolloutRunner runner(pool, rom);
+
+    const std::vector<std::vector<uint8_t>> inputs = { { RIGHT }, { LEFT }, { RIGHT, LEFT }, { LEFT, 0 }, {} };
+    const std::vector<uint16_t> addresses = { 0xC000 };
+    std::vector<uint8_t> results(inputs.size());
+    const RolloutStats stats = runner.Run(StartState(rom), inputs, addresses, results.data());
+
+    CHECK_EQ(stats.rollouts, inputs.size());
+    CHECK_EQ(results[0], 0xEE);
+    CHECK_EQ(results[1], 0xED);
+    CHECK_EQ(results[2], 0xED); // the last mask ran, it isn't left latched for a frame that never comes
+    CHECK_EQ(results[3], 0xEF);
+    CHECK_EQ(results[4], 0xEF); // nothing ran, what the start state had
+}
+
+TEST(rollout, results_match_a_fresh_machine_whatever_ran_before)
+{
+    const auto rom = JoypadEchoRom();
+    const std::vector<uint8_t> start = StartState(rom);
+
+    std::mt19937 rng(7);
+    std::vector<std::vector<uint8_t>> inputs(12);
+    for (auto& sequence : inputs)
+    {
+        sequence.resize(rng() % 6);
+        for (uint8_t& buttons : sequence)
+            buttons = static_cast<uint8_t>(rng() & 0x0F);
+    }
+
+    WorkStealingPool pool(2);
+    RolloutRunner runner(pool, rom);
+    const std::size_t size = RolloutRunner::ResultSize({});
+    std::vector<uint8_t> results(inputs.size() * size);
+
+    // twice, the second time every worker's machine comes in with someone else's rollout in it
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        runner.Run(start, inputs, {}, results.data());
+        for (std::size_t k = 0; k < inputs.size(); ++k)
+        {
+            Machine reference(rom);
+            reference.LoadState(start);
+            for (uint8_t buttons : inputs[k])
+            {
+                reference.SetInput(buttons);
+                reference.RunFrame();
+            }
+
+            const uint8_t* result = results.data() + k * size;
+            CHECK(std::memcmp(result, reference.GetMemory().PeekPtrAt(ROLLOUT_WRAM_START), ROLLOUT_WRAM_SIZE) == 0);
+            CHECK(std::memcmp(result + ROLLOUT_WRAM_SIZE, reference.GetMemory().PeekPtrAt(ROLLOUT_HRAM_START), ROLLOUT_HRAM_SIZE) == 0);
+        }
+        std::reverse(inputs.begin(), inputs.end());
+    }
+}
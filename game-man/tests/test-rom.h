@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "cartridge.h"
+#include "cpu.h"
+
+// a 32K ROM-only cartridge for tests, all NOPs (0x00) apart from what gets put in
+// the header bytes stay 0, that's no MBC and no RAM
+struct TestRom
+{
+    std::vector<uint8_t> bytes = std::vector<uint8_t>(2 * CART_ROM_BANK_SIZE, 0x00);
+
+    TestRom& At(uint16_t address, std::initializer_list<uint8_t> code)
+    {
+        std::memcpy(bytes.data() + address, code.begin(), code.size());
+        return *this;
+    }
+
+    // code that runs from power on
+    TestRom& Entry(std::initializer_list<uint8_t> code)
+    {
+        return At(GB_ROM_ENTRY_POINT, code);
+    }
+
+    // cartridge type and RAM size code, the header bytes at 0x147 and 0x149
+    TestRom& Header(uint8_t type, uint8_t ram_size)
+    {
+        bytes[CART_TYPE_ADDRESS] = type;
+        bytes[CART_RAM_SIZE_ADDRESS] = ram_size;
+        return *this;
+    }
+
+    // grows the ROM to count 16K banks, each one starting with its own number (bank 0's is under the vectors)
+    TestRom& Banks(std::size_t count)
+    {
+        bytes.resize(count * CART_ROM_BANK_SIZE, 0x00);
+        for (std::size_t bank = 1; bank < count; ++bank)
+            bytes[bank * CART_ROM_BANK_SIZE] = static_cast<uint8_t>(bank);
+        return *this;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> Build() const
+    {
+        return std::make_shared<const std::vector<uint8_t>>(bytes);
+    }
+};
+
+// opcodes the tests' little programs are made of
+#define OP_NOP 0x00
+#define OP_JR 0x18 // JR e, 0xFE after it spins on the spot
+#define OP_LD_A_N 0x3E
+#define OP_INC_A 0x3C
+#define OP_XOR_A 0xAF
+#define OP_LDH_N_A 0xE0 // LDH (0xFF00 + n), A
+#define OP_LDH_A_N 0xF0 // LDH A, (0xFF00 + n)
+#define OP_LD_NN_A 0xEA
+#define OP_EI 0xFB
+#define OP_DI 0xF3
+#define OP_JP 0xC3
+#define OP_RETI 0xD9
+#define SPIN OP_JR, 0xFE
+
+// selects the direction keys and copies 0xFF00 to 0xC000 over and over, 0xEE with only Right held
+inline std::shared_ptr<const std::vector<uint8_t>> JoypadEchoRom()
+{
+    return TestRom().Entry({
+        OP_LD_A_N, 0x20,
+        OP_LDH_N_A, 0x00,
+        OP_LDH_A_N, 0x00,
+        OP_LD_NN_A, 0x00, 0xC0,
+        OP_JR, 0xF5, // back to the start
+    }).Build();
+}
+
+// MBC3 with 32K of RAM, enables it, then over and over: A + 1 into 0xA123 of the mapped bank and A as the RAM bank
+// select, so every bank gets written and then mapped out (4-7 select nothing and leave the bank where it is)
+inline std::shared_ptr<const std::vector<uint8_t>> RamBankingRom()
+{
+    return TestRom().Header(0x13, 0x03).Entry({
+        OP_LD_A_N, 0x0A, OP_LD_NN_A, 0x00, 0x00,
+        OP_INC_A,
+        OP_LD_NN_A, 0x23, 0xA1,
+        OP_LD_NN_A, 0x00, 0x40,
+        OP_JR, 0xF7, // back to the INC A
+    }).Build();
+}
+
+// MBC3 with 8 ROM banks and no RAM, selects bank A + 1 over and over and copies its first byte to 0xC000
+inline std::shared_ptr<const std::vector<uint8_t>> RomBankingRom()
+{
+    return TestRom().Header(0x11, 0x00).Banks(8).Entry({
+        OP_INC_A,
+        OP_LD_NN_A, 0x00, 0x20,
+        0xFA, 0x00, 0x40, // LD A, (0x4000)
+        OP_LD_NN_A, 0x00, 0xC0,
+        OP_JR, 0xF4, // back to the INC A
+    }).Build();
+}
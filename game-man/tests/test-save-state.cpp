@@ -0,0 +1,77 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "machine.h"
+
+namespace
+{
+    std::vector<uint8_t> StateOf(const Machine& machine)
+    {
+        std::vector<uint8_t> state;
+        machine.SaveState(state);
+        return state;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> CountingRom()
+    {
+        return TestRom().Entry({ OP_INC_A, OP_LD_NN_A, 0x00, 0xC0, OP_LDH_N_A, 0x80, OP_JR, 0xF8 }).Build();
+    }
+}
+
+TEST(savestate, round_trip_continues_the_same_run)
+{
+    const auto rom = CountingRom();
+    Machine original(rom);
+    for (int i = 0; i < 10; ++i)
+        original.RunFrame();
+    const std::vector<uint8_t> saved = StateOf(original);
+
+    Machine loaded(rom);
+    loaded.RunFrame();
+    loaded.LoadState(saved);
+    CHECK(StateOf(loaded) == saved);
+    CHECK_EQ(loaded.GetCpu().GetRegisters().pc, original.GetCpu().GetRegisters().pc);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        original.RunFrame();
+        loaded.RunFrame();
+    }
+    CHECK(StateOf(loaded) == StateOf(original));
+}
+
+TEST(savestate, bad_state_leaves_the_machine_alone)
+{
+    const auto rom = CountingRom();
+    Machine source(rom);
+    source.RunFrame();
+    const std::vector<uint8_t> good = StateOf(source);
+
+    Machine target(rom);
+    for (int i = 0; i < 3; ++i)
+        target.RunFrame();
+    const std::vector<uint8_t> before = StateOf(target);
+
+    // everything up to the last chunk is fine each time, so a reader that applies as it goes has done damage by then
+    std::vector<uint8_t> wrong_tag = good;
+    const std::size_t last = good.size() - SAVE_STATE_CHUNK_HEADER_SIZE - StateReader(good).Layout().back().size;
+    wrong_tag[last] = 'X';
+    CHECK_THROWS(target.LoadState(wrong_tag));
+    CHECK(StateOf(target) == before);
+
+    std::vector<uint8_t> missing_chunk(good.begin(), good.begin() + last);
+    CHECK_THROWS(target.LoadState(missing_chunk));
+    CHECK(StateOf(target) == before);
+
+    std::vector<uint8_t> truncated(good.begin(), good.end() - 1);
+    CHECK_THROWS(target.LoadState(truncated));
+    CHECK(StateOf(target) == before);
+
+    std::vector<uint8_t> wrong_version = good;
+    wrong_version[4] ^= 0xFF;
+    CHECK_THROWS(target.LoadState(wrong_version));
+    CHECK(StateOf(target) == before);
+
+    target.LoadState(good);
+    CHECK(StateOf(target) == good);
+}
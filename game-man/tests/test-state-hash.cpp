@@ -0,0 +1,99 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "state-hash.h"
+
+namespace
+{
+    std::vector<uint8_t> NoiseBytes(std::size_t size, uint64_t seed)
+    {
+        std::vector<uint8_t> bytes(size);
+        for (uint8_t& byte : bytes)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            byte = static_cast<uint8_t>(seed >> 56);
+        }
+        return bytes;
+    }
+}
+
+TEST(hash, simd_matches_scalar)
+{
+    // every tail length, a few whole blocks and then some, unaligned starts, different seeds
+    const std::vector<uint8_t> bytes = NoiseBytes(70000, 1);
+    std::vector<std::size_t> sizes;
+    for (std::size_t size = 0; size <= 3 * 64 + 1; ++size)
+        sizes.push_back(size);
+    for (std::size_t size : { 1023, 1024, 1025, 4096, 0x8000, 65536 + 37 })
+        sizes.push_back(size);
+
+    for (std::size_t size : sizes)
+    {
+        for (std::size_t offset : { 0, 1, 7 })
+        {
+            for (uint64_t seed : { 0ULL, 0x123456789ABCDEF0ULL })
+                CHECK_EQ(StateHash64(bytes.data() + offset, size, seed), StateHash64Scalar(bytes.data() + offset, size, seed));
+        }
+    }
+}
+
+TEST(hash, tells_close_inputs_apart)
+{
+    std::vector<uint8_t> bytes = NoiseBytes(4096, 2);
+    const uint64_t hash = StateHash64(bytes.data(), bytes.size());
+    CHECK(StateHash64(bytes.data(), bytes.size() - 1) != hash);
+    CHECK(StateHash64(bytes.data(), bytes.size(), 1) != hash);
+
+    bytes[2000] ^= 0x10;
+    CHECK(StateHash64(bytes.data(), bytes.size()) != hash);
+
+    const uint8_t ab[3] = { 'a', 'b', 0 };
+    CHECK(StateHash64(ab, 2) != StateHash64(ab, 3));
+}
+
+TEST(hash, frame_hashes_follow_the_state)
+{
+    const auto rom = TestRom().Entry({ OP_INC_A, OP_LD_NN_A, 0x00, 0xC0, OP_JR, 0xFA }).Build();
+    Machine a(rom);
+    Machine b(rom);
+    FrameHasher hasher;
+    FrameHashLog log;
+    log.first_frame = 1;
+    for (int i = 0; i < 5; ++i)
+    {
+        a.RunFrame();
+        b.RunFrame();
+        log.hashes.push_back(hasher.Hash(a));
+        CHECK_EQ(hasher.Hash(b), log.hashes.back());
+    }
+    CHECK(log.hashes[3] != log.hashes[4]);
+
+    b.GetMemory().PokeAt(0xD000, b.GetMemory().ReadMemory8(0xD000) ^ 1);
+    CHECK(hasher.Hash(b) != hasher.Hash(a));
+
+    const std::string path = TempPath("frames.hashlog");
+    log.Save(path);
+    const FrameHashLog loaded = FrameHashLog::Load(path);
+    std::filesystem::remove(path);
+    CHECK_EQ(loaded.first_frame, 1u);
+    CHECK(loaded.hashes == log.hashes);
+}
+
+TEST(hash, cart_ram_banks_count)
+{
+    // same machine, one byte of one RAM bank as the cartridge keeps it differs, the frame hash has to tell them apart
+    const auto rom = RamBankingRom();
+    Machine a(rom);
+    Machine b(rom);
+    a.RunFrame();
+    b.RunFrame();
+    FrameHasher hasher_a;
+    FrameHasher hasher_b;
+    CHECK_EQ(hasher_a.Hash(a), hasher_b.Hash(b));
+
+    Cartridge& cartridge = b.GetCartridge();
+    std::vector<uint8_t> data(cartridge.RamBank(2), cartridge.RamBank(2) + cartridge.RamBankSize());
+    data[0x555] ^= 0x01;
+    cartridge.WriteRamBank(2, data.data());
+    CHECK(hasher_a.Hash(a) != hasher_b.Hash(b));
+}
@@ -0,0 +1,94 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include <atomic>
+#include <thread>
+
+#include "machine.h"
+#include "state-publisher.h"
+
+TEST(publisher, run_frame_publishes_the_frame_boundary)
+{
+    Machine machine(TestRom().Entry({ OP_INC_A, OP_LD_NN_A, 0x00, 0xC0, OP_JR, 0xFA }).Build());
+    StatePublisher publisher({ 0xC000, 0xFF47 });
+    StateSnapshot snapshot;
+    CHECK(!publisher.TryRead(snapshot));
+
+    machine.SetStatePublisher(&publisher);
+    for (int i = 0; i < 3; ++i)
+        machine.RunFrame();
+
+    snapshot = publisher.Read();
+    CHECK_EQ(snapshot.sequence, 6u);
+    CHECK_EQ(snapshot.frame, machine.FrameCount());
+    CHECK_EQ(snapshot.cycles, machine.Cycles());
+    CHECK_EQ(snapshot.instructions, machine.GetCpu().InstructionCount());
+    CHECK_EQ(snapshot.registers.pc, machine.GetCpu().GetRegisters().pc);
+    CHECK_EQ(snapshot.byte_count, 2);
+    CHECK_EQ(snapshot.bytes[0], *machine.GetMemory().PeekPtrAt(0xC000));
+    CHECK_EQ(snapshot.bytes[1], 0xFC); // BGP from power up
+
+    CHECK_THROWS(StatePublisher(std::vector<uint16_t>(STATE_PUBLISHER_MAX_BYTES + 1, 0xC000)));
+}
+
+TEST(publisher, readers_never_see_a_torn_snapshot)
+{
+    // every field of publish n is worked out from n, a reader can tell a mix of two publishes apart
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    std::vector<uint16_t> addresses;
+    for (uint16_t i = 0; i < 64; ++i)
+        addresses.push_back(0xC000 + i);
+    StatePublisher publisher(addresses);
+
+    constexpr uint64_t publishes = 100000;
+    std::atomic<bool> writing(true);
+    std::atomic<uint64_t> torn(0);
+    std::atomic<uint64_t> backwards(0);
+    std::atomic<uint64_t> reads(0);
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.emplace_back([&]
+        {
+            uint64_t last = 0;
+            while (writing.load(std::memory_order_relaxed))
+            {
+                const StateSnapshot snapshot = publisher.Read();
+                const uint64_t n = snapshot.frame;
+                const uint8_t low = static_cast<uint8_t>(n);
+                bool good = snapshot.sequence == 2 * n && snapshot.cycles == 3 * n
+                    && snapshot.registers.a == low && snapshot.registers.l == low && snapshot.registers.sp == static_cast<uint16_t>(n);
+                for (uint16_t i = 0; i < snapshot.byte_count; ++i)
+                    good = good && snapshot.bytes[i] == static_cast<uint8_t>(low + i);
+
+                torn += good ? 0 : 1;
+                backwards += n < last ? 1 : 0;
+                last = n;
+                ++reads;
+            }
+        });
+    }
+
+    Cpu& cpu = machine.GetCpu();
+    Memory& memory = machine.GetMemory();
+    for (uint64_t n = 1; n <= publishes; ++n)
+    {
+        const uint8_t low = static_cast<uint8_t>(n);
+        CpuRegisters registers = cpu.GetRegisters();
+        registers.a = registers.l = low;
+        registers.sp = static_cast<uint16_t>(n);
+        cpu.SetRegisters(registers);
+        for (uint16_t i = 0; i < addresses.size(); ++i)
+            memory.PokeAt(addresses[i], static_cast<uint8_t>(low + i));
+        publisher.Publish(cpu, memory, n, 3 * n);
+    }
+    writing = false;
+    for (auto& reader : readers)
+        reader.join();
+
+    CHECK(reads.load() > 0);
+    CHECK_EQ(torn.load(), 0u);
+    CHECK_EQ(backwards.load(), 0u);
+    CHECK_EQ(publisher.Read().frame, publishes);
+}
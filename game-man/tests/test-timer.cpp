@@ -0,0 +1,118 @@
+#include "test.h"
+#include "test-rom.h"
+
+#include "machine.h"
+
+namespace
+{
+    constexpr uint8_t TIMER_IF = static_cast<uint8_t>(InterruptFlags::TimerOverflow);
+
+    // the registers written from outside the cpu, between two JRs of a spinning machine
+    // DIV is reset while the timer is still off, with it on the reset can be a falling edge and tick TIMA
+    uint64_t StartTimer(Machine& machine, uint8_t tima, uint8_t tma, uint8_t tac)
+    {
+        Memory& memory = machine.GetMemory();
+        memory.SetMemory8(0xFF04, 0);
+        memory.SetMemory8(0xFF05, tima);
+        memory.SetMemory8(0xFF06, tma);
+        memory.SetMemory8(0xFF07, tac);
+        return machine.Cycles();
+    }
+}
+
+TEST(timer, overflow_lands_on_the_right_edge)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    machine.RunCycles(1000);
+    Memory& memory = machine.GetMemory();
+    memory.SetMemory8(0xFF0F, 0);
+
+    // 262144 Hz is a TIMA tick every 16 cycles, 16 of them from 0xF0
+    const uint64_t start = StartTimer(machine, 0xF0, 0xAB, 0x05);
+    const uint64_t due = start + 16 * 16;
+    CHECK_EQ(machine.GetScheduler().ScheduledAt(EventType::TimerOverflow), due);
+
+    machine.RunUntil([due](Machine& machine) { return machine.Cycles() + 12 >= due; });
+    CHECK_EQ(memory.ReadMemory8(0xFF05), 0xF0 + (machine.Cycles() - start) / 16);
+    CHECK_EQ(*memory.PeekPtrAt(0xFF0F) & TIMER_IF, 0);
+
+    machine.RunUntil([due](Machine& machine) { return machine.Cycles() >= due; });
+    CHECK_EQ(*memory.PeekPtrAt(0xFF0F) & TIMER_IF, TIMER_IF);
+    CHECK_EQ(memory.ReadMemory8(0xFF05), 0xAB);
+    // and from TMA on again
+    CHECK_EQ(machine.GetScheduler().ScheduledAt(EventType::TimerOverflow), due + (0x100 - 0xAB) * 16);
+}
+
+TEST(timer, every_tac_rate)
+{
+    // 4096 Hz, 262144 Hz, 65536 Hz, 16384 Hz
+    const uint64_t cycles_per_tick[4] = { 1024, 16, 64, 256 };
+    for (uint8_t rate = 0; rate < 4; ++rate)
+    {
+        Machine machine(TestRom().Entry({ SPIN }).Build());
+        machine.RunCycles(100);
+        const uint64_t start = StartTimer(machine, 0x00, 0x00, 0x04 | rate);
+        CHECK_EQ(machine.GetScheduler().ScheduledAt(EventType::TimerOverflow), start + 256 * cycles_per_tick[rate]);
+
+        machine.RunCycles(3 * cycles_per_tick[rate] + 5);
+        CHECK_EQ(machine.GetMemory().ReadMemory8(0xFF05), (machine.Cycles() - start) / cycles_per_tick[rate]);
+    }
+}
+
+TEST(timer, div_counts_from_its_reset)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    machine.RunCycles(5000);
+    const uint64_t start = StartTimer(machine, 0x00, 0x00, 0x00);
+    CHECK(!machine.GetScheduler().IsScheduled(EventType::TimerOverflow));
+    for (int i = 0; i < 5; ++i)
+    {
+        machine.RunCycles(700);
+        CHECK_EQ(machine.GetMemory().ReadMemory8(0xFF04), static_cast<uint8_t>((machine.Cycles() - start) >> 8));
+    }
+}
+
+TEST(timer, div_reset_on_a_high_bit_ticks_tima)
+{
+    Machine machine(TestRom().Entry({ SPIN }).Build());
+    const uint64_t start = StartTimer(machine, 0x10, 0x00, 0x05);
+    Memory& memory = machine.GetMemory();
+
+    // TIMA at 262144 Hz watches bit 3 of the counter, resetting it while that's high is a falling edge
+    machine.RunUntil([start](Machine& machine) { return machine.Cycles() - start > 64 && ((machine.Cycles() - start) & 8) != 0; });
+    const uint8_t before = memory.ReadMemory8(0xFF05);
+    memory.SetMemory8(0xFF04, 0);
+    CHECK_EQ(memory.ReadMemory8(0xFF05), before + 1);
+
+    // while it's low it isn't
+    const uint64_t reset = machine.Cycles();
+    machine.RunUntil([reset](Machine& machine) { return machine.Cycles() - reset > 64 && ((machine.Cycles() - reset) & 8) == 0; });
+    const uint8_t low = memory.ReadMemory8(0xFF05);
+    memory.SetMemory8(0xFF04, 0);
+    CHECK_EQ(memory.ReadMemory8(0xFF05), low);
+}
+
+TEST(timer, overflows_reach_the_handler)
+{
+    // TIMA and TMA 0xF0 at 4096 Hz is an interrupt every 16 * 1024 cycles, the handler counts them in 0xC000
+    Machine machine(TestRom()
+        .At(0x50, { 0x21, 0x00, 0xC0, 0x34, OP_RETI }) // LD HL, 0xC000; INC (HL)
+        .Entry({
+            OP_LD_A_N, 0xF0,
+            OP_LDH_N_A, 0x05,
+            OP_LDH_N_A, 0x06,
+            OP_LD_A_N, TIMER_IF,
+            OP_LDH_N_A, 0xFF,
+            OP_XOR_A,
+            OP_LDH_N_A, 0x0F,
+            OP_LD_A_N, 0x04,
+            OP_LDH_N_A, 0x07,
+            OP_EI,
+            SPIN,
+        }).Build());
+
+    machine.RunUntil([](Machine& machine) { return machine.GetScheduler().IsScheduled(EventType::TimerOverflow); });
+    const uint64_t first = machine.GetScheduler().ScheduledAt(EventType::TimerOverflow);
+    machine.RunUntil([first](Machine& machine) { return machine.Cycles() >= first + 19 * 16 * 1024 + 100; });
+    CHECK_EQ(*machine.GetMemory().PeekPtrAt(0xC000), 20);
+}
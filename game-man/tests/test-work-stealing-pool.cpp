@@ -0,0 +1,43 @@
+#include "test.h"
+
+#include <atomic>
+
+#include "work-stealing-pool.h"
+
+TEST(pool, runs_everything_including_nested_submits)
+{
+    WorkStealingPool pool(4);
+    std::atomic<int> ran(0);
+    for (int i = 0; i < 100; ++i)
+    {
+        pool.Submit([&pool, &ran]
+        {
+            ++ran;
+            pool.Submit([&ran] { ++ran; });
+        });
+    }
+    pool.Wait();
+    CHECK_EQ(ran.load(), 200);
+}
+
+TEST(pool, a_throwing_task_comes_back_from_wait)
+{
+    WorkStealingPool pool(2);
+    std::atomic<int> ran(0);
+    for (int i = 0; i < 50; ++i)
+    {
+        pool.Submit([&ran, i]
+        {
+            if (i % 10 == 3)
+                throw std::runtime_error("task failed");
+            ++ran;
+        });
+    }
+    CHECK_THROWS(pool.Wait());
+    // the workers are still there and the rest ran
+    CHECK_EQ(ran.load(), 45);
+
+    pool.Submit([&ran] { ++ran; });
+    pool.Wait();
+    CHECK_EQ(ran.load(), 46);
+}
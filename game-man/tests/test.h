@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// just enough of a test framework for ctest, no dependencies
+// a test is a function that throws TestFailure (through the CHECK macros) when something's off,
+// tests are named "suite.case" and `gameman-tests <suite>` runs the ones whose name starts with it
+struct TestCase
+{
+    const char* name;
+    void (*run)();
+};
+
+struct TestFailure : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+std::vector<TestCase>& TestRegistry();
+bool RegisterTest(const char* name, void (*run)());
+
+// somewhere to put files a test writes, the name has to be unique across the tests
+inline std::string TempPath(const std::string& name)
+{
+    return (std::filesystem::temp_directory_path() / ("gameman-test-" + name)).string();
+}
+
+#define TEST_CONCAT_INNER(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT_INNER(a, b)
+
+// TEST(timer, overflow_timing) { ... }
+#define TEST(suite, name) \
+    static void TEST_CONCAT(suite##_, name)(); \
+    static const bool TEST_CONCAT(suite##_registered_, name) = RegisterTest(#suite "." #name, TEST_CONCAT(suite##_, name)); \
+    static void TEST_CONCAT(suite##_, name)()
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+            throw TestFailure(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": CHECK(" #cond ") failed"); \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do \
+    { \
+        const auto actual_val = (actual); \
+        const auto expected_val = (expected); \
+        if (!(actual_val == expected_val)) \
+        { \
+            std::ostringstream message; \
+            message << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #actual ", " #expected ") failed, got " \
+                << +actual_val << " expected " << +expected_val; \
+            throw TestFailure(message.str()); \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(expr) \
+    do \
+    { \
+        bool threw = false; \
+        try \
+        { \
+            expr; \
+        } \
+        catch (const std::exception&) \
+        { \
+            threw = true; \
+        } \
+        if (!threw) \
+            throw TestFailure(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " #expr " didn't throw"); \
+    } while (0)
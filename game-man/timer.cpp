@@ -0,0 +1,138 @@
+#include "timer.h"
+
+#include <cstring>
+
+Timer::Timer(Memory& memory, Scheduler& scheduler): m_Memory(memory), m_Scheduler(scheduler)
+{
+    std::memset(&this->state, 0, sizeof(this->state));
+    this->state.div_reset_cycle = scheduler.Now();
+    this->state.tima_sync_cycle = scheduler.Now();
+    this->state.tima = 0;
+    this->state.tma = 0;
+    this->state.tac = 0;
+
+    m_Memory.ConnectTimer(*this);
+    m_Scheduler.SetClient(EventType::TimerOverflow, *this);
+}
+
+uint8_t Timer::EdgeShift() const
+{
+    // 4096 Hz, 262144 Hz, 65536 Hz, 16384 Hz
+    static constexpr uint8_t shifts[4] = { 10, 4, 6, 8 };
+    return shifts[state.tac & 0b11];
+}
+
+uint64_t Timer::SystemCounterAt(uint64_t cycle) const
+{
+    return cycle - state.div_reset_cycle;
+}
+
+uint8_t Timer::TimaAt(uint64_t cycle) const
+{
+    if (!Enabled())
+        return state.tima;
+
+    const uint8_t shift = EdgeShift();
+    const uint64_t ticks = (SystemCounterAt(cycle) >> shift) - (SystemCounterAt(state.tima_sync_cycle) >> shift);
+
+    // overflows are handled by the scheduled event, so this never wraps
+    return static_cast<uint8_t>(state.tima + ticks);
+}
+
+void Timer::Sync(uint64_t cycle)
+{
+    state.tima = TimaAt(cycle);
+    state.tima_sync_cycle = cycle;
+}
+
+void Timer::ScheduleOverflow()
+{
+    if (!Enabled())
+    {
+        m_Scheduler.Cancel(EventType::TimerOverflow);
+        return;
+    }
+
+    const uint8_t shift = EdgeShift();
+    const uint64_t edges_left = 0x100 - state.tima;
+    const uint64_t overflow_counter = ((SystemCounterAt(state.tima_sync_cycle) >> shift) + edges_left) << shift;
+
+    m_Scheduler.Schedule(EventType::TimerOverflow, state.div_reset_cycle + overflow_counter);
+}
+
+void Timer::OnEvent(EventType, uint64_t cycle)
+{
+    state.tima = state.tma;
+    state.tima_sync_cycle = cycle;
+    m_Memory.RequestInterrupt(InterruptFlags::TimerOverflow);
+
+    ScheduleOverflow();
+}
+
+uint8_t Timer::ReadRegister(uint16_t offset) const
+{
+    const uint64_t now = m_Scheduler.Now();
+
+    switch (offset)
+    {
+    case 0xFF04: // DIV
+        return static_cast<uint8_t>(SystemCounterAt(now) >> 8);
+    case 0xFF05: // TIMA
+        return TimaAt(now);
+    case 0xFF06: // TMA
+        return state.tma;
+    case 0xFF07: // TAC
+        return state.tac | 0b11111000;
+    default:
+        return 0xFF;
+    }
+}
+
+void Timer::WriteRegister(uint16_t offset, uint8_t val)
+{
+    const uint64_t now = m_Scheduler.Now();
+    Sync(now);
+
+    switch (offset)
+    {
+    case 0xFF04: // DIV, any write resets it
+    {
+        // if the bit TIMA watches was high, the reset is a falling edge too
+        const bool edge = Enabled() && ((SystemCounterAt(now) >> (EdgeShift() - 1)) & 1) == 1;
+        state.div_reset_cycle = now;
+        if (edge)
+        {
+            if (state.tima == 0xFF)
+            {
+                OnEvent(EventType::TimerOverflow, now);
+                return;
+            }
+            ++state.tima;
+        }
+        break;
+    }
+    case 0xFF05: // TIMA
+        state.tima = val;
+        break;
+    case 0xFF06: // TMA
+        state.tma = val;
+        return; // doesn't move the next overflow
+    case 0xFF07: // TAC
+        state.tac = val & 0b111;
+        break;
+    default:
+        return;
+    }
+
+    ScheduleOverflow();
+}
+
+void Timer::SaveState(StateWriter& writer) const
+{
+    writer.Write("TIMR", state);
+}
+
+void Timer::LoadState(StateReader& reader)
+{
+    reader.Read("TIMR", state);
+}
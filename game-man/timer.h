@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+#include "memory.h"
+#include "scheduler.h"
+
+// DIV/TIMA/TMA/TAC, nothing here ticks, DIV and TIMA are worked out from the global cycle
+// counter when they're read and the next TIMA overflow is the only thing on the schedule
+class Timer : public SchedulerClient
+{
+public:
+    Timer(Memory& memory, Scheduler& scheduler);
+    void OnEvent(EventType type, uint64_t cycle) override;
+
+    uint8_t ReadRegister(uint16_t offset) const;
+    void WriteRegister(uint16_t offset, uint8_t val);
+
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+private:
+    bool Enabled() const
+    {
+        return (state.tac & 0b100) == 0b100;
+    }
+
+    // TIMA counts falling edges of one bit of the internal 16 bit counter, the counter is 0 at div_reset_cycle
+    uint8_t EdgeShift() const;
+    uint64_t SystemCounterAt(uint64_t cycle) const;
+    uint8_t TimaAt(uint64_t cycle) const;
+    void Sync(uint64_t cycle);
+    void ScheduleOverflow();
+
+    Memory& m_Memory;
+    Scheduler& m_Scheduler;
+
+    struct TimerState
+    {
+        uint64_t div_reset_cycle;
+        uint64_t tima_sync_cycle; // tima below is exact at this cycle
+        uint8_t tima;
+        uint8_t tma;
+        uint8_t tac;
+    };
+    TimerState state;
+};
@@ -0,0 +1,201 @@
+#include "work-stealing-pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    // which worker of which pool the current thread is, tasks submitted from inside go to its own deque
+    thread_local const void* current_pool = nullptr;
+    thread_local unsigned current_worker = 0;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned workers, bool pin_threads): running(true), queued(0), pending(0), steals(0), next_queue(0)
+{
+    if (workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 0; i < workers; ++i)
+        queues.push_back(std::make_unique<WorkerQueue>());
+
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        this->workers.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+        if (pin_threads)
+            PinToCpu(this->workers.back(), i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    WaitIdle();
+    if (error)
+    {
+        try
+        {
+            std::rethrow_exception(error);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "WorkStealingPool: a task threw and nobody called Wait: " << e.what() << "\n";
+        }
+        catch (...)
+        {
+        }
+    }
+    running.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void WorkStealingPool::PinToCpu(std::thread& thread, unsigned cpu)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (cpu % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    // no affinity api, the OS scheduler gets to decide
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+void WorkStealingPool::Submit(Task task)
+{
+    const unsigned index = current_pool == this ? current_worker
+        : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+    pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+
+    // only bother waking anyone if there could be someone asleep
+    if (queued.fetch_add(1, std::memory_order_release) < workers.size())
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake.notify_one();
+    }
+}
+
+bool WorkStealingPool::PopLocal(unsigned index, Task& task)
+{
+    WorkerQueue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::Steal(unsigned index, Task& task)
+{
+    for (std::size_t offset = 1; offset < queues.size(); ++offset)
+    {
+        WorkerQueue& victim = *queues[(index + offset) % queues.size()];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || victim.tasks.empty())
+            continue;
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        steals.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    return false;
+}
+
+void WorkStealingPool::FinishTask()
+{
+    if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        done.notify_all();
+    }
+}
+
+void WorkStealingPool::WorkerLoop(unsigned index)
+{
+    current_pool = this;
+    current_worker = index;
+
+    Task task;
+    while (running.load(std::memory_order_acquire))
+    {
+        if (PopLocal(index, task) || Steal(index, task))
+        {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+            task = nullptr;
+            FinishTask();
+            continue;
+        }
+
+        // nothing anywhere, the timeout covers a steal that lost a try_lock race
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake.wait_for(lock, std::chrono::milliseconds(1), [this]
+        {
+            return !running.load(std::memory_order_acquire) || queued.load(std::memory_order_acquire) > 0;
+        });
+    }
+}
+
+void WorkStealingPool::Wait()
+{
+    WaitIdle();
+
+    std::exception_ptr thrown = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        std::swap(thrown, error);
+    }
+    if (thrown)
+        std::rethrow_exception(thrown);
+}
+
+void WorkStealingPool::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+}
+
+unsigned WorkStealingPool::WorkerCount() const
+{
+    return static_cast<unsigned>(workers.size());
+}
+
+uint64_t WorkStealingPool::Steals() const
+{
+    return steals.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// one deque per worker, a worker works LIFO off its own and steals FIFO from the others when it runs dry
+// tasks submitted from inside a task go to the submitting worker's deque, so follow up work
+// (the next slice of the same machine) stays on the same core and its cache unless someone is idle
+// every deque has its own lock, only the owner and the occasional thief ever touch it
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    // 0 workers = one per hardware thread, pin puts worker i on cpu i
+    explicit WorkStealingPool(unsigned workers = 0, bool pin_threads = false);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    void Submit(Task task);
+    // blocks until every submitted task, and everything those submitted, has finished
+    // a task that throws doesn't take its worker down, the first exception since the last Wait is rethrown here
+    void Wait();
+
+    unsigned WorkerCount() const;
+    uint64_t Steals() const;
+private:
+    struct alignas(64) WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerLoop(unsigned index);
+    bool PopLocal(unsigned index, Task& task);
+    bool Steal(unsigned index, Task& task);
+    void FinishTask();
+    void WaitIdle();
+    static void PinToCpu(std::thread& thread, unsigned cpu);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<bool> running;
+    std::atomic<uint64_t> queued; // sitting in some deque, lets idle workers go to sleep
+    std::atomic<uint64_t> pending; // queued or running
+    std::atomic<uint64_t> steals;
+    std::atomic<unsigned> next_queue; // round robin for submits from outside the pool
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::mutex done_mutex;
+    std::condition_variable done;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};